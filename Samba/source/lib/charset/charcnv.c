@@ -22,6 +22,9 @@
 */
 #include "includes.h"
 #include "system/iconv.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /**
  * @file
@@ -57,6 +60,20 @@ static const char *charset_name(charset_t ch)
 
 static smb_iconv_t conv_handles[NUM_CHARSETS][NUM_CHARSETS];
 
+/*
+  what the conversions that bypass iconv know about a charset
+*/
+enum fast_charset {
+	FAST_CHARSET_UNKNOWN = 0,	/* not looked at yet */
+	FAST_CHARSET_NONE,		/* iconv only */
+	FAST_CHARSET_ASCII,		/* a superset of ASCII, nothing more */
+	FAST_CHARSET_LATIN1,
+	FAST_CHARSET_UTF8,
+	FAST_CHARSET_UTF16LE
+};
+
+static enum fast_charset fast_charsets[NUM_CHARSETS];
+
 /**
  re-initialize iconv conversion descriptors
 **/
@@ -74,14 +91,15 @@ _PUBLIC_ void init_iconv(void)
 		}
 	}
 
+	/* the charset names may have changed */
+	memset(fast_charsets, 0, sizeof(fast_charsets));
 }
 
 /*
-  on-demand initialisation of conversion handles
+  first time setup, before any conversion is done
 */
-static smb_iconv_t get_conv_handle(charset_t from, charset_t to)
+static void charcnv_init(void)
 {
-	const char *n1, *n2;
 	static int initialised;
 	/* auto-free iconv memory on exit so valgrind reports are easier
 	   to look at */
@@ -100,6 +118,16 @@ static smb_iconv_t get_conv_handle(charset_t from, charset_t to)
 
 		atexit(init_iconv);
 	}
+}
+
+/*
+  on-demand initialisation of conversion handles
+*/
+static smb_iconv_t get_conv_handle(charset_t from, charset_t to)
+{
+	const char *n1, *n2;
+
+	charcnv_init();
 
 	if (conv_handles[from][to]) {
 		return conv_handles[from][to];
@@ -128,6 +156,389 @@ static smb_iconv_t get_conv_handle(charset_t from, charset_t to)
 }
 
 
+/*
+  Conversions between UTF-16LE, UTF-8, Latin-1 and pure ASCII in the
+  DOS codepages are done here rather than by iconv. A first pass works
+  out the exact size of the result, the second one converts into a
+  buffer of that size. Runs of ASCII, by far the most common case in
+  RPC traffic, are handled 16 bytes at a time where SSE2 is available.
+
+  Anything these do not handle, including invalid input, is left to
+  iconv, so errors are reported just as they were before.
+*/
+
+/* the DOS and Windows codepages that extend ASCII, not the EBCDIC ones */
+static const unsigned int ascii_codepages[] = {
+	437, 720, 737, 775, 850, 852, 855, 857, 858, 860, 861, 862, 863,
+	864, 865, 866, 869, 874, 1250, 1251, 1252, 1253, 1254, 1255, 1256,
+	1257, 1258
+};
+
+static enum fast_charset fast_charset_classify(const char *name)
+{
+	const char *p;
+	char *end;
+	unsigned long cp;
+	unsigned int i;
+
+	if (name == NULL) {
+		return FAST_CHARSET_NONE;
+	}
+	if (strcasecmp(name, "UTF-16LE") == 0) {
+		return FAST_CHARSET_UTF16LE;
+	}
+	if (strcasecmp(name, "UTF8") == 0 || strcasecmp(name, "UTF-8") == 0) {
+		return FAST_CHARSET_UTF8;
+	}
+	if (strcasecmp(name, "ISO-8859-1") == 0 ||
+	    strcasecmp(name, "ISO8859-1") == 0 ||
+	    strcasecmp(name, "LATIN1") == 0) {
+		return FAST_CHARSET_LATIN1;
+	}
+	if (strcasecmp(name, "ASCII") == 0 ||
+	    strcasecmp(name, "US-ASCII") == 0 ||
+	    strncasecmp(name, "ISO-8859-", 9) == 0 ||
+	    strncasecmp(name, "ISO8859-", 8) == 0) {
+		return FAST_CHARSET_ASCII;
+	}
+
+	if (strncasecmp(name, "CP", 2) == 0) {
+		p = name + 2;
+	} else if (strncasecmp(name, "IBM", 3) == 0) {
+		p = name + 3;
+	} else {
+		return FAST_CHARSET_NONE;
+	}
+	cp = strtoul(p, &end, 10);
+	if (end == p || *end != 0) {
+		return FAST_CHARSET_NONE;
+	}
+	for (i = 0; i < ARRAY_SIZE(ascii_codepages); i++) {
+		if (cp == ascii_codepages[i]) {
+			return FAST_CHARSET_ASCII;
+		}
+	}
+	return FAST_CHARSET_NONE;
+}
+
+static enum fast_charset fast_charset_of(charset_t ch)
+{
+	if (fast_charsets[ch] == FAST_CHARSET_UNKNOWN) {
+		charcnv_init();
+		fast_charsets[ch] = fast_charset_classify(charset_name(ch));
+	}
+	return fast_charsets[ch];
+}
+
+/* the number of bytes at the start of src that are ASCII */
+static size_t ascii_run8(const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		if (_mm_movemask_epi8(v) != 0) {
+			break;
+		}
+	}
+#endif
+	while (i < n && src[i] < 0x80) {
+		i++;
+	}
+	return i;
+}
+
+/* the number of UTF-16LE units at the start of src that are ASCII */
+static size_t ascii_run16(const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i high = _mm_set1_epi16((short)0xff80);
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 2*i));
+		v = _mm_cmpeq_epi16(_mm_and_si128(v, high), zero);
+		if (_mm_movemask_epi8(v) != 0xffff) {
+			break;
+		}
+	}
+#endif
+	while (i < n && src[2*i] < 0x80 && src[2*i+1] == 0) {
+		i++;
+	}
+	return i;
+}
+
+/* n UTF-16LE units below 0x100 to bytes */
+static void narrow16(uint8_t *dest, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + 2*i));
+		_mm_storel_epi64((__m128i *)(dest + i), _mm_packus_epi16(v, v));
+	}
+#endif
+	for (; i < n; i++) {
+		dest[i] = src[2*i];
+	}
+}
+
+/* n bytes to UTF-16LE units */
+static void widen8(uint8_t *dest, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dest + 2*i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)(dest + 2*i + 16), _mm_unpackhi_epi8(v, zero));
+	}
+#endif
+	for (; i < n; i++) {
+		dest[2*i] = src[i];
+		dest[2*i+1] = 0;
+	}
+}
+
+/* store a codepoint as UTF-8 if dest is not NULL, return its length */
+static size_t put_utf8(uint8_t *dest, codepoint_t c)
+{
+	if (c < 0x80) {
+		if (dest) dest[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		if (dest) {
+			dest[0] = 0xc0 | (c >> 6);
+			dest[1] = 0x80 | (c & 0x3f);
+		}
+		return 2;
+	}
+	if (c < 0x10000) {
+		if (dest) {
+			dest[0] = 0xe0 | (c >> 12);
+			dest[1] = 0x80 | ((c >> 6) & 0x3f);
+			dest[2] = 0x80 | (c & 0x3f);
+		}
+		return 3;
+	}
+	if (dest) {
+		dest[0] = 0xf0 | (c >> 18);
+		dest[1] = 0x80 | ((c >> 12) & 0x3f);
+		dest[2] = 0x80 | ((c >> 6) & 0x3f);
+		dest[3] = 0x80 | (c & 0x3f);
+	}
+	return 4;
+}
+
+/*
+  decode one UTF-8 character, return the number of bytes used or 0 for
+  anything that is not strictly valid (overlong forms, surrogates,
+  codepoints above 0x10FFFF, truncated sequences)
+*/
+static size_t get_utf8(const uint8_t *src, size_t n, codepoint_t *c)
+{
+	uint8_t b = src[0];
+	size_t len, i;
+	codepoint_t v, min;
+
+	if (b < 0x80) {
+		*c = b;
+		return 1;
+	} else if (b >= 0xc2 && b < 0xe0) {
+		len = 2; v = b & 0x1f; min = 0x80;
+	} else if (b >= 0xe0 && b < 0xf0) {
+		len = 3; v = b & 0x0f; min = 0x800;
+	} else if (b >= 0xf0 && b < 0xf5) {
+		len = 4; v = b & 0x07; min = 0x10000;
+	} else {
+		return 0;
+	}
+	if (n < len) {
+		return 0;
+	}
+	for (i = 1; i < len; i++) {
+		if ((src[i] & 0xc0) != 0x80) {
+			return 0;
+		}
+		v = (v << 6) | (src[i] & 0x3f);
+	}
+	if (v < min || v > 0x10ffff || (v >= 0xd800 && v < 0xe000)) {
+		return 0;
+	}
+	*c = v;
+	return len;
+}
+
+/* n UTF-16LE units to UTF-8, measured only if dest is NULL */
+static ssize_t utf16_to_utf8(const uint8_t *src, size_t n, uint8_t *dest)
+{
+	size_t i = 0, len = 0, run;
+	codepoint_t c, c2;
+
+	while (i < n) {
+		run = ascii_run16(src + 2*i, n - i);
+		if (dest) narrow16(dest + len, src + 2*i, run);
+		i += run;
+		len += run;
+		if (i == n) {
+			break;
+		}
+
+		c = SVAL(src, 2*i);
+		i++;
+		if (c >= 0xd800 && c < 0xdc00) {
+			if (i == n) {
+				return -1;
+			}
+			c2 = SVAL(src, 2*i);
+			if (c2 < 0xdc00 || c2 >= 0xe000) {
+				return -1;
+			}
+			i++;
+			c = 0x10000 + ((c - 0xd800) << 10) + (c2 - 0xdc00);
+		} else if (c >= 0xdc00 && c < 0xe000) {
+			return -1;
+		}
+		len += put_utf8(dest ? dest + len : NULL, c);
+	}
+	return len;
+}
+
+/* n bytes of UTF-8 to UTF-16LE, measured only if dest is NULL */
+static ssize_t utf8_to_utf16(const uint8_t *src, size_t n, uint8_t *dest)
+{
+	size_t i = 0, len = 0, run, size;
+	codepoint_t c;
+
+	while (i < n) {
+		run = ascii_run8(src + i, n - i);
+		if (dest) widen8(dest + len, src + i, run);
+		i += run;
+		len += 2*run;
+		if (i == n) {
+			break;
+		}
+
+		size = get_utf8(src + i, n - i, &c);
+		if (size == 0) {
+			return -1;
+		}
+		i += size;
+		if (c < 0x10000) {
+			if (dest) SSVAL(dest, len, c);
+			len += 2;
+		} else {
+			c -= 0x10000;
+			if (dest) {
+				SSVAL(dest, len, 0xd800 | (c >> 10));
+				SSVAL(dest, len + 2, 0xdc00 | (c & 0x3ff));
+			}
+			len += 4;
+		}
+	}
+	return len;
+}
+
+/* n bytes of Latin-1 to UTF-8, measured only if dest is NULL */
+static ssize_t latin1_to_utf8(const uint8_t *src, size_t n, uint8_t *dest)
+{
+	size_t i = 0, len = 0, run;
+
+	while (i < n) {
+		run = ascii_run8(src + i, n - i);
+		if (dest) memcpy(dest + len, src + i, run);
+		i += run;
+		len += run;
+		if (i == n) {
+			break;
+		}
+		len += put_utf8(dest ? dest + len : NULL, src[i]);
+		i++;
+	}
+	return len;
+}
+
+/*
+  convert without iconv if the charsets and the string allow it.
+  Returns the size of the result, which is only measured if dest is
+  NULL, or -1 if iconv has to do it.
+*/
+static ssize_t fast_convert(charset_t from, charset_t to,
+			    const void *src, size_t srclen, void *dest)
+{
+	const uint8_t *s = (const uint8_t *)src;
+	uint8_t *d = (uint8_t *)dest;
+	enum fast_charset f = fast_charset_of(from);
+	enum fast_charset t = fast_charset_of(to);
+
+	switch (f) {
+	case FAST_CHARSET_UTF16LE:
+		if (srclen & 1) {
+			return -1;
+		}
+		if (t == FAST_CHARSET_UTF8) {
+			return utf16_to_utf8(s, srclen/2, d);
+		}
+		if (t == FAST_CHARSET_ASCII || t == FAST_CHARSET_LATIN1) {
+			if (ascii_run16(s, srclen/2) != srclen/2) {
+				return -1;
+			}
+			if (d) narrow16(d, s, srclen/2);
+			return srclen/2;
+		}
+		return -1;
+
+	case FAST_CHARSET_UTF8:
+		if (t == FAST_CHARSET_UTF16LE) {
+			return utf8_to_utf16(s, srclen, d);
+		}
+		if (t == FAST_CHARSET_ASCII || t == FAST_CHARSET_LATIN1) {
+			break;
+		}
+		return -1;
+
+	case FAST_CHARSET_LATIN1:
+		if (t == FAST_CHARSET_UTF8) {
+			return latin1_to_utf8(s, srclen, d);
+		}
+		if (t == FAST_CHARSET_UTF16LE) {
+			if (d) widen8(d, s, srclen);
+			return 2*srclen;
+		}
+		if (t == FAST_CHARSET_ASCII) {
+			break;
+		}
+		return -1;
+
+	case FAST_CHARSET_ASCII:
+		if (t == FAST_CHARSET_UTF16LE) {
+			if (ascii_run8(s, srclen) != srclen) {
+				return -1;
+			}
+			if (d) widen8(d, s, srclen);
+			return 2*srclen;
+		}
+		if (t == FAST_CHARSET_UTF8 || t == FAST_CHARSET_LATIN1 ||
+		    t == FAST_CHARSET_ASCII) {
+			break;
+		}
+		return -1;
+
+	default:
+		return -1;
+	}
+
+	/* pure ASCII is the same in both */
+	if (ascii_run8(s, srclen) != srclen) {
+		return -1;
+	}
+	if (d) memcpy(d, s, srclen);
+	return srclen;
+}
+
 /**
  * Convert string from one encoding to another, making error checking etc
  *
@@ -146,10 +557,16 @@ _PUBLIC_ ssize_t convert_string(charset_t from, charset_t to,
 	const char* inbuf = (const char*)src;
 	char* outbuf = (char*)dest;
 	smb_iconv_t descriptor;
+	ssize_t len;
 
 	if (srclen == (size_t)-1)
 		srclen = strlen(src)+1;
 
+	len = fast_convert(from, to, src, srclen, NULL);
+	if (len != -1 && (size_t)len <= destlen) {
+		return fast_convert(from, to, src, srclen, dest);
+	}
+
 	descriptor = get_conv_handle(from, to);
 
 	if (descriptor == (smb_iconv_t)-1 || descriptor == (smb_iconv_t)0) {
@@ -208,12 +625,27 @@ _PUBLIC_ ssize_t convert_string_talloc(TALLOC_CTX *ctx, charset_t from, charset_
 	const char *inbuf = (const char *)src;
 	char *outbuf, *ob;
 	smb_iconv_t descriptor;
+	ssize_t len;
 
 	*dest = NULL;
 
 	if (src == NULL || srclen == (size_t)-1 || srclen == 0)
 		return (size_t)-1;
 
+	len = fast_convert(from, to, src, srclen, NULL);
+	if (len != -1) {
+		/* room for a terminator in all charsets */
+		ob = talloc_array(ctx, char, len + 2);
+		if (!ob) {
+			DEBUG(0, ("convert_string_talloc: alloc failed!\n"));
+			return (size_t)-1;
+		}
+		fast_convert(from, to, src, srclen, ob);
+		SSVAL(ob, len, 0);
+		*dest = ob;
+		return len;
+	}
+
 	descriptor = get_conv_handle(from, to);
 
 	if (descriptor == (smb_iconv_t)-1 || descriptor == (smb_iconv_t)0) {
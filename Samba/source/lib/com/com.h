@@ -25,7 +25,9 @@
 struct IUnknown_vtable;
 
 enum {
-        COM_EXT_WMI_CLASS_CACHE = 1
+        COM_EXT_WMI_CLASS_CACHE = 1,
+        COM_EXT_WMI_SESSION_POOL = 2,
+        COM_EXT_WMI_SERVICES_NAMESPACES = 3
 };
 
 struct com_context 
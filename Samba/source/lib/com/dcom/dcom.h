@@ -25,12 +25,29 @@ struct cli_credentials;
 struct dcerpc_pipe;
 struct IRemUnknown;
 struct rpc_request;
+struct dcom_release_queue;
+struct REMINTERFACEREF;
 
 #include "lib/com/com.h"
 #include "librpc/gen_ndr/orpc.h"
 
 #define NT_STATUS_RPC_NT_CALL_FAILED	NT_STATUS(0xC002001BL)
 
+/* number of connections kept open to a single object exporter */
+#define DCOM_MAX_PIPES_PER_OXID	4
+
+/* delay before racing the next string binding against a slow connect */
+#define DCOM_CONNECT_STAGGER_MSEC	250
+
+/* seconds a host's activation binding is trusted without a ServerAlive */
+#define DCOM_ACTIVATION_CACHE_TTL	300
+
+/* how long releases are held back to share a RemRelease call */
+#define DCOM_RELEASE_DELAY_MSEC	20
+
+/* references queued on an object exporter before they are sent regardless */
+#define DCOM_RELEASE_BATCH_MAX	64
+
 typedef NTSTATUS (*marshal_fn)(struct IUnknown *pv, struct OBJREF *o);
 typedef NTSTATUS (*unmarshal_fn)(struct OBJREF *o, struct IUnknown **pv);
 
@@ -42,12 +59,31 @@ struct dcom_client_context {
 		struct cli_credentials *credentials;
 		struct dcom_server_credentials *prev, *next;
 	} *credentials;
+	struct dcom_last_binding {
+		const char *host;
+		char *network_addr;	/* the string binding that answered */
+		struct dcom_last_binding *prev, *next;
+	} *last_bindings;
+	struct dcom_activation_cache {
+		const char *server;
+		struct dcerpc_binding *binding;	/* answered ServerAlive */
+		struct COMVERSION version;
+		time_t expires;
+		struct dcom_activation_cache *prev, *next;
+	} *activation_cache;
 	struct dcom_object_exporter {
 		uint64_t oxid;
 		char *host;
 		struct IRemUnknown *rem_unknown;
 		struct DUALSTRINGARRAY *bindings;
-		struct dcerpc_pipe *pipe;
+		struct dcom_ox_pipe {
+			struct dcerpc_pipe *pipe;
+			uint32_t handouts;	/* picked, call not sent yet */
+			struct dcom_ox_pipe *prev, *next;
+		} *pipes;
+		uint32_t num_pipes;	/* pooled plus still connecting */
+		uint32_t max_pipes;
+		struct dcom_release_queue *releases;	/* not sent yet */
 		struct dcom_object_exporter *prev, *next;
 	} *object_exporters;
 };
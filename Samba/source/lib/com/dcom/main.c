@@ -32,6 +32,7 @@
 #include "lib/com/dcom/dcom.h"
 #include "librpc/rpc/dcerpc_table.h"
 #include "lib/util/dlinklist.h"
+#include "lib/events/events.h"
 #include "auth/credentials/credentials.h"
 #include "libcli/composite/composite.h"
 
@@ -149,6 +150,47 @@ void dcom_set_server_credentials(struct com_context *ctx, const char *server,
     DLIST_ADD(ctx->dcom->credentials, c);
 }
 
+/*
+ * Remember which of a host's string bindings we last connected to, so the
+ * next connection to it tries that one first.
+ */
+void dcom_set_last_binding(struct com_context *ctx, const char *host,
+        const char *network_addr)
+{
+    struct dcom_last_binding *b;
+
+    for (b = ctx->dcom->last_bindings; b; b = b->next)
+    {
+        if (strcasecmp(b->host, host) == 0)
+            break;
+    }
+    if (b == NULL)
+    {
+        b = talloc_zero(ctx->dcom, struct dcom_last_binding);
+        if (b == NULL) return;
+        b->host = talloc_strdup(b, host);
+        DLIST_ADD(ctx->dcom->last_bindings, b);
+    }
+    else if (strcmp(b->network_addr, network_addr) == 0)
+    {
+        return;
+    }
+    talloc_free(b->network_addr);
+    b->network_addr = talloc_strdup(b, network_addr);
+}
+
+const char *dcom_get_last_binding(struct com_context *ctx, const char *host)
+{
+    struct dcom_last_binding *b;
+
+    for (b = ctx->dcom->last_bindings; b; b = b->next)
+    {
+        if (strcasecmp(b->host, host) == 0)
+            return b->network_addr;
+    }
+    return NULL;
+}
+
 void dcom_update_credentials_for_aliases(struct com_context *ctx,
         const char *server, struct DUALSTRINGARRAY *pds)
 {
@@ -307,33 +349,84 @@ static void remote_activation_complete(struct rpc_request *rpc_req)
 }
 
 /*
- * Continue the remote activation request following a connect by issuing the
- * RemoteActivation call after all the preliminary negotiation has been
- * completed.
+ * Look up the binding and COM version a recent activation on the server
+ * negotiated. Stale entries are dropped.
  */
-static void remote_activation_continue(struct composite_context *ctx)
+static struct dcom_activation_cache *activation_cache_find(
+        struct com_context *ctx, const char *server)
 {
-    static uint16_t protseq[] = DCOM_NEGOTIATED_PROTOCOLS;
+    struct dcom_activation_cache *e;
 
-    struct composite_context *c = NULL;
-    struct dcom_activation_state *s = NULL;
-    struct dcerpc_pipe *p = NULL;
-    struct RemoteActivation *r = NULL;
-    struct rpc_request *rpc_req = NULL;
+    for (e = ctx->dcom->activation_cache; e; e = e->next)
+    {
+        if (strcasecmp(e->server, server) != 0)
+            continue;
+        if (e->expires > time(NULL))
+            return e;
+        DLIST_REMOVE(ctx->dcom->activation_cache, e);
+        talloc_free(e);
+        break;
+    }
+    return NULL;
+}
 
-    /* retrieve the parent composite context */
-    c = talloc_get_type(ctx->async.private_data, struct composite_context);
-    if (!composite_is_ok(c)) return;
+/*
+ * Remember the binding that answered ServerAlive for the server, so
+ * activations over the next DCOM_ACTIVATION_CACHE_TTL seconds can skip it.
+ */
+static void activation_cache_store(struct com_context *ctx,
+        const char *server, const struct dcerpc_binding *binding,
+        const struct COMVERSION *version)
+{
+    struct dcom_activation_cache *e;
+    const char *bindstr;
 
-    /* retrieve the activation state data */
-    s = talloc_get_type(c->private_data, struct dcom_activation_state);
+    e = activation_cache_find(ctx, server);
+    if (e == NULL)
+    {
+        e = talloc_zero(ctx->dcom, struct dcom_activation_cache);
+        if (e == NULL) return;
+        e->server = talloc_strdup(e, server);
+        DLIST_ADD(ctx->dcom->activation_cache, e);
+    }
 
-    /*
-     * complete the pipe connect and receive a pointer to the dcerpc_pipe
-     * structure
-     */
-    c->status = dcerpc_pipe_connect_b_recv(ctx, c, &p);
-    if (!composite_is_ok(c)) return;
+    talloc_free(e->binding);
+    e->binding = NULL;
+    bindstr = dcerpc_binding_string(e, binding);
+    if (e->server == NULL || bindstr == NULL ||
+            !NT_STATUS_IS_OK(dcerpc_parse_binding(e, bindstr, &e->binding)))
+    {
+        DLIST_REMOVE(ctx->dcom->activation_cache, e);
+        talloc_free(e);
+        return;
+    }
+    e->version = *version;
+    e->expires = time(NULL) + DCOM_ACTIVATION_CACHE_TTL;
+}
+
+static void activation_cache_forget(struct com_context *ctx,
+        const char *server)
+{
+    struct dcom_activation_cache *e = activation_cache_find(ctx, server);
+
+    if (e != NULL)
+    {
+        DLIST_REMOVE(ctx->dcom->activation_cache, e);
+        talloc_free(e);
+    }
+}
+
+/*
+ * Issue the RemoteActivation call on a pipe to the IRemoteActivation
+ * interface after all the preliminary negotiation has been completed.
+ */
+static void send_remote_activation(struct composite_context *c,
+        struct dcom_activation_state *s, struct dcerpc_pipe *p)
+{
+    static uint16_t protseq[] = DCOM_NEGOTIATED_PROTOCOLS;
+
+    struct RemoteActivation *r = NULL;
+    struct rpc_request *rpc_req = NULL;
 
     /*
      * Prepare arguments for the RemoteActivation call. Refer to 3.1.4.1.1.2
@@ -388,6 +481,33 @@ static void remote_activation_continue(struct composite_context *ctx)
     composite_continue_rpc(c, rpc_req, remote_activation_complete, c);
 }
 
+/*
+ * Continue the remote activation request following a connect by issuing the
+ * RemoteActivation call.
+ */
+static void remote_activation_continue(struct composite_context *ctx)
+{
+    struct composite_context *c = NULL;
+    struct dcom_activation_state *s = NULL;
+    struct dcerpc_pipe *p = NULL;
+
+    /* retrieve the parent composite context */
+    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+    if (!composite_is_ok(c)) return;
+
+    /* retrieve the activation state data */
+    s = talloc_get_type(c->private_data, struct dcom_activation_state);
+
+    /*
+     * complete the pipe connect and receive a pointer to the dcerpc_pipe
+     * structure
+     */
+    c->status = dcerpc_pipe_connect_b_recv(ctx, c, &p);
+    if (!composite_is_ok(c)) return;
+
+    send_remote_activation(c, s, p);
+}
+
 /**
  * Continue the RPC IOXIDResolver:ServerAlive call by receiving the
  * response and processing the results.
@@ -426,6 +546,9 @@ static void determine_rpc_binding_continue2(struct rpc_request *rpc_ctx)
     s->negotiated_version.MajorVersion = COM_MAJOR_VERSION;
     s->negotiated_version.MinorVersion = COM_MINOR_VERSION;
 
+    activation_cache_store(s->com_ctx, s->server, s->binding,
+            &s->negotiated_version);
+
     /*
      * Proceed with the activating request using the same binding that was
      * successful for the ServerAlive call and try to retrieve a pipe to
@@ -572,6 +695,39 @@ static void complete_activation(struct composite_context *ctx)
     composite_done(c);
 }
 
+/*
+ * Continue an activation that skipped ServerAlive because the server was
+ * activated on recently. Should the cached binding no longer connect, forget
+ * it and take the long way round.
+ */
+static void activation_cached_continue(struct composite_context *ctx)
+{
+    struct composite_context *c = NULL;
+    struct composite_context *binding_ctx = NULL;
+    struct dcom_activation_state *s = NULL;
+    struct dcerpc_pipe *p = NULL;
+    NTSTATUS status;
+
+    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+    s = talloc_get_type(c->private_data, struct dcom_activation_state);
+
+    status = dcerpc_pipe_connect_b_recv(ctx, c, &p);
+    if (!NT_STATUS_IS_OK(status))
+    {
+        DEBUG(3, ("dcom_activate: cached binding for %s failed: %s\n",
+                s->server, nt_errstr(status)));
+        activation_cache_forget(s->com_ctx, s->server);
+
+        binding_ctx = dcom_determine_rpc_binding(c, s->server, s, c);
+        if (composite_nomem(binding_ctx, c)) return;
+
+        composite_continue(c, binding_ctx, complete_activation, c);
+        return;
+    }
+
+    send_remote_activation(c, s, p);
+}
+
 /*
  * Begin an asynchronous DCOM object activation request.
  *
@@ -589,6 +745,9 @@ struct composite_context *dcom_activate_send(TALLOC_CTX *parent_ctx,
     struct composite_context *c = NULL;
     struct dcom_activation_state *s = NULL;
     struct composite_context *binding_ctx = NULL;
+    struct composite_context *pipe_conn_req = NULL;
+    struct dcom_activation_cache *cached = NULL;
+    const char *bindstr = NULL;
 
     /* composite context allocation and setup */
     c = composite_create(parent_ctx, com_ctx->event_ctx);
@@ -605,6 +764,32 @@ struct composite_context *dcom_activate_send(TALLOC_CTX *parent_ctx,
     s->iid = *iid;
     s->num_ifaces = num_ifaces;
 
+    /*
+     * A server activated on within the last DCOM_ACTIVATION_CACHE_TTL seconds
+     * is known to be alive, so go straight to RemoteActivation using the
+     * binding and COM version found then.
+     */
+    cached = activation_cache_find(com_ctx, server);
+    if (cached != NULL)
+    {
+        bindstr = dcerpc_binding_string(c, cached->binding);
+        if (bindstr != NULL && NT_STATUS_IS_OK(dcerpc_parse_binding(c,
+                bindstr, &s->binding)))
+        {
+            DEBUG(3, ("dcom_activate: using cached binding %s\n", bindstr));
+            s->negotiated_version = cached->version;
+
+            pipe_conn_req = dcerpc_pipe_connect_b_send(c, s->binding,
+                    &dcerpc_table_IRemoteActivation,
+                    dcom_get_server_credentials(com_ctx, server),
+                    c->event_ctx);
+            if (composite_nomem(pipe_conn_req, c)) return c;
+
+            composite_continue(c, pipe_conn_req, activation_cached_continue, c);
+            return c;
+        }
+    }
+
     /*
      * Begin the DCOM object activation by first attempting to determine the
      * correct RPC binding to use and what COM version should be used. This
@@ -681,6 +866,7 @@ struct dcom_object_exporter *object_exporter_update_oxid(
         ox = talloc_zero(ctx, struct dcom_object_exporter);
         DLIST_ADD(ctx->dcom->object_exporters, ox);
         ox->oxid = oxid;
+        ox->max_pipes = DCOM_MAX_PIPES_PER_OXID;
     }
     else
     {
@@ -972,12 +1158,89 @@ struct dcom_get_pipe_state
     struct IUnknown *iface;             /* the requested interface */
     struct dcom_object_exporter *ox;    /* the object exporter for it */
     struct dcerpc_pipe *p;              /* the final pipe */
+    struct dcom_ox_pipe *op;            /* its pool entry */
+    BOOL connecting;                    /* counted in ox->num_pipes */
+
+    const char *host;                   /* host name the bindings are for */
+    int *order;                         /* binding indexes, in try order */
+    int num_order;
+    int next_attempt;
+    struct dcom_connect_attempt *attempts;  /* still connecting */
+    struct timed_event *stagger_te;
+};
 
-    int similar_binding_index;
-    int current_binding_index;
-    int current_binding_offset;
+/*
+ * One of the connection attempts raced by bind_new_pipe.
+ */
+struct dcom_connect_attempt
+{
+    struct composite_context *c;        /* the dcom_get_pipe request */
+    struct composite_context *ctx;      /* the dcerpc_pipe_connect_b one */
+    int index;                          /* into ox->bindings */
+    struct dcom_connect_attempt *prev, *next;
 };
 
+/*
+ * Count the calls a pooled pipe has outstanding on its connection. Calls that
+ * are queued but not yet shipped pick up the pipe's context id when they go
+ * out, so a pipe with queued calls must not be re-targeted.
+ */
+static uint32_t dcom_pipe_calls(struct dcerpc_pipe *p, uint32_t *queued)
+{
+    struct rpc_request *req;
+    uint32_t calls = 0;
+
+    *queued = 0;
+    for (req = p->conn->pending; req; req = req->next)
+    {
+        if (req->p == p) calls++;
+    }
+    for (req = p->conn->request_queue; req; req = req->next)
+    {
+        if (req->p == p) (*queued)++;
+    }
+    return calls + *queued;
+}
+
+/*
+ * Add a freshly bound pipe to the object exporter's pool. The object exporter
+ * owns pooled pipes; every call handed one holds a reference to it, so the
+ * pipe outlives the call that created it and survives being dropped from the
+ * pool while calls are still using it.
+ */
+static struct dcom_ox_pipe *dcom_ox_pipe_add(struct dcom_object_exporter *ox,
+        struct dcerpc_pipe *p)
+{
+    struct dcom_ox_pipe *op;
+
+    op = talloc_zero(ox, struct dcom_ox_pipe);
+    if (op == NULL) return NULL;
+    op->pipe = p;
+    talloc_steal(ox, p);
+    DLIST_ADD_END(ox->pipes, op, struct dcom_ox_pipe *);
+    return op;
+}
+
+/*
+ * Take a pipe out of the pool. It is freed unless a call still holds a
+ * reference to it, in which case the last of those calls frees it.
+ */
+static void dcom_ox_pipe_drop(struct dcom_object_exporter *ox,
+        struct dcom_ox_pipe *op)
+{
+    struct dcerpc_pipe *p = op->pipe;
+
+    DLIST_REMOVE(ox->pipes, op);
+    ox->num_pipes--;
+    /* a pending dcom_get_pipe still points at the entry, it frees it */
+    op->pipe = NULL;
+    if (op->handouts == 0)
+        talloc_free(op);
+
+    /* p may be gone after this */
+    talloc_unlink(ox, p);
+}
+
 /*
  * Complete the alter_context PDU request for an existing pipe so it can be
  * used again for the requested interface.
@@ -996,25 +1259,38 @@ static void reuse_existing_pipe_continue(struct composite_context *ctx)
 }
 
 /*
- * Reuse an existing pipe already on the object exporter. If the pipe isn't
- * presently bound to the GUID for the requested interface then an alter_context
- * PDU request is sent off, otherwise the pipe is used as-is.
+ * Reuse a pipe already on the object exporter. If the pipe isn't presently
+ * bound to the GUID for the requested interface it is switched to a context
+ * the connection negotiated earlier, or else an alter_context PDU request is
+ * sent off. Otherwise the pipe is used as-is.
  */
-static void reuse_existing_pipe(struct composite_context *c)
+static void reuse_existing_pipe(struct composite_context *c,
+        struct dcom_ox_pipe *op)
 {
     struct composite_context *new_ctx = NULL;
     struct dcom_get_pipe_state *s = NULL;
-    struct dcerpc_pipe *p = NULL;
+    struct dcerpc_pipe *p = op->pipe;
+    const struct dcerpc_syntax_id *syntax = NULL;
 
     s = talloc_get_type(c->private_data, struct dcom_get_pipe_state);
-    p = s->p = s->ox->pipe;
+    s->p = p;
+    s->op = op;
+    op->handouts++;
+    talloc_reference(s, p);
 
     if (!GUID_equal(&p->syntax.uuid, &s->iface->vtable->iid))
     {
-        s->ox->pipe->syntax.uuid = s->iface->vtable->iid;
+        syntax = &idl_iface_by_uuid(&s->iface->vtable->iid)->syntax_id;
+        if (dcerpc_select_context(p, syntax, &p->transfer_syntax))
+        {
+            c->status = NT_STATUS_OK;
+            composite_done(c);
+            return;
+        }
+
+        p->syntax.uuid = s->iface->vtable->iid;
 
-        new_ctx = dcerpc_alter_context_send(p, c,
-                &idl_iface_by_uuid(&s->iface->vtable->iid)->syntax_id,
+        new_ctx = dcerpc_alter_context_send(p, c, syntax,
                 &p->transfer_syntax);
         if (composite_nomem(new_ctx, c)) return;
 
@@ -1028,131 +1304,181 @@ static void reuse_existing_pipe(struct composite_context *c)
 }
 
 /* forward reference */
-static void try_next_binding(struct composite_context *c,
+static void start_next_attempt(struct composite_context *c,
         struct dcom_get_pipe_state *s);
 
+/*
+ * Give up on the connection attempts still running, the first one to answer
+ * has won.
+ */
+static void cancel_attempts(struct dcom_get_pipe_state *s)
+{
+    struct dcom_connect_attempt *a;
+
+    while ((a = s->attempts) != NULL)
+    {
+        DLIST_REMOVE(s->attempts, a);
+        talloc_free(a);
+    }
+    talloc_free(s->stagger_te);
+    s->stagger_te = NULL;
+}
+
 /*
  * Continues a new pipe binding request by determining if the specific binding
- * attempt was successful.
+ * attempt was successful. The first attempt to succeed cancels the others,
+ * a failed one makes way for the next binding straight away.
  */
 static void bind_new_pipe_continue(struct composite_context *ctx)
 {
+    struct dcom_connect_attempt *a = NULL;
     struct composite_context *c = NULL;
     struct dcom_get_pipe_state *s = NULL;
     struct dcerpc_pipe *p = NULL;
     const struct STRINGBINDING *sb = NULL;
     NTSTATUS status;
 
-    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+    a = talloc_get_type(ctx->async.private_data, struct dcom_connect_attempt);
+    c = a->c;
     s = talloc_get_type(c->private_data, struct dcom_get_pipe_state);
-    sb = s->ox->bindings->stringbindings[s->current_binding_offset];
+    sb = s->ox->bindings->stringbindings[a->index];
 
     status = dcerpc_pipe_connect_b_recv(ctx, c, &p);
+    DLIST_REMOVE(s->attempts, a);
+    talloc_free(a);
+
     if (!NT_STATUS_IS_OK(status))
     {
         DEBUG(9, ("Unable to bind to %s: %s\n", sb->NetworkAddr,
                 nt_errstr(status)));
-        try_next_binding(c, s);
+        start_next_attempt(c, s);
     }
     else
     {
         DEBUG(9, ("bind_new_pipe_continue: successfully bound to %s\n",
                 dcerpc_binding_string(c, p->binding)));
+        cancel_attempts(s);
+        dcom_set_last_binding(s->iface->ctx, s->host, sb->NetworkAddr);
         s->p = p;
+        s->connecting = False;
+        s->op = dcom_ox_pipe_add(s->ox, p);
+        if (s->op != NULL)
+        {
+            s->op->handouts++;
+            talloc_reference(s, p);
+        }
         composite_done(c);
     }
 }
 
 /*
- * Try to bind to the next available STRINGBINDING until we finally run out of
- * them.
+ * The binding tried last has not answered in time, so race the next one
+ * against it.
+ */
+static void attempt_stagger_handler(struct event_context *ev,
+        struct timed_event *te, struct timeval t, void *private_data)
+{
+    struct composite_context *c = NULL;
+    struct dcom_get_pipe_state *s = NULL;
+
+    c = talloc_get_type(private_data, struct composite_context);
+    s = talloc_get_type(c->private_data, struct dcom_get_pipe_state);
+    s->stagger_te = NULL;
+
+    start_next_attempt(c, s);
+}
+
+/*
+ * Start connecting to the next binding in line. Attempts are staggered by
+ * DCOM_CONNECT_STAGGER_MSEC, so a binding that answers quickly is used before
+ * the next is tried, while an unreachable address (a backup or iSCSI NIC of a
+ * multi-homed server, say) no longer holds everything up for a full TCP
+ * timeout. Once every binding has been tried and failed the request fails.
  */
-static void try_next_binding(struct composite_context *c,
+static void start_next_attempt(struct composite_context *c,
         struct dcom_get_pipe_state *s)
 {
     struct STRINGBINDING **bindings = s->ox->bindings->stringbindings;
-    struct STRINGBINDING *sb = NULL;
-    int try_index = -1;
+    struct dcom_connect_attempt *a = NULL;
+    struct dcerpc_binding *binding = NULL;
+    NTSTATUS status;
+
+    talloc_free(s->stagger_te);
+    s->stagger_te = NULL;
 
-    /* repeat our loop until we reach the end OR we find a binding to try */
-    while (bindings[s->current_binding_index++] != NULL)
+    while (s->next_attempt < s->num_order)
     {
-        /* wrap the offset around if we've reached the end of the bindings */
-        if (bindings[++s->current_binding_offset] == NULL)
-            s->current_binding_offset = 0;
+        int index = s->order[s->next_attempt++];
 
-        sb = bindings[s->current_binding_offset];
+        DEBUG(9, ("dcom_get_pipe: Trying binding %s\n",
+                bindings[index]->NetworkAddr));
 
-        /* let's try the similar binding as soon as we see it */
-        if (s->current_binding_offset == s->similar_binding_index)
-        {
-            try_index = s->current_binding_offset;
-            break;
-        }
+        a = talloc_zero(c, struct dcom_connect_attempt);
+        if (composite_nomem(a, c)) return;
+        a->c = c;
+        a->index = index;
 
-        /*
-         * otherwise, if we've got a non-TCP/IP binding let's just skip it
-         */
-        if (sb->wTowerId != EPM_PROTOCOL_TCP)
+        status = dcerpc_binding_from_STRINGBINDING(a, &binding,
+                bindings[index]);
+        if (!NT_STATUS_IS_OK(status))
         {
-            DEBUG(3, ("dcom_get_pipe: Skipping binding %s\n", sb->NetworkAddr));
+            DEBUG(1, ("Error parsing string binding %s: %s\n",
+                    bindings[index]->NetworkAddr, nt_errstr(status)));
+            talloc_free(a);
             continue;
         }
 
-        /* hey, a binding to try! */
-        try_index = s->current_binding_offset;
-        break;
-    }
+        binding->flags |= DCERPC_AUTH_NTLM | DCERPC_SIGN | DCERPC_CONC_MPX;
+        if (DEBUGLVL(9)) binding->flags |= DCERPC_DEBUG_PRINT_BOTH;
 
-    if (try_index != -1)
-    {
-        struct composite_context *new_ctx = NULL;
-        struct dcerpc_binding *binding = NULL;
-        NTSTATUS status;
+        a->ctx = dcerpc_pipe_connect_b_send(a, binding,
+                idl_iface_by_uuid(&s->iface->obj.iid),
+                dcom_get_server_credentials(s->iface->ctx, binding->host),
+                s->iface->ctx->event_ctx);
+        if (composite_nomem(a->ctx, c)) return;
 
-        DEBUG(9, ("dcom_get_pipe: Trying binding %s\n", sb->NetworkAddr));
-        status = dcerpc_binding_from_STRINGBINDING(s->iface->ctx, &binding, sb);
-        if (!NT_STATUS_IS_OK(status))
-        {
-            DEBUG(1, ("Error parsing string binding %s: %s\n", sb->NetworkAddr,
-                    nt_errstr(status)));
-            try_next_binding(c, s);
-        }
-        else
-        {
-            binding->flags |= DCERPC_AUTH_NTLM | DCERPC_SIGN;
-            if (DEBUGLVL(9)) binding->flags |= DCERPC_DEBUG_PRINT_BOTH;
+        DLIST_ADD(s->attempts, a);
+        composite_continue(c, a->ctx, bind_new_pipe_continue, a);
 
-            new_ctx = dcerpc_pipe_connect_b_send(c, binding,
-                    idl_iface_by_uuid(&s->iface->obj.iid),
-                    dcom_get_server_credentials(s->iface->ctx, binding->host),
-                    s->iface->ctx->event_ctx);
-
-            if (!composite_nomem(new_ctx, c))
-                composite_continue(c, new_ctx, bind_new_pipe_continue, c);
+        if (s->next_attempt < s->num_order)
+        {
+            s->stagger_te = event_add_timed(c->event_ctx, s,
+                    timeval_current_ofs(0, DCOM_CONNECT_STAGGER_MSEC * 1000),
+                    attempt_stagger_handler, c);
         }
+        return;
     }
-    else
+
+    if (s->attempts == NULL)
     {
         /* no more bindings left and we never connected, so error time */
-        /* NOTE: this should effectively never happen */
+        if (s->connecting)
+        {
+            s->connecting = False;
+            s->ox->num_pipes--;
+        }
         composite_error(c, NT_STATUS_INVALID_ADDRESS);
     }
 }
 
 /*
- * Allocate a new DCE/RPC pipe by finding the best binding that matches our
- * previous connection attempts.
+ * Allocate a new DCE/RPC pipe by racing connections to the object exporter's
+ * TCP/IP bindings, in the order we think is best.
  */
 static void bind_new_pipe(struct composite_context *c)
 {
     struct dcom_get_pipe_state *s = NULL;
+    struct STRINGBINDING **bindings = NULL;
     struct dcerpc_binding *binding = NULL;
-    const char *host = NULL;
+    const char *last = NULL;
     int similar_index = -1;
+    int count, i, j;
     NTSTATUS status;
 
     s = talloc_get_type(c->private_data, struct dcom_get_pipe_state);
+    s->connecting = True;
+    s->ox->num_pipes++;
+    bindings = s->ox->bindings->stringbindings;
 
     /*
      * First, try and find a similar STRINGBINDING by comparing the specified
@@ -1160,30 +1486,67 @@ static void bind_new_pipe(struct composite_context *c)
      * a binding string first to make sure we have a consistent hostname format
      * without any binding prefix.
      */
-    host = s->ox->host;
-    status = dcerpc_parse_binding(c, host, &binding);
+    s->host = s->ox->host;
+    status = dcerpc_parse_binding(c, s->host, &binding);
     if (NT_STATUS_IS_OK(status))
     {
-        host = talloc_strdup(c, binding->host);
+        s->host = talloc_strdup(s, binding->host);
         talloc_free(binding);
     }
-    similar_index = find_similar_binding(s->ox->bindings->stringbindings, host);
-    DEBUG(1, (__location__": dcom_get_pipe: host=%s, similar=%s\n", host,
-            s->ox->bindings->stringbindings[similar_index] ? s->ox->bindings->stringbindings[similar_index]->NetworkAddr : "None"));
+    similar_index = find_similar_binding(bindings, s->host);
+    DEBUG(1, (__location__": dcom_get_pipe: host=%s, similar=%s\n", s->host,
+            bindings[similar_index] ? bindings[similar_index]->NetworkAddr : "None"));
 
     /*
-     * Second, set the initial values for the binding offset and index and begin
-     * the search for a binding that answers. The current_binding_index
-     * represents an index from 0 until we hit the maximum string binding, but
-     * the current_binding_offset starts at the similar_index first and then
-     * wraps as needed. This approach gives us one pass through the
-     * stringbindings but starts where we think is best.
+     * Second, put the bindings in the order they are tried: the one that
+     * worked for this host last time, then the similar one, then every other
+     * TCP/IP binding starting from the similar one and wrapping around.
      */
-    s->similar_binding_index = similar_index;
-    s->current_binding_offset = similar_index - 1;
-    s->current_binding_index = 0;
+    for (count = 0; bindings[count] != NULL; ++count)
+        ;
+    s->order = talloc_array(s, int, count);
+    if (composite_nomem(s->order, c)) return;
+    s->num_order = 0;
+    s->next_attempt = 0;
+
+    last = dcom_get_last_binding(s->iface->ctx, s->host);
+    for (i = 0; last != NULL && i < count; ++i)
+    {
+        if (bindings[i]->wTowerId == EPM_PROTOCOL_TCP &&
+                strcmp(bindings[i]->NetworkAddr, last) == 0)
+        {
+            s->order[s->num_order++] = i;
+            break;
+        }
+    }
+    for (j = 0; j < count; ++j)
+    {
+        i = (similar_index + j) % count;
+        if (bindings[i]->wTowerId != EPM_PROTOCOL_TCP)
+        {
+            DEBUG(3, ("dcom_get_pipe: Skipping binding %s\n",
+                    bindings[i]->NetworkAddr));
+            continue;
+        }
+        if (s->num_order > 0 && s->order[0] == i)
+            continue;
+        s->order[s->num_order++] = i;
+    }
 
-    try_next_binding(c, s);
+    start_next_attempt(c, s);
+}
+
+/*
+ * Once the caller has its pipe (or gave up on it) the call has been sent and
+ * the pool entry no longer needs to be protected from re-targeting.
+ */
+static int dcom_get_pipe_state_destructor(struct dcom_get_pipe_state *s)
+{
+    if (s->connecting)
+        s->ox->num_pipes--;
+    if (s->op != NULL && --s->op->handouts == 0 && s->op->pipe == NULL)
+        talloc_free(s->op);
+    return 0;
 }
 
 /*
@@ -1194,6 +1557,9 @@ struct composite_context *dcom_get_pipe_send(struct IUnknown *d,
 {
     struct composite_context *c = NULL;
     struct dcom_get_pipe_state *s = NULL;
+    struct dcom_ox_pipe *op, *next, *bound = NULL, *other = NULL;
+    uint32_t calls, queued, bound_calls = 0, other_calls = 0;
+    const struct dcerpc_interface_table *table = NULL;
 
     /* create a new composite to use for this call sequence */
     c = composite_create(0, d->ctx->event_ctx);
@@ -1203,6 +1569,7 @@ struct composite_context *dcom_get_pipe_send(struct IUnknown *d,
     if (composite_nomem(s, c)) return c;
     c->private_data = s;
     s->iface = d;
+    talloc_set_destructor(s, dcom_get_pipe_state_destructor);
 
     /* get the local object exporter for this IUnknown */
     s->ox = object_exporter_by_oxid(s->iface->ctx,
@@ -1214,22 +1581,90 @@ struct composite_context *dcom_get_pipe_send(struct IUnknown *d,
         return c;
     }
 
-    /* release the existing pipe if it is invalid */
-    if (s->ox->pipe != NULL && s->ox->pipe->last_fault_code)
+    /* release the pooled pipes that are no longer usable */
+    for (op = s->ox->pipes; op; op = next)
+    {
+        next = op->next;
+        if (op->pipe->last_fault_code)
+        {
+            DEBUG(1, ("dcom_get_pipe: pipe's last_fault_code was %08x, "
+                    "freeing\n", op->pipe->last_fault_code));
+            dcom_ox_pipe_drop(s->ox, op);
+        }
+        else if (op->pipe->conn->dead)
+        {
+            /* a connection whose transport failed is replaced by a fresh one */
+            DEBUG(1, ("dcom_get_pipe: connection to %s is dead, freeing\n",
+                    s->ox->host ? s->ox->host : "?"));
+            dcom_ox_pipe_drop(s->ox, op);
+        }
+    }
+
+    table = idl_iface_by_uuid(&s->iface->vtable->iid);
+
+    /*
+     * Pick a pipe for the call. A pipe already bound to the interface with
+     * room in its connection's call window is best, and may be shared by
+     * several calls since each holds its own reference to it. Failing that
+     * a new connection is opened while the object exporter is below its
+     * limit, so calls on different interfaces run side by side rather than
+     * bouncing one pipe between them with alter_context. Once the limit is
+     * reached an idle pipe is re-targeted, and when everything is busy the
+     * call queues behind the least loaded pipe for its interface.
+     */
+    for (op = s->ox->pipes; op; op = op->next)
     {
-        DEBUG(1, ("dcom_get_pipe: pipe's last_fault_code was %08x, freeing\n",
-                s->ox->pipe->last_fault_code));
-        talloc_free(s->ox->pipe);
-        s->ox->pipe = NULL;
+        calls = dcom_pipe_calls(op->pipe, &queued) + op->handouts;
+
+        /* a pipe with nothing left to ship can switch contexts locally */
+        if (table != NULL && queued == 0 && op->handouts == 0 &&
+                !GUID_equal(&op->pipe->syntax.uuid, &s->iface->vtable->iid))
+            dcerpc_select_context(op->pipe, &table->syntax_id,
+                    &op->pipe->transfer_syntax);
+
+        if (GUID_equal(&op->pipe->syntax.uuid, &s->iface->vtable->iid))
+        {
+            if (bound == NULL || calls < bound_calls)
+            {
+                bound = op;
+                bound_calls = calls;
+            }
+        }
+        else if (queued == 0 && op->handouts == 0 &&
+                (other == NULL || calls < other_calls))
+        {
+            other = op;
+            other_calls = calls;
+        }
     }
 
-    /* if the object exporter has a valid pipe then reuse it, otherwise... */
-    if (s->ox->pipe != NULL)
+    if (bound != NULL && bound_calls < bound->pipe->conn->max_in_flight)
     {
-        reuse_existing_pipe(c);
+        reuse_existing_pipe(c, bound);
+    }
+    else if (s->ox->num_pipes < s->ox->max_pipes || s->ox->pipes == NULL)
+    {
+        bind_new_pipe(c);
+    }
+    else if (other != NULL && other_calls == 0)
+    {
+        reuse_existing_pipe(c, other);
+    }
+    else if (bound != NULL)
+    {
+        reuse_existing_pipe(c, bound);
+    }
+    else if (other != NULL)
+    {
+        reuse_existing_pipe(c, other);
     }
     else
     {
+        /*
+         * every pipe has calls that have not gone out yet and would be sent
+         * with the wrong context id after an alter_context, so go over the
+         * limit by one connection rather than break them
+         */
         bind_new_pipe(c);
     }
 
@@ -1253,14 +1688,14 @@ NTSTATUS dcom_get_pipe_recv(struct composite_context *c,
         s = talloc_get_type(c->private_data, struct dcom_get_pipe_state);
 
         /*
-         * let the caller own it, but also let the object exporter own a
-         * reference as well
+         * the object exporter owns pooled pipes, the caller gets a reference
+         * of its own that goes away with parent_ctx
          */
-        talloc_steal(parent_ctx, s->p);
+        if (s->op != NULL)
+            talloc_reference(parent_ctx, s->p);
+        else
+            talloc_steal(parent_ctx, s->p);
         *pp = s->p;
-
-        talloc_reference(s->ox, s->p);
-        s->ox->pipe = s->p;
     }
 
     talloc_free(c);
@@ -1273,43 +1708,277 @@ struct IUnknown_Release_out
     uint32_t result;
 };
 
-void dcom_release_continue(struct composite_context *cr)
+/*
+ * Releases queued on an object exporter and sent together as one
+ * IRemUnknown::RemRelease call, along with the release requests waiting for
+ * its answer.
+ */
+struct dcom_release_queue
+{
+    struct dcom_object_exporter *ox;    /* NULL once sent */
+    struct REMINTERFACEREF *refs;
+    uint32_t num_refs;
+    struct dcom_release_waiter *waiters;
+    struct timed_event *te;
+};
+
+struct dcom_release_waiter
+{
+    struct composite_context *c;        /* the caller's release request */
+    struct dcom_release_queue *q;
+    struct dcom_release_waiter *prev, *next;
+};
+
+static void dcom_release_failed(struct event_context *ev,
+        struct timed_event *te, struct timeval t, void *private_data)
+{
+    struct composite_context *c = talloc_get_type(private_data,
+            struct composite_context);
+
+    composite_error(c, c->status);
+}
+
+/*
+ * Fail a release request from the event loop. Its caller may not have set
+ * up the completion callback yet, or may be in the middle of tearing down
+ * what the callback would free.
+ */
+static void dcom_release_fail(struct composite_context *c, NTSTATUS status)
+{
+    c->status = status;
+    if (event_add_timed(c->event_ctx, c, timeval_zero(),
+            dcom_release_failed, c) == NULL)
+        composite_error(c, status);
+}
+
+/*
+ * A queue is only freed with requests still waiting on it when its object
+ * exporter goes before the batch was answered. Those requests are failed
+ * from the event loop rather than from here, as their callbacks may free
+ * more of what is being torn down.
+ */
+static int dcom_release_queue_destructor(struct dcom_release_queue *q)
+{
+    struct dcom_release_waiter *w;
+
+    if (q->waiters != NULL)
+        DEBUG(3, ("dcom_release: object exporter freed, %u refs not "
+                "released\n", q->num_refs));
+    while ((w = q->waiters) != NULL)
+    {
+        DLIST_REMOVE(q->waiters, w);
+        w->q = NULL;
+        dcom_release_fail(w->c, NT_STATUS_CONNECTION_DISCONNECTED);
+    }
+    if (q->ox != NULL && q->ox->releases == q)
+        q->ox->releases = NULL;
+    return 0;
+}
+
+static int dcom_release_waiter_destructor(struct dcom_release_waiter *w)
 {
+    if (w->q != NULL)
+        DLIST_REMOVE(w->q->waiters, w);
+    return 0;
+}
+
+/*
+ * Hand the result of a batched RemRelease to every release request that was
+ * part of it.
+ */
+static void dcom_release_batch_continue(struct composite_context *cr)
+{
+    struct dcom_release_queue *q;
+    struct dcom_release_waiter *w;
     struct composite_context *c;
-    struct IUnknown *d;
     struct IUnknown_Release_out *out;
     WERROR r;
 
-    c = talloc_get_type(cr->async.private_data, struct composite_context);
-    d = c->private_data;
+    q = talloc_get_type(cr->async.private_data, struct dcom_release_queue);
     r = IRemUnknown_RemRelease_recv(cr);
-    talloc_free(d);
-    out = talloc_zero(c, struct IUnknown_Release_out);
-    out->result = W_ERROR_V(r);
-    c->private_data = out;
-    composite_done(c);
+    DEBUG(9, ("dcom_release: RemRelease of %u refs returned %s\n",
+            q->num_refs, win_errstr(r)));
+
+    /* a completion callback may well free the object exporter */
+    talloc_steal(NULL, q);
+
+    while ((w = q->waiters) != NULL)
+    {
+        DLIST_REMOVE(q->waiters, w);
+        w->q = NULL;
+        c = w->c;
+        talloc_free(c->private_data);
+        out = talloc_zero(c, struct IUnknown_Release_out);
+        if (out != NULL) out->result = W_ERROR_V(r);
+        c->private_data = out;
+        if (out == NULL)
+            composite_error(c, NT_STATUS_NO_MEMORY);
+        else
+            composite_done(c);
+    }
+    talloc_free(q);
 }
 
-struct composite_context *dcom_release_send(struct IUnknown *d,
-        TALLOC_CTX *mem_ctx)
+/*
+ * Send the releases queued on an object exporter now.
+ */
+static void dcom_release_flush_ox(struct dcom_object_exporter *ox)
+{
+    struct dcom_release_queue *q = ox->releases;
+    struct dcom_release_waiter *w;
+    struct composite_context *cr;
+
+    if (q == NULL) return;
+    ox->releases = NULL;
+    q->ox = NULL;
+    talloc_free(q->te);
+    q->te = NULL;
+
+    /* nothing made it onto a queue whose first request ran out of memory */
+    if (q->num_refs == 0 && q->waiters == NULL)
+    {
+        talloc_free(q);
+        return;
+    }
+
+    cr = IRemUnknown_RemRelease_send(ox->rem_unknown, q, q->num_refs, q->refs);
+    if (cr == NULL)
+    {
+        while ((w = q->waiters) != NULL)
+        {
+            DLIST_REMOVE(q->waiters, w);
+            w->q = NULL;
+            dcom_release_fail(w->c, NT_STATUS_NO_MEMORY);
+        }
+        talloc_free(q);
+        return;
+    }
+    cr->async.fn = dcom_release_batch_continue;
+    cr->async.private_data = q;
+}
+
+static void dcom_release_timer(struct event_context *ev,
+        struct timed_event *te, struct timeval t, void *private_data)
+{
+    struct dcom_release_queue *q = talloc_get_type(private_data,
+            struct dcom_release_queue);
+
+    q->te = NULL;
+    if (q->ox != NULL)
+        dcom_release_flush_ox(q->ox);
+}
+
+/*
+ * Send every release still queued, e.g. before the connections go away.
+ */
+void dcom_release_flush(struct com_context *ctx)
 {
-    struct composite_context *c, *cr;
-    struct REMINTERFACEREF iref;
     struct dcom_object_exporter *ox;
 
-    c = composite_create(d->ctx, d->ctx->event_ctx);
+    for (ox = ctx->dcom->object_exporters; ox; ox = ox->next)
+        dcom_release_flush_ox(ox);
+}
+
+/*
+ * Release references to interface pointers on d's object exporter. Rather
+ * than a RemRelease round trip each, releases are queued for
+ * DCOM_RELEASE_DELAY_MSEC, or until DCOM_RELEASE_BATCH_MAX references have
+ * piled up, and then go to the server together. The request is allocated
+ * on mem_ctx, or on d's COM context if that is NULL, and d is freed with it
+ * once the server has answered. Errors are always reported from the event
+ * loop, after the caller had a chance to set the completion callback.
+ */
+struct composite_context *dcom_release_refs_send(struct IUnknown *d,
+        TALLOC_CTX *mem_ctx, uint32_t num_refs,
+        const struct REMINTERFACEREF *refs)
+{
+    struct composite_context *c;
+    struct dcom_object_exporter *ox;
+    struct dcom_release_queue *q;
+    struct dcom_release_waiter *w;
+    struct REMINTERFACEREF *refs_new;
+    uint32_t i, j;
+
+    c = composite_create(mem_ctx ? mem_ctx : d->ctx, d->ctx->event_ctx);
     if (c == NULL)
         return NULL;
     c->private_data = d;
+    talloc_steal(c, d);
 
     ox = object_exporter_by_ip(d->ctx, d);
+    if (ox == NULL || ox->rem_unknown == NULL)
+    {
+        dcom_release_fail(c, NT_STATUS_INVALID_PARAMETER);
+        return c;
+    }
+
+    q = ox->releases;
+    if (q == NULL)
+    {
+        q = talloc_zero(ox, struct dcom_release_queue);
+        if (q == NULL)
+        {
+            dcom_release_fail(c, NT_STATUS_NO_MEMORY);
+            return c;
+        }
+        q->ox = ox;
+        talloc_set_destructor(q, dcom_release_queue_destructor);
+        q->te = event_add_timed(c->event_ctx, q,
+                timeval_current_ofs(0, DCOM_RELEASE_DELAY_MSEC * 1000),
+                dcom_release_timer, q);
+        ox->releases = q;
+    }
+
+    w = talloc_zero(c, struct dcom_release_waiter);
+    refs_new = talloc_realloc(q, q->refs, struct REMINTERFACEREF,
+            q->num_refs + num_refs);
+    if (w == NULL || refs_new == NULL)
+    {
+        dcom_release_fail(c, NT_STATUS_NO_MEMORY);
+        return c;
+    }
+    q->refs = refs_new;
+
+    /* releases of the same interface pointer fold into one reference */
+    for (i = 0; i < num_refs; i++)
+    {
+        for (j = 0; j < q->num_refs; j++)
+        {
+            if (GUID_equal(&q->refs[j].ipid, &refs[i].ipid))
+                break;
+        }
+        if (j == q->num_refs)
+        {
+            q->refs[j] = refs[i];
+            q->num_refs++;
+        }
+        else
+        {
+            q->refs[j].cPublicRefs += refs[i].cPublicRefs;
+            q->refs[j].cPrivateRefs += refs[i].cPrivateRefs;
+        }
+    }
+
+    w->c = c;
+    w->q = q;
+    DLIST_ADD_END(q->waiters, w, struct dcom_release_waiter *);
+    talloc_set_destructor(w, dcom_release_waiter_destructor);
+
+    if (q->num_refs >= DCOM_RELEASE_BATCH_MAX)
+        dcom_release_flush_ox(ox);
+
+    return c;
+}
+
+struct composite_context *dcom_release_send(struct IUnknown *d,
+        TALLOC_CTX *mem_ctx)
+{
+    struct REMINTERFACEREF iref;
+
     iref.ipid = IUnknown_ipid(d);
     iref.cPublicRefs = 5;
     iref.cPrivateRefs = 0;
-    cr = IRemUnknown_RemRelease_send(ox->rem_unknown, mem_ctx, 1, &iref);
-
-    composite_continue(c, cr, dcom_release_continue, c);
-    return c;
+    return dcom_release_refs_send(d, mem_ctx, 1, &iref);
 }
 
 uint32_t dcom_release_recv(struct composite_context *c)
@@ -116,6 +116,7 @@ void com_extension_set(struct com_context *ctx, uint32_t id, void *data)
         for (ce = ctx->extensions; ce; ce = ce->next) {
                 if (ce->id == id) {
                         talloc_free(ce->data);
+                        break;
                 }
         }
 	if (!ce) {
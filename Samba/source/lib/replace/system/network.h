@@ -26,6 +26,10 @@
 #include <sys/socket.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_UNIXSOCKET
 #include <sys/un.h>
 #endif
@@ -1,4 +1,5 @@
 AC_CHECK_FUNCS(writev)
+AC_CHECK_HEADERS(sys/uio.h)
 AC_CHECK_FUNCS(readv)
 
 AC_CACHE_CHECK([for sin_len in sock],samba_cv_HAVE_SOCK_SIN_LEN,[
@@ -255,6 +255,76 @@ _PUBLIC_ NTSTATUS socket_send(struct socket_context *sock,
 }
 
 
+/*
+  send several buffers in one go. Backends without a gather send, and
+  the random short send testing mode, fall back to sending the first
+  buffer that still has data in it, which the caller sees as a short
+  write and retries.
+*/
+_PUBLIC_ NTSTATUS socket_sendv(struct socket_context *sock,
+			       const DATA_BLOB *blobs, int count, size_t *sendlen)
+{
+	int i;
+
+	if (sock == NULL) {
+		return NT_STATUS_CONNECTION_DISCONNECTED;
+	}
+	if (sock->state != SOCKET_STATE_CLIENT_CONNECTED &&
+	    sock->state != SOCKET_STATE_SERVER_CONNECTED) {
+		return NT_STATUS_INVALID_PARAMETER;
+	}
+
+	if (sock->ops->fn_sendv && !(sock->flags & SOCKET_FLAG_TESTNONBLOCK)) {
+		return sock->ops->fn_sendv(sock, blobs, count, sendlen);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (blobs[i].length != 0) {
+			return socket_send(sock, &blobs[i], sendlen);
+		}
+	}
+
+	*sendlen = 0;
+	return NT_STATUS_OK;
+}
+
+
+#ifdef HAVE_WRITEV
+/*
+  the fn_sendv of backends whose sockets are plain file descriptors,
+  writing up to SOCKET_SENDV_MAX buffers with writev()
+*/
+_PUBLIC_ NTSTATUS socket_fd_sendv(struct socket_context *sock,
+				  const DATA_BLOB *blobs, int count, size_t *sendlen)
+{
+	struct iovec iov[SOCKET_SENDV_MAX];
+	ssize_t len;
+	int i, n = 0;
+
+	*sendlen = 0;
+
+	for (i = 0; i < count && n < SOCKET_SENDV_MAX; i++) {
+		if (blobs[i].length == 0) continue;
+		iov[n].iov_base = blobs[i].data;
+		iov[n].iov_len = blobs[i].length;
+		n++;
+	}
+	if (n == 0) {
+		return NT_STATUS_OK;
+	}
+
+	len = writev(sock->fd, iov, n);
+	if (len == -1) {
+		return map_nt_error_from_unix(errno);
+	}
+
+	*sendlen = len;
+
+	return NT_STATUS_OK;
+}
+#endif
+
+
 _PUBLIC_ NTSTATUS socket_sendto(struct socket_context *sock, 
 			        const DATA_BLOB *blob, size_t *sendlen, 
 			        const struct socket_address *dest_addr)
@@ -65,6 +65,9 @@ struct socket_ops {
 			    size_t wantlen, size_t *nread);
 	NTSTATUS (*fn_send)(struct socket_context *sock, 
 			    const DATA_BLOB *blob, size_t *sendlen);
+	/* optional, gathers several buffers into one send */
+	NTSTATUS (*fn_sendv)(struct socket_context *sock,
+			     const DATA_BLOB *blobs, int count, size_t *sendlen);
 
 	NTSTATUS (*fn_sendto)(struct socket_context *sock, 
 			      const DATA_BLOB *blob, size_t *sendlen,
@@ -99,6 +102,9 @@ enum socket_state {
 	SOCKET_STATE_SERVER_ERROR
 };
 
+/* most buffers a single socket_sendv() hands to the kernel */
+#define SOCKET_SENDV_MAX 16
+
 #define SOCKET_FLAG_BLOCK        0x00000001
 #define SOCKET_FLAG_PEEK         0x00000002
 #define SOCKET_FLAG_TESTNONBLOCK 0x00000004
@@ -145,6 +151,10 @@ NTSTATUS socket_recvfrom(struct socket_context *sock, void *buf,
 			 TALLOC_CTX *addr_ctx, struct socket_address **src_addr);
 NTSTATUS socket_send(struct socket_context *sock, 
 		     const DATA_BLOB *blob, size_t *sendlen);
+NTSTATUS socket_sendv(struct socket_context *sock,
+		      const DATA_BLOB *blobs, int count, size_t *sendlen);
+NTSTATUS socket_fd_sendv(struct socket_context *sock,
+			 const DATA_BLOB *blobs, int count, size_t *sendlen);
 NTSTATUS socket_sendto(struct socket_context *sock, 
 		       const DATA_BLOB *blob, size_t *sendlen,
 		       const struct socket_address *dest_addr);
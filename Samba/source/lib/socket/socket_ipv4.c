@@ -519,6 +519,9 @@ static const struct socket_ops ipv4_ops = {
 	.fn_recv		= ipv4_recv,
 	.fn_recvfrom		= ipv4_recvfrom,
 	.fn_send		= ipv4_send,
+#ifdef HAVE_WRITEV
+	.fn_sendv		= socket_fd_sendv,
+#endif
 	.fn_sendto		= ipv4_sendto,
 	.fn_pending		= ipv4_pending,
 	.fn_close		= ipv4_close,
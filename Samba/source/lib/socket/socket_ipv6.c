@@ -399,6 +399,9 @@ static const struct socket_ops ipv6_tcp_ops = {
 	.fn_accept		= ipv6_tcp_accept,
 	.fn_recv		= ipv6_tcp_recv,
 	.fn_send		= ipv6_tcp_send,
+#ifdef HAVE_WRITEV
+	.fn_sendv		= socket_fd_sendv,
+#endif
 	.fn_close		= ipv6_tcp_close,
 
 	.fn_set_option		= ipv6_tcp_set_option,
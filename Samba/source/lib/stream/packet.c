@@ -48,9 +48,17 @@ struct packet_context {
 	BOOL busy;
 	BOOL destructor_called;
 
+	/* receive buffer mode: size of the buffer, and where the first
+	   packet not yet handed out starts in partial */
+	size_t recv_buffer;
+	size_t ring_start;
+
 	struct send_element {
 		struct send_element *next, *prev;
 		DATA_BLOB blob;
+		DATA_BLOB *iov;		/* the buffers making up the packet */
+		int iov_count;
+		size_t length;
 		size_t nsent;
 		packet_send_callback_fn_t send_callback;
 		void *send_callback_private;
@@ -169,6 +177,20 @@ _PUBLIC_ void packet_set_initial_read(struct packet_context *pc, uint32_t initia
 	pc->initial_read = initial_read;
 }
 
+/*
+  switch the receiver to buffer mode. Each readable event reads as much
+  as fits into a reusable buffer of (at least) the given size with a
+  single recv, and every complete packet found in it is handed to the
+  callback as a slice of that buffer. The callback does not own the
+  blob and must copy whatever it wants to keep before returning.
+  Packets are delivered one callback at a time, as with
+  packet_set_serialise(), and the initial read size is not used.
+*/
+_PUBLIC_ void packet_set_recv_buffer(struct packet_context *pc, size_t size)
+{
+	pc->recv_buffer = size;
+}
+
 /*
   tell the packet system not to steal/free blobs given to packet_send()
 */
@@ -214,6 +236,12 @@ static void packet_next_event(struct event_context *ev, struct timed_event *te,
 			      struct timeval t, void *private)
 {
 	struct packet_context *pc = talloc_get_type(private, struct packet_context);
+	if (pc->recv_buffer != 0) {
+		if (pc->num_read > pc->ring_start) {
+			packet_recv(pc);
+		}
+		return;
+	}
 	if (pc->num_read != 0 && pc->packet_size != 0 &&
 	    pc->packet_size <= pc->num_read) {
 		packet_recv(pc);
@@ -221,6 +249,158 @@ static void packet_next_event(struct event_context *ev, struct timed_event *te,
 }
 
 
+/*
+  hand out the complete packets sitting in the receive buffer. Returns
+  True if the buffer needs more data, False if delivery stopped for
+  another reason (receiving disabled, an error, or the context went
+  away)
+*/
+static BOOL packet_ring_dispatch(struct packet_context *pc)
+{
+	NTSTATUS status;
+	DATA_BLOB blob;
+
+	while (pc->num_read > pc->ring_start) {
+		blob = data_blob_const(pc->partial.data + pc->ring_start,
+				       pc->num_read - pc->ring_start);
+
+		pc->packet_size = 0;
+		status = pc->full_request(pc->private, blob, &pc->packet_size);
+		if (NT_STATUS_IS_ERR(status)) {
+			packet_error(pc, status);
+			return False;
+		}
+		if (!NT_STATUS_IS_OK(status)) {
+			break;
+		}
+
+		if (pc->packet_size > blob.length) {
+			/* the caller made an error */
+			DEBUG(0,("Invalid packet_size %lu greater than num_read %lu\n",
+				 (long)pc->packet_size, (long)blob.length));
+			packet_error(pc, NT_STATUS_INVALID_PARAMETER);
+			return False;
+		}
+
+		blob.length = pc->packet_size;
+		pc->ring_start += pc->packet_size;
+		pc->packet_size = 0;
+
+		pc->processing = 1;
+		pc->busy = True;
+
+		status = pc->callback(pc->private, blob);
+
+		pc->busy = False;
+
+		if (pc->destructor_called) {
+			talloc_free(pc);
+			return False;
+		}
+
+		if (pc->processing > 1) {
+			EVENT_FD_READABLE(pc->fde);
+		}
+		pc->processing = 0;
+
+		if (!NT_STATUS_IS_OK(status)) {
+			packet_error(pc, status);
+			return False;
+		}
+
+		if (pc->recv_disable) {
+			return False;
+		}
+	}
+
+	if (pc->ring_start == pc->num_read) {
+		pc->ring_start = 0;
+		pc->num_read = 0;
+	}
+
+	return True;
+}
+
+/*
+  make room in the receive buffer for the next read. The tail of a
+  partly received packet is moved to the front, and the buffer grows
+  when a single packet does not fit into it
+*/
+static NTSTATUS packet_ring_space(struct packet_context *pc)
+{
+	size_t want = pc->recv_buffer;
+	size_t used = pc->num_read - pc->ring_start;
+
+	if (pc->ring_start != 0) {
+		memmove(pc->partial.data, pc->partial.data + pc->ring_start, used);
+		pc->ring_start = 0;
+		pc->num_read = used;
+	}
+
+	if (pc->packet_size > want) {
+		want = pc->packet_size;
+	}
+	while (want <= pc->num_read) {
+		if (want * 2 < want) {
+			return NT_STATUS_INVALID_PARAMETER;
+		}
+		want *= 2;
+	}
+
+	/* grow for a large packet, and give the memory back after it */
+	if (pc->partial.length < want ||
+	    (pc->num_read == 0 && pc->partial.length > want)) {
+		return data_blob_realloc(pc, &pc->partial, want);
+	}
+
+	return NT_STATUS_OK;
+}
+
+/*
+  the receive side of buffer mode, see packet_set_recv_buffer()
+*/
+static void packet_recv_ring(struct packet_context *pc)
+{
+	NTSTATUS status;
+	size_t nread = 0;
+
+	/* hand out what is already buffered before reading more */
+	if (!packet_ring_dispatch(pc)) {
+		return;
+	}
+
+	status = packet_ring_space(pc);
+	if (!NT_STATUS_IS_OK(status)) {
+		packet_error(pc, status);
+		return;
+	}
+
+	if (pc->sock == NULL) {
+		packet_error(pc, NT_STATUS_CONNECTION_DISCONNECTED);
+		return;
+	}
+
+	status = socket_recv(pc->sock, pc->partial.data + pc->num_read,
+			     pc->partial.length - pc->num_read, &nread);
+	if (NT_STATUS_IS_ERR(status)) {
+		packet_error(pc, status);
+		return;
+	}
+	if (!NT_STATUS_IS_OK(status)) {
+		return;
+	}
+
+	if (nread == 0) {
+		packet_eof(pc);
+		return;
+	}
+
+	pc->num_read += nread;
+
+	packet_ring_dispatch(pc);
+}
+
+
 /*
   call this when the socket becomes readable to kick off the whole
   stream parsing process
@@ -243,6 +423,11 @@ _PUBLIC_ void packet_recv(struct packet_context *pc)
 		return;
 	}
 
+	if (pc->recv_buffer != 0) {
+		packet_recv_ring(pc);
+		return;
+	}
+
 	if (pc->packet_size != 0 && pc->num_read >= pc->packet_size) {
 		goto next_partial;
 	}
@@ -443,6 +628,13 @@ _PUBLIC_ void packet_recv_enable(struct packet_context *pc)
 {
 	EVENT_FD_READABLE(pc->fde);
 	pc->recv_disable = False;
+	if (pc->recv_buffer != 0) {
+		/* packets may be waiting in the buffer already */
+		if (pc->num_read > pc->ring_start) {
+			event_add_timed(pc->ev, pc, timeval_zero(), packet_next_event, pc);
+		}
+		return;
+	}
 	if (pc->num_read != 0 && pc->packet_size >= pc->num_read) {
 		event_add_timed(pc->ev, pc, timeval_zero(), packet_next_event, pc);
 	}
@@ -457,10 +649,26 @@ _PUBLIC_ void packet_queue_run(struct packet_context *pc)
 		struct send_element *el = pc->send_queue;
 		NTSTATUS status;
 		size_t nwritten;
-		DATA_BLOB blob = data_blob_const(el->blob.data + el->nsent,
-						 el->blob.length - el->nsent);
+		DATA_BLOB iov[SOCKET_SENDV_MAX];
+		size_t skip = el->nsent;
+		int i, n = 0;
+
+		/* skip over what has already gone out */
+		for (i = 0; i < el->iov_count && n < SOCKET_SENDV_MAX; i++) {
+			if (skip >= el->iov[i].length) {
+				skip -= el->iov[i].length;
+				continue;
+			}
+			iov[n++] = data_blob_const(el->iov[i].data + skip,
+						   el->iov[i].length - skip);
+			skip = 0;
+		}
 
-		status = socket_send(pc->sock, &blob, &nwritten);
+		if (n == 1) {
+			status = socket_send(pc->sock, &iov[0], &nwritten);
+		} else {
+			status = socket_sendv(pc->sock, iov, n, &nwritten);
+		}
 
 		if (NT_STATUS_IS_ERR(status)) {
 			packet_error(pc, status);
@@ -470,7 +678,7 @@ _PUBLIC_ void packet_queue_run(struct packet_context *pc)
 			return;
 		}
 		el->nsent += nwritten;
-		if (el->nsent == el->blob.length) {
+		if (el->nsent == el->length) {
 			DLIST_REMOVE(pc->send_queue, el);
 			if (el->send_callback) {
 				el->send_callback(el->send_callback_private);
@@ -485,45 +693,86 @@ _PUBLIC_ void packet_queue_run(struct packet_context *pc)
 }
 
 /*
-  put a packet in the send queue.  When the packet is actually sent,
-  call send_callback.  
-
-  Useful for operations that must occour after sending a message, such
-  as the switch to SASL encryption after as sucessful LDAP bind relpy.
+  put a packet made up of several buffers in the send queue. When the
+  packet is actually sent, call send_callback. The buffers are written
+  with a single gather send where the socket supports it, so the caller
+  does not need to flatten them.
+
+  The buffers must stay valid until the packet is sent, which the caller
+  ensures by hanging them (or references to them) off owner. On success
+  the packet system takes over owner and frees it once the packet is
+  out, or only references it if packet_set_nofree() was called. On
+  failure owner is left with the caller.
 */
-_PUBLIC_ NTSTATUS packet_send_callback(struct packet_context *pc, DATA_BLOB blob,
-				       packet_send_callback_fn_t send_callback, 
-				       void *private)
+_PUBLIC_ NTSTATUS packet_sendv_callback(struct packet_context *pc,
+					const DATA_BLOB *blobs, int count,
+					void *owner,
+					packet_send_callback_fn_t send_callback,
+					void *private)
 {
 	struct send_element *el;
-	el = talloc(pc, struct send_element);
+	int i;
+
+	el = talloc_zero(pc, struct send_element);
 	NT_STATUS_HAVE_NO_MEMORY(el);
 
-	DLIST_ADD_END(pc->send_queue, el, struct send_element *);
-	el->blob = blob;
-	el->nsent = 0;
+	if (count == 1) {
+		el->blob = blobs[0];
+		el->iov = &el->blob;
+	} else {
+		el->iov = talloc_memdup(el, blobs, count * sizeof(DATA_BLOB));
+		if (el->iov == NULL) {
+			talloc_free(el);
+			return NT_STATUS_NO_MEMORY;
+		}
+	}
+	el->iov_count = count;
+	for (i = 0; i < count; i++) {
+		el->length += blobs[i].length;
+	}
 	el->send_callback = send_callback;
 	el->send_callback_private = private;
 
+	if (private && !talloc_reference(el, private)) {
+		talloc_free(el);
+		return NT_STATUS_NO_MEMORY;
+	}
+
 	/* if we aren't going to free the packet then we must reference it
 	   to ensure it doesn't disappear before going out */
-	if (pc->nofree) {
-		if (!talloc_reference(el, blob.data)) {
-			return NT_STATUS_NO_MEMORY;
+	if (owner) {
+		if (pc->nofree) {
+			if (!talloc_reference(el, owner)) {
+				talloc_free(el);
+				return NT_STATUS_NO_MEMORY;
+			}
+		} else {
+			talloc_steal(el, owner);
 		}
-	} else {
-		talloc_steal(el, blob.data);
 	}
 
-	if (private && !talloc_reference(el, private)) {
-		return NT_STATUS_NO_MEMORY;
-	}
+	DLIST_ADD_END(pc->send_queue, el, struct send_element *);
 
 	EVENT_FD_WRITEABLE(pc->fde);
 
 	return NT_STATUS_OK;
 }
 
+/*
+  put a packet in the send queue.  When the packet is actually sent,
+  call send_callback.  
+
+  Useful for operations that must occour after sending a message, such
+  as the switch to SASL encryption after as sucessful LDAP bind relpy.
+*/
+_PUBLIC_ NTSTATUS packet_send_callback(struct packet_context *pc, DATA_BLOB blob,
+				       packet_send_callback_fn_t send_callback, 
+				       void *private)
+{
+	return packet_sendv_callback(pc, &blob, 1, blob.data,
+				     send_callback, private);
+}
+
 /*
   put a packet in the send queue
 */
@@ -532,6 +781,16 @@ _PUBLIC_ NTSTATUS packet_send(struct packet_context *pc, DATA_BLOB blob)
 	return packet_send_callback(pc, blob, NULL, NULL);
 }
 
+/*
+  put a packet made up of several buffers in the send queue, see
+  packet_sendv_callback()
+*/
+_PUBLIC_ NTSTATUS packet_sendv(struct packet_context *pc,
+			       const DATA_BLOB *blobs, int count, void *owner)
+{
+	return packet_sendv_callback(pc, blobs, count, owner, NULL, NULL);
+}
+
 
 /*
   a full request checker for NBT formatted packets (first 3 bytes are length)
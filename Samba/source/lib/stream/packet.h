@@ -42,6 +42,7 @@ void packet_set_fde(struct packet_context *pc, struct fd_event *fde);
 void packet_set_serialise(struct packet_context *pc);
 void packet_set_initial_read(struct packet_context *pc, uint32_t initial_read);
 void packet_set_nofree(struct packet_context *pc);
+void packet_set_recv_buffer(struct packet_context *pc, size_t size);
 void packet_recv(struct packet_context *pc);
 void packet_recv_disable(struct packet_context *pc);
 void packet_recv_enable(struct packet_context *pc);
@@ -49,6 +50,12 @@ NTSTATUS packet_send(struct packet_context *pc, DATA_BLOB blob);
 NTSTATUS packet_send_callback(struct packet_context *pc, DATA_BLOB blob,
 			      packet_send_callback_fn_t send_callback, 
 			      void *private);
+NTSTATUS packet_sendv(struct packet_context *pc,
+		      const DATA_BLOB *blobs, int count, void *owner);
+NTSTATUS packet_sendv_callback(struct packet_context *pc,
+			       const DATA_BLOB *blobs, int count, void *owner,
+			       packet_send_callback_fn_t send_callback,
+			       void *private);
 void packet_queue_run(struct packet_context *pc);
 
 /*
@@ -61,6 +61,8 @@
 #define TALLOC_MAGIC 0xe814ec70
 #define TALLOC_FLAG_FREE 0x01
 #define TALLOC_FLAG_LOOP 0x02
+#define TALLOC_FLAG_POOL 0x04		/* This is a talloc pool */
+#define TALLOC_FLAG_POOLMEM 0x08	/* This is allocated in a pool */
 #define TALLOC_MAGIC_REFERENCE ((const char *)1)
 
 /* by default we abort when given a bad pointer (such as when talloc_free() is called 
@@ -102,18 +104,52 @@ struct talloc_reference_handle {
 
 typedef int (*talloc_destructor_t)(void *);
 
+/*
+  Usage counters and an optional limit for a subtree, created by
+  talloc_set_memlimit(). Every chunk below the context points at the
+  nearest one, and a limit set inside another one points at the
+  enclosing one through "upper", so allocations are checked and counted
+  against all of them.
+*/
+struct talloc_memlimit {
+	struct talloc_chunk *parent;	/* the context the limit was set on */
+	struct talloc_memlimit *upper;
+	size_t max_size;		/* 0 for no limit, just counting */
+	size_t cur_size;
+	size_t cur_blocks;
+	size_t peak_size;
+	size_t failures;
+};
+
 struct talloc_chunk {
 	struct talloc_chunk *next, *prev;
+	/* every chunk points at its parent, not just the first child */
 	struct talloc_chunk *parent, *child;
 	struct talloc_reference_handle *refs;
 	talloc_destructor_t destructor;
 	const char *name;
-	size_t size;
+	/* less than MAX_TALLOC_SIZE, an int keeps the header at 80 bytes */
+	unsigned size;
 	unsigned flags;
+	struct talloc_memlimit *limit;
+
+	/*
+	 * "pool" has dual use:
+	 *
+	 * For the talloc pool itself (i.e. TALLOC_FLAG_POOL is set), "pool"
+	 * marks the end of the currently allocated area.
+	 *
+	 * For members of the pool (i.e. TALLOC_FLAG_POOLMEM is set), "pool"
+	 * is a pointer to the struct talloc_chunk of the pool that it was
+	 * allocated from. This way children can quickly find the pool to chew
+	 * from.
+	 */
+	void *pool;
 };
 
 /* 16 byte alignment seems to keep everyone happy */
-#define TC_HDR_SIZE ((sizeof(struct talloc_chunk)+15)&~15)
+#define TC_ALIGN16(s) (((s)+15)&~15)
+#define TC_HDR_SIZE TC_ALIGN16(sizeof(struct talloc_chunk))
 #define TC_PTR_FROM_CHUNK(tc) ((void *)(TC_HDR_SIZE + (char*)tc))
 
 int talloc_tc_flags_ok(const void *pp)
@@ -122,6 +158,7 @@ int talloc_tc_flags_ok(const void *pp)
         unsigned test = tc->flags;
         test &= ~TALLOC_FLAG_FREE;
         test &= ~TALLOC_FLAG_LOOP;
+        test &= ~(TALLOC_FLAG_POOL|TALLOC_FLAG_POOLMEM);
         return (test == TALLOC_MAGIC);
 }
 
@@ -171,10 +208,9 @@ do { \
 /*
   return the parent chunk of a pointer
 */
-static struct talloc_chunk *talloc_parent_chunk(const void *ptr)
+static inline struct talloc_chunk *talloc_parent_chunk(const void *ptr)
 {
 	struct talloc_chunk *tc = talloc_chunk_from_ptr(ptr);
-	while (tc->prev) tc=tc->prev;
 	return tc->parent;
 }
 
@@ -195,21 +231,228 @@ const char *talloc_parent_name(const void *context)
 		return NULL;
 	}
 
-	tc = talloc_chunk_from_ptr(context);
-	while (tc && tc->prev) tc = tc->prev;
-	if (tc) {
-		tc = tc->parent;
+	tc = talloc_chunk_from_ptr(context)->parent;
+	return tc ? tc->name : NULL;
+}
+
+
+/*
+  check that size more bytes fit into a limit and all the limits
+  enclosing it, returns 0 if they don't
+*/
+static int talloc_memlimit_check(struct talloc_memlimit *limit, size_t size)
+{
+	struct talloc_memlimit *l;
+
+	for (l = limit; l; l = l->upper) {
+		if (l->max_size != 0 &&
+		    (l->cur_size >= l->max_size ||
+		     size > l->max_size - l->cur_size)) {
+			l->failures++;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void talloc_memlimit_grow(struct talloc_memlimit *limit,
+				 size_t size, size_t blocks)
+{
+	struct talloc_memlimit *l;
+
+	for (l = limit; l; l = l->upper) {
+		l->cur_size += size;
+		l->cur_blocks += blocks;
+		if (l->cur_size > l->peak_size) {
+			l->peak_size = l->cur_size;
+		}
+	}
+}
+
+static void talloc_memlimit_shrink(struct talloc_memlimit *limit,
+				   size_t size, size_t blocks)
+{
+	struct talloc_memlimit *l;
+
+	for (l = limit; l; l = l->upper) {
+		l->cur_size -= size;
+		l->cur_blocks -= blocks;
+	}
+}
+
+/*
+  the bytes and blocks of a subtree that are counted in a limit. Chunks
+  allocated from a pool are not, the pool itself is.
+*/
+static void talloc_memlimit_subtree(struct talloc_chunk *tc,
+				    size_t *size, size_t *blocks)
+{
+	struct talloc_chunk *c;
+
+	if (!(tc->flags & TALLOC_FLAG_POOLMEM)) {
+		*size += tc->size;
+		*blocks += 1;
+	}
+	for (c = tc->child; c; c = c->next) {
+		talloc_memlimit_subtree(c, size, blocks);
+	}
+}
+
+/*
+  point a subtree that used the limit old at the limit new. Below a
+  context with a limit of its own only that limit needs to be relinked.
+*/
+static void talloc_memlimit_relink(struct talloc_chunk *tc,
+				   struct talloc_memlimit *old,
+				   struct talloc_memlimit *new_limit)
+{
+	struct talloc_chunk *c;
+
+	if (tc->limit && tc->limit->parent == tc) {
+		if (tc->limit->upper == old) {
+			tc->limit->upper = new_limit;
+		}
+		return;
+	}
+	if (tc->limit == old) {
+		tc->limit = new_limit;
+	}
+	for (c = tc->child; c; c = c->next) {
+		talloc_memlimit_relink(c, old, new_limit);
 	}
-	return tc->name;
 }
 
+/*
+  move the accounting of a subtree that is being stolen to a context
+  under a different limit. This walks the subtree, stealing within one
+  limit costs nothing.
+*/
+static void talloc_memlimit_move(struct talloc_chunk *tc,
+				 struct talloc_memlimit *new_limit)
+{
+	struct talloc_memlimit *old = tc->limit;
+	size_t size = 0, blocks = 0;
+
+	if (old && old->parent == tc) {
+		/* the subtree has a limit of its own, it moves as a whole */
+		if (old->upper == new_limit) {
+			return;
+		}
+		talloc_memlimit_shrink(old->upper, old->cur_size, old->cur_blocks);
+		talloc_memlimit_grow(new_limit, old->cur_size, old->cur_blocks);
+		old->upper = new_limit;
+		return;
+	}
+
+	if (old == new_limit) {
+		return;
+	}
+
+	talloc_memlimit_subtree(tc, &size, &blocks);
+	talloc_memlimit_shrink(old, size, blocks);
+	talloc_memlimit_grow(new_limit, size, blocks);
+	talloc_memlimit_relink(tc, old, new_limit);
+}
+
+
+/*
+  A pool carries an unsigned int object count right after its chunk
+  header, followed by the memory its children are carved out of. The
+  count includes the pool itself, so the block is released once the
+  pool and every chunk allocated from it have been freed.
+*/
+#define TALLOC_POOL_HDR_SIZE 16
+
+static unsigned int *talloc_pool_objectcount(struct talloc_chunk *tc)
+{
+	return (unsigned int *)((char *)tc + TC_HDR_SIZE);
+}
+
+#define TC_POOL_FIRST_CHUNK(tc) \
+	((void *)((char *)(tc) + TC_HDR_SIZE + TALLOC_POOL_HDR_SIZE))
+
+/*
+  Allocate from a pool, returns NULL if the parent is not in a pool or
+  the pool has run out of space
+*/
+static struct talloc_chunk *talloc_alloc_pool(struct talloc_chunk *parent,
+					      size_t size)
+{
+	struct talloc_chunk *pool_ctx = NULL;
+	size_t space_left;
+	struct talloc_chunk *result;
+	size_t chunk_size;
+
+	if (parent == NULL) {
+		return NULL;
+	}
+
+	if (parent->flags & TALLOC_FLAG_POOL) {
+		pool_ctx = parent;
+	}
+	else if (parent->flags & TALLOC_FLAG_POOLMEM) {
+		pool_ctx = (struct talloc_chunk *)parent->pool;
+	}
+
+	if (pool_ctx == NULL) {
+		return NULL;
+	}
+
+	space_left = ((char *)pool_ctx + TC_HDR_SIZE + pool_ctx->size)
+		- ((char *)pool_ctx->pool);
+
+	/*
+	 * Align size to 16 bytes
+	 */
+	chunk_size = TC_ALIGN16(size);
+
+	if (space_left < chunk_size) {
+		return NULL;
+	}
+
+	result = (struct talloc_chunk *)pool_ctx->pool;
+	pool_ctx->pool = (void *)((char *)result + chunk_size);
+
+	result->flags = TALLOC_MAGIC | TALLOC_FLAG_POOLMEM;
+	result->pool = pool_ctx;
+
+	*talloc_pool_objectcount(pool_ctx) += 1;
+
+	return result;
+}
+
+/*
+  Give a chunk of a pool back. Once only the pool itself is left its
+  memory can be handed out again from the start; once the pool is gone
+  too the block is freed.
+*/
+static void talloc_pool_release(struct talloc_chunk *pool)
+{
+	unsigned int *pool_object_count = talloc_pool_objectcount(pool);
+
+	if (unlikely(*pool_object_count == 0)) {
+		TALLOC_ABORT("Pool object count zero!");
+	}
+
+	*pool_object_count -= 1;
+
+	if (*pool_object_count == 1 && !(pool->flags & TALLOC_FLAG_FREE)) {
+		pool->pool = TC_POOL_FIRST_CHUNK(pool);
+	} else if (*pool_object_count == 0) {
+		free(pool);
+	}
+}
 
 /* 
-   Allocate a bit of memory as a child of an existing pointer
+   Allocate a bit of memory as a child of an existing pointer, carving
+   it out of the parent's pool if use_pool is set and there is one
 */
-static inline void *__talloc(const void *context, size_t size)
+static inline void *__talloc_chunk(const void *context, size_t size,
+				   int use_pool)
 {
-	struct talloc_chunk *tc;
+	struct talloc_chunk *tc = NULL;
+	struct talloc_chunk *parent = NULL;
+	struct talloc_memlimit *limit = NULL;
 
 	if (unlikely(context == NULL)) {
 		context = null_context;
@@ -219,21 +462,38 @@ static inline void *__talloc(const void *context, size_t size)
 		return NULL;
 	}
 
-	tc = (struct talloc_chunk *)malloc(TC_HDR_SIZE+size);
-	if (unlikely(tc == NULL)) return NULL;
+	if (likely(context)) {
+		parent = talloc_chunk_from_ptr(context);
+		limit = parent->limit;
+		if (use_pool &&
+		    (parent->flags & (TALLOC_FLAG_POOL|TALLOC_FLAG_POOLMEM))) {
+			tc = talloc_alloc_pool(parent, TC_HDR_SIZE+size);
+		}
+	}
+
+	if (tc == NULL) {
+		if (unlikely(limit != NULL) &&
+		    !talloc_memlimit_check(limit, size)) {
+			return NULL;
+		}
+		tc = (struct talloc_chunk *)malloc(TC_HDR_SIZE+size);
+		if (unlikely(tc == NULL)) return NULL;
+		tc->flags = TALLOC_MAGIC;
+		tc->pool = NULL;
+		if (unlikely(limit != NULL)) {
+			talloc_memlimit_grow(limit, size, 1);
+		}
+	}
 
 	tc->size = size;
-	tc->flags = TALLOC_MAGIC;
+	tc->limit = limit;
 	tc->destructor = NULL;
 	tc->child = NULL;
 	tc->name = NULL;
 	tc->refs = NULL;
 
-	if (likely(context)) {
-		struct talloc_chunk *parent = talloc_chunk_from_ptr(context);
-
+	if (likely(parent)) {
 		if (parent->child) {
-			parent->child->parent = NULL;
 			tc->next = parent->child;
 			tc->next->prev = tc;
 		} else {
@@ -249,6 +509,36 @@ static inline void *__talloc(const void *context, size_t size)
 	return TC_PTR_FROM_CHUNK(tc);
 }
 
+static inline void *__talloc(const void *context, size_t size)
+{
+	return __talloc_chunk(context, size, 1);
+}
+
+/*
+ * Create a talloc pool. Its block always comes from malloc(), also when
+ * the parent is itself in a pool: talloc_pool_release() hands the block
+ * back with free().
+ */
+
+void *talloc_pool(const void *context, size_t size)
+{
+	void *result = __talloc_chunk(context, size + TALLOC_POOL_HDR_SIZE, 0);
+	struct talloc_chunk *tc;
+
+	if (unlikely(result == NULL)) {
+		return NULL;
+	}
+
+	tc = talloc_chunk_from_ptr(result);
+
+	tc->flags |= TALLOC_FLAG_POOL;
+	tc->pool = TC_POOL_FIRST_CHUNK(tc);
+
+	*talloc_pool_objectcount(tc) = 1;
+
+	return result;
+}
+
 /*
   setup a destructor to be called on free of a pointer
   the destructor should return 0 on success, or -1 on failure.
@@ -390,9 +680,6 @@ static inline int _talloc_free(void *ptr)
 
 	if (tc->parent) {
 		_TLIST_REMOVE(tc->parent->child, tc);
-		if (tc->parent->child) {
-			tc->parent->child->parent = tc->parent;
-		}
 	} else {
 		if (tc->prev) tc->prev->next = tc->next;
 		if (tc->next) tc->next->prev = tc->prev;
@@ -422,7 +709,23 @@ static inline int _talloc_free(void *ptr)
 	}
 
 	tc->flags |= TALLOC_FLAG_FREE;
-	free(tc);
+
+	if (unlikely(tc->limit != NULL)) {
+		if (!(tc->flags & TALLOC_FLAG_POOLMEM)) {
+			talloc_memlimit_shrink(tc->limit, tc->size, 1);
+		}
+		if (tc->limit->parent == tc) {
+			free(tc->limit);
+		}
+	}
+
+	if (tc->flags & TALLOC_FLAG_POOL) {
+		talloc_pool_release(tc);
+	} else if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		talloc_pool_release((struct talloc_chunk *)tc->pool);
+	} else {
+		free(tc);
+	}
 	return 0;
 }
 
@@ -448,15 +751,15 @@ void *_talloc_steal(const void *new_ctx, const void *ptr)
 	if (unlikely(new_ctx == NULL)) {
 		if (tc->parent) {
 			_TLIST_REMOVE(tc->parent->child, tc);
-			if (tc->parent->child) {
-				tc->parent->child->parent = tc->parent;
-			}
 		} else {
 			if (tc->prev) tc->prev->next = tc->next;
 			if (tc->next) tc->next->prev = tc->prev;
 		}
 		
 		tc->parent = tc->next = tc->prev = NULL;
+		if (unlikely(tc->limit != NULL)) {
+			talloc_memlimit_move(tc, NULL);
+		}
 		return discard_const_p(void, ptr);
 	}
 
@@ -466,18 +769,18 @@ void *_talloc_steal(const void *new_ctx, const void *ptr)
 		return discard_const_p(void, ptr);
 	}
 
+	if (unlikely(tc->limit != new_tc->limit)) {
+		talloc_memlimit_move(tc, new_tc->limit);
+	}
+
 	if (tc->parent) {
 		_TLIST_REMOVE(tc->parent->child, tc);
-		if (tc->parent->child) {
-			tc->parent->child->parent = tc->parent;
-		}
 	} else {
 		if (tc->prev) tc->prev->next = tc->next;
 		if (tc->next) tc->next->prev = tc->prev;
 	}
 
 	tc->parent = new_tc;
-	if (new_tc->child) new_tc->child->parent = NULL;
 	_TLIST_ADD(new_tc->child, tc);
 
 	return discard_const_p(void, ptr);
@@ -769,8 +1072,9 @@ int talloc_free(void *ptr)
 */
 void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *name)
 {
-	struct talloc_chunk *tc;
+	struct talloc_chunk *tc, *old_tc;
 	void *new_ptr;
+	struct talloc_chunk *pool = NULL;
 
 	/* size zero is equivalent to free() */
 	if (unlikely(size == 0)) {
@@ -794,31 +1098,91 @@ void *_talloc_realloc(const void *context, void *ptr, size_t size, const char *n
 		return NULL;
 	}
 
+	/* a pool cannot move, its members point into it */
+	if (unlikely(tc->flags & TALLOC_FLAG_POOL)) {
+		return NULL;
+	}
+
+	/* only the growth of a malloc()ed chunk needs to fit the limit,
+	   the copy of a pool member may end up outside its pool */
+	if (unlikely(tc->limit != NULL) &&
+	    ((tc->flags & TALLOC_FLAG_POOLMEM) || size > tc->size) &&
+	    !talloc_memlimit_check(tc->limit, (tc->flags & TALLOC_FLAG_POOLMEM)
+				   ? size : size - tc->size)) {
+		return NULL;
+	}
+
+	old_tc = tc;
+
 	/* by resetting magic we catch users of the old memory */
 	tc->flags |= TALLOC_FLAG_FREE;
 
+	if (tc->flags & TALLOC_FLAG_POOLMEM) {
+		/* pool members are not realloc()able, copy to a new chunk,
+		   from the same pool if there is room left */
+		pool = (struct talloc_chunk *)tc->pool;
+		new_ptr = talloc_alloc_pool(tc, size + TC_HDR_SIZE);
+		if (new_ptr == NULL) {
+			new_ptr = malloc(TC_HDR_SIZE+size);
+			if (new_ptr) {
+				((struct talloc_chunk *)new_ptr)->flags = 0;
+			}
+		}
+		if (new_ptr) {
+			unsigned flags = ((struct talloc_chunk *)new_ptr)->flags;
+			memcpy(new_ptr, tc, MIN(tc->size, size) + TC_HDR_SIZE);
+			((struct talloc_chunk *)new_ptr)->flags =
+				(tc->flags & ~TALLOC_FLAG_POOLMEM) | flags;
+			((struct talloc_chunk *)new_ptr)->pool =
+				(flags & TALLOC_FLAG_POOLMEM) ? pool : NULL;
+		}
+	} else {
 #if ALWAYS_REALLOC
-	new_ptr = malloc(size + TC_HDR_SIZE);
-	if (new_ptr) {
-		memcpy(new_ptr, tc, tc->size + TC_HDR_SIZE);
-		free(tc);
-	}
+		new_ptr = malloc(size + TC_HDR_SIZE);
+		if (new_ptr) {
+			memcpy(new_ptr, tc, tc->size + TC_HDR_SIZE);
+			free(tc);
+		}
 #else
-	new_ptr = realloc(tc, size + TC_HDR_SIZE);
+		new_ptr = realloc(tc, size + TC_HDR_SIZE);
 #endif
+	}
 	if (unlikely(!new_ptr)) {	
 		tc->flags &= ~TALLOC_FLAG_FREE; 
 		return NULL; 
 	}
 
-	tc = (struct talloc_chunk *)new_ptr;
-	tc->flags &= ~TALLOC_FLAG_FREE; 
-	if (tc->parent) {
-		tc->parent->child = tc;
+	if (pool != NULL) {
+		/* the old copy is no longer in use */
+		talloc_pool_release(pool);
+	}
+
+	if (unlikely(((struct talloc_chunk *)new_ptr)->limit != NULL)) {
+		struct talloc_chunk *n = (struct talloc_chunk *)new_ptr;
+		if (pool == NULL) {
+			talloc_memlimit_shrink(n->limit, n->size, 0);
+			talloc_memlimit_grow(n->limit, size, 0);
+		} else if (!(n->flags & TALLOC_FLAG_POOLMEM)) {
+			talloc_memlimit_grow(n->limit, size, 1);
+		}
+		if (n->limit->parent == old_tc) {
+			n->limit->parent = n;
+		}
 	}
-	if (tc->child) {
-		tc->child->parent = tc;
+
+	if (new_ptr != (void *)tc) {
+		struct talloc_chunk *c;
+
+		tc = (struct talloc_chunk *)new_ptr;
+		if (tc->parent && tc->prev == NULL) {
+			tc->parent->child = tc;
+		}
+		/* the block moved, so the children need the new address */
+		for (c = tc->child; c; c = c->next) {
+			c->parent = tc;
+		}
 	}
+	tc->flags &= ~TALLOC_FLAG_FREE; 
 
 	if (tc->prev) {
 		tc->prev->next = tc;
@@ -902,6 +1266,64 @@ size_t talloc_total_blocks(const void *ptr)
 	return total;
 }
 
+/*
+  count the memory below a context from now on, and fail allocations
+  that would take it over max_size bytes (0 for no limit). Calling it
+  again on the same context changes the limit.
+*/
+int talloc_set_memlimit(const void *ctx, size_t max_size)
+{
+	struct talloc_chunk *c, *tc = talloc_chunk_from_ptr(ctx);
+	struct talloc_memlimit *limit;
+
+	if (tc->limit && tc->limit->parent == tc) {
+		tc->limit->max_size = max_size;
+		return 0;
+	}
+
+	limit = (struct talloc_memlimit *)malloc(sizeof(*limit));
+	if (unlikely(limit == NULL)) {
+		return -1;
+	}
+
+	limit->parent = tc;
+	limit->upper = tc->limit;
+	limit->max_size = max_size;
+	limit->cur_size = 0;
+	limit->cur_blocks = 0;
+	limit->failures = 0;
+	talloc_memlimit_subtree(tc, &limit->cur_size, &limit->cur_blocks);
+	limit->peak_size = limit->cur_size;
+
+	for (c = tc->child; c; c = c->next) {
+		talloc_memlimit_relink(c, limit->upper, limit);
+	}
+	tc->limit = limit;
+
+	return 0;
+}
+
+/*
+  copy out the counters of a context set up with talloc_set_memlimit(),
+  returns -1 for any other context
+*/
+int talloc_get_memstats(const void *ctx, struct talloc_memstats *stats)
+{
+	struct talloc_chunk *tc = talloc_chunk_from_ptr(ctx);
+	struct talloc_memlimit *limit = tc->limit;
+
+	if (limit == NULL || limit->parent != tc) {
+		return -1;
+	}
+
+	stats->bytes = limit->cur_size;
+	stats->blocks = limit->cur_blocks;
+	stats->peak_bytes = limit->peak_size;
+	stats->max_bytes = limit->max_size;
+	stats->failures = limit->failures;
+	return 0;
+}
+
 /*
   return the number of external references to a pointer
 */
@@ -1382,10 +1804,7 @@ void *talloc_find_parent_byname(const void *context, const char *name)
 		if (tc->name && strcmp(tc->name, name) == 0) {
 			return TC_PTR_FROM_CHUNK(tc);
 		}
-		while (tc && tc->prev) tc = tc->prev;
-		if (tc) {
-			tc = tc->parent;
-		}
+		tc = tc->parent;
 	}
 	return NULL;
 }
@@ -1406,10 +1825,7 @@ void talloc_show_parents(const void *context, FILE *file)
 	fprintf(file, "talloc parents of '%s'\n", talloc_get_name(context));
 	while (tc) {
 		fprintf(file, "\t'%s'\n", talloc_get_name(TC_PTR_FROM_CHUNK(tc)));
-		while (tc && tc->prev) tc = tc->prev;
-		if (tc) {
-			tc = tc->parent;
-		}
+		tc = tc->parent;
 	}
 	fflush(file);
 }
@@ -1428,10 +1844,7 @@ int talloc_is_parent(const void *context, const void *ptr)
 	tc = talloc_chunk_from_ptr(context);
 	while (tc) {
 		if (TC_PTR_FROM_CHUNK(tc) == ptr) return 1;
-		while (tc && tc->prev) tc = tc->prev;
-		if (tc) {
-			tc = tc->parent;
-		}
+		tc = tc->parent;
 	}
 	return 0;
 }
@@ -29,6 +29,15 @@
 /* this is only needed for compatibility with the old talloc */
 typedef void TALLOC_CTX;
 
+/* counters of a context, see talloc_set_memlimit() */
+struct talloc_memstats {
+	size_t bytes;		/* allocated below the context now */
+	size_t blocks;
+	size_t peak_bytes;
+	size_t max_bytes;	/* the limit, 0 for none */
+	size_t failures;	/* allocations refused by the limit */
+};
+
 /*
   this uses a little trick to allow __LINE__ to be stringified
 */
@@ -120,6 +129,7 @@ void talloc_set_name_const(const void *ptr, const char *name);
 void *talloc_named(const void *context, size_t size, 
 		   const char *fmt, ...) PRINTF_ATTRIBUTE(3,4);
 void *talloc_named_const(const void *context, size_t size, const char *name);
+void *talloc_pool(const void *context, size_t size);
 const char *talloc_get_name(const void *ptr);
 void *talloc_check_name(const void *ptr, const char *name);
 void *talloc_parent(const void *ptr);
@@ -131,6 +141,8 @@ void *_talloc_steal(const void *new_ctx, const void *ptr);
 void *_talloc_move(const void *new_ctx, const void *pptr);
 size_t talloc_total_size(const void *ptr);
 size_t talloc_total_blocks(const void *ptr);
+int talloc_set_memlimit(const void *ctx, size_t max_size);
+int talloc_get_memstats(const void *ctx, struct talloc_memstats *stats);
 void talloc_report_depth_cb(const void *ptr, int depth, int max_depth,
 			    void (*callback)(const void *ptr,
 			  		     int depth, int max_depth,
@@ -162,6 +174,7 @@ size_t talloc_get_size(const void *ctx);
 void *talloc_find_parent_byname(const void *ctx, const char *name);
 void talloc_show_parents(const void *context, FILE *file);
 int talloc_is_parent(const void *context, const void *ptr);
+int talloc_tc_flags_ok(const void *pp);
 
 #endif
 
@@ -814,6 +814,25 @@ static bool test_speed(void)
 
 	talloc_free(ctx);
 
+	ctx = talloc_pool(NULL, 1024);
+
+	tv = timeval_current();
+	count = 0;
+	do {
+		void *p1, *p2, *p3;
+		for (i=0;i<loop;i++) {
+			p1 = talloc_size(ctx, loop % 100);
+			p2 = talloc_strdup(p1, "foo bar");
+			p3 = talloc_size(p1, 300);
+			talloc_free_children(ctx);
+		}
+		count += 3 * loop;
+	} while (timeval_elapsed(&tv) < 5.0);
+
+	talloc_free(ctx);
+
+	fprintf(stderr, "talloc_pool: %.0f ops/sec\n", count/timeval_elapsed(&tv));
+
 	tv = timeval_current();
 	count = 0;
 	do {
@@ -835,6 +854,96 @@ static bool test_speed(void)
 	return true;
 }
 
+static bool test_speed_hierarchy(void)
+{
+	void *top = talloc_new(NULL);
+	void *wide, *deep, *oldest = NULL, *leaf, *p, *c;
+	unsigned count;
+	const int loop = 1000;
+	const int width = 100000;
+	const int depth = 1000;
+	int i;
+	struct timeval tv;
+
+	printf("test: speed_hierarchy [\nTALLOC PARENT LOOKUPS IN WIDE AND DEEP TREES\n]\n");
+
+	/* the oldest child is the last one in its parent's list */
+	wide = talloc_named_const(top, 0, "wide");
+	for (i=0;i<width;i++) {
+		p = talloc_size(wide, 1);
+		if (oldest == NULL) oldest = p;
+	}
+
+	leaf = deep = talloc_named_const(top, 0, "deep");
+	for (i=0;i<depth;i++) {
+		leaf = talloc_size(leaf, 1);
+	}
+
+	torture_assert("speed_hierarchy", talloc_parent(oldest) == wide,
+		       "wrong parent in a wide tree");
+	torture_assert("speed_hierarchy",
+		       talloc_find_parent_byname(leaf, "deep") == deep,
+		       "parent not found in a deep tree");
+
+	/* children follow a parent that moves */
+	p = talloc_size(top, 10);
+	c = talloc_size(p, 1);
+	p = talloc_realloc_size(top, p, 100000);
+	torture_assert("speed_hierarchy", talloc_parent(c) == p,
+		       "child lost its parent when it moved");
+
+	tv = timeval_current();
+	count = 0;
+	do {
+		for (i=0;i<loop;i++) {
+			talloc_parent(oldest);
+		}
+		count += loop;
+	} while (timeval_elapsed(&tv) < 1.0);
+	fprintf(stderr, "talloc_parent (%d siblings): %.0f ops/sec\n",
+		width, count/timeval_elapsed(&tv));
+
+	tv = timeval_current();
+	count = 0;
+	do {
+		for (i=0;i<loop;i++) {
+			talloc_reference(top, oldest);
+			talloc_unlink(top, oldest);
+		}
+		count += 2 * loop;
+	} while (timeval_elapsed(&tv) < 1.0);
+	fprintf(stderr, "talloc_reference/unlink (%d siblings): %.0f ops/sec\n",
+		width, count/timeval_elapsed(&tv));
+
+	tv = timeval_current();
+	count = 0;
+	do {
+		for (i=0;i<loop;i++) {
+			talloc_steal(top, oldest);
+			talloc_steal(wide, oldest);
+		}
+		count += 2 * loop;
+	} while (timeval_elapsed(&tv) < 1.0);
+	fprintf(stderr, "talloc_steal (%d siblings): %.0f ops/sec\n",
+		width, count/timeval_elapsed(&tv));
+
+	tv = timeval_current();
+	count = 0;
+	do {
+		for (i=0;i<loop;i++) {
+			talloc_find_parent_byname(leaf, "deep");
+		}
+		count += loop;
+	} while (timeval_elapsed(&tv) < 1.0);
+	fprintf(stderr, "talloc_find_parent_byname (depth %d): %.0f ops/sec\n",
+		depth, count/timeval_elapsed(&tv));
+
+	talloc_free(top);
+
+	printf("success: speed_hierarchy\n");
+	return true;
+}
+
 static bool test_lifeless(void)
 {
 	void *top = talloc_new(NULL);
@@ -1010,6 +1119,160 @@ static bool test_talloc_ptrtype(void)
 	return true;
 }
 
+static bool test_pool(void)
+{
+	void *pool;
+	void *p1, *p2, *p3, *p4;
+
+	printf("test: pool [\nTALLOC POOL\n]\n");
+
+	pool = talloc_pool(NULL, 1024);
+
+	p1 = talloc_size(pool, 80);
+	p2 = talloc_size(pool, 20);
+	p3 = talloc_size(p1, 50);
+	p4 = talloc_size(p3, 1000);
+
+	torture_assert("pool", (char *)p2 > (char *)pool &&
+		       (char *)p2 < (char *)pool + 1024 + 256,
+		       "small chunk not carved out of the pool");
+
+	/* growing a pool member has to move it */
+	p2 = talloc_realloc_size(pool, p2, 2000);
+	torture_assert("pool", p2 != NULL, "realloc of pool member failed");
+	memset(p2, 0, 2000);
+
+	talloc_free(pool);
+
+	/* a stolen member keeps the pool memory alive */
+	pool = talloc_pool(NULL, 1024);
+	p1 = talloc_strdup(pool, "survivor");
+	p2 = talloc_new(NULL);
+	talloc_steal(p2, p1);
+	talloc_free(pool);
+	torture_assert_str_equal("pool", (const char *)p1, "survivor",
+				 "stolen member lost its contents");
+	talloc_free(p2);
+
+	/* once empty a pool is reused from the start */
+	pool = talloc_pool(NULL, 1024);
+	p1 = talloc_size(pool, 100);
+	talloc_free_children(pool);
+	p2 = talloc_size(pool, 100);
+	torture_assert("pool", p1 == p2, "empty pool not reused");
+	talloc_free(pool);
+
+	/*
+	 * a pool inside a pool gets its own block; the size of a pool is
+	 * that of its whole block, so nothing carved out of it lies past it
+	 */
+	pool = talloc_pool(NULL, 8192);
+	p1 = talloc_size(pool, 16);
+	p2 = talloc_pool(p1, 4096);
+	torture_assert("pool", p2 != NULL, "nested pool failed");
+	torture_assert("pool", (char *)p2 < (char *)pool ||
+		       (char *)p2 >= (char *)pool + talloc_get_size(pool),
+		       "nested pool carved out of its parent pool");
+	torture_assert("pool", talloc_tc_flags_ok(p2), "pool flags not masked");
+	p3 = talloc_strdup(p2, "nested");
+	torture_assert("pool", (char *)p3 > (char *)p2 &&
+		       (char *)p3 < (char *)p2 + talloc_get_size(p2),
+		       "nested pool member not carved out of the nested pool");
+	talloc_free(p2);
+	p2 = talloc_pool(pool, 512);
+	talloc_steal(NULL, p2);
+	talloc_free(pool);
+	talloc_free(p2);
+
+	printf("success: pool\n");
+	return true;
+}
+
+static bool test_memlimit(void)
+{
+	void *root, *inner, *p1, *p2, *other;
+	struct talloc_memstats st;
+
+	printf("test: memlimit [\nMEMORY LIMITS\n]\n");
+
+	root = talloc_named_const(NULL, 0, "root");
+	p1 = talloc_size(root, 100);
+
+	torture_assert("memlimit", talloc_get_memstats(root, &st) == -1,
+		       "stats without a limit");
+
+	/* existing children are counted when the limit is set */
+	torture_assert("memlimit", talloc_set_memlimit(root, 1000) == 0,
+		       "set limit failed");
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 100 && st.blocks == 2,
+		       "existing children not counted");
+
+	p2 = talloc_size(p1, 500);
+	torture_assert("memlimit", p2 != NULL, "allocation below limit failed");
+	torture_assert("memlimit", talloc_size(root, 500) == NULL,
+		       "allocation over limit succeeded");
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 600 && st.failures == 1,
+		       "wrong counters after refused allocation");
+
+	/* realloc is counted by its growth */
+	p2 = talloc_realloc_size(NULL, p2, 800);
+	torture_assert("memlimit", p2 != NULL, "realloc below limit failed");
+	torture_assert("memlimit",
+		       talloc_realloc_size(NULL, p2, 2000) == NULL,
+		       "realloc over limit succeeded");
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 900 && st.peak_bytes == 900,
+		       "wrong counters after realloc");
+
+	/* a nested limit is checked together with the outer one */
+	talloc_free(p1);
+	inner = talloc_named_const(root, 0, "inner");
+	talloc_set_memlimit(inner, 200);
+	torture_assert("memlimit", talloc_size(inner, 300) == NULL,
+		       "allocation over inner limit succeeded");
+	p1 = talloc_size(inner, 150);
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 150 && st.blocks == 3,
+		       "inner allocation not counted in outer limit");
+
+	/* stealing moves the bytes out of both limits */
+	other = talloc_new(NULL);
+	talloc_steal(other, p1);
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 0, "stolen bytes still counted");
+	talloc_get_memstats(inner, &st);
+	torture_assert("memlimit", st.bytes == 0 && st.blocks == 1,
+		       "stolen bytes still counted in inner limit");
+	talloc_steal(inner, p1);
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 150, "stolen bytes not counted");
+
+	/* and a context with its own limit moves as a whole */
+	talloc_steal(other, inner);
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes == 0 && st.blocks == 1,
+		       "moved limit still counted");
+	talloc_free(other);
+
+	/* pool members are counted as part of the pool */
+	p1 = talloc_pool(root, 500);
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes >= 500, "pool not counted");
+	p2 = talloc_size(p1, 100);
+	p2 = talloc_size(p1, 150);
+	talloc_get_memstats(root, &st);
+	torture_assert("memlimit", st.bytes < 1000 && st.blocks == 2,
+		       "pool members counted twice");
+	talloc_free(p1);
+
+	talloc_free(root);
+
+	printf("success: memlimit\n");
+	return true;
+}
+
 static bool test_autofree(void)
 {
 #ifndef _SAMBA_BUILD_
@@ -1055,9 +1318,12 @@ bool torture_local_talloc(struct torture_context *tctx)
 	ret &= test_loop();
 	ret &= test_free_parent_deny_child(); 
 	ret &= test_talloc_ptrtype();
+	ret &= test_pool();
+	ret &= test_memlimit();
 
 	if (ret) {
 		ret &= test_speed();
+		ret &= test_speed_hierarchy();
 	}
 	ret &= test_autofree();
 
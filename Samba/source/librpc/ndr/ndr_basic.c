@@ -277,6 +277,72 @@ _PUBLIC_ NTSTATUS ndr_pull_array_uint8(struct ndr_pull *ndr, int ndr_flags, uint
 	return ndr_pull_bytes(ndr, data, n);
 }
 
+/*
+  pull an array of uint16. This is the same as pulling the elements one
+  at a time, but the alignment and bounds are checked once and a little
+  endian buffer is copied as a whole
+*/
+_PUBLIC_ NTSTATUS ndr_pull_array_uint16(struct ndr_pull *ndr, int ndr_flags, uint16_t *data, uint32_t n)
+{
+	uint32_t i;
+
+	if (!(ndr_flags & NDR_SCALARS) || n == 0) {
+		return NT_STATUS_OK;
+	}
+	NDR_PULL_ALIGN(ndr, 2);
+	if (n > ndr->data_size / 2) {
+		return ndr_pull_error(ndr, NDR_ERR_BUFSIZE, "Pull array of %u uint16", n);
+	}
+	NDR_PULL_NEED_BYTES(ndr, n*2);
+	if (NDR_BE(ndr)) {
+		for (i=0;i<n;i++) {
+			data[i] = RSVAL(ndr->data, ndr->offset + i*2);
+		}
+	} else {
+#ifdef WORDS_BIGENDIAN
+		for (i=0;i<n;i++) {
+			data[i] = SVAL(ndr->data, ndr->offset + i*2);
+		}
+#else
+		memcpy(data, ndr->data + ndr->offset, n*2);
+#endif
+	}
+	ndr->offset += n*2;
+	return NT_STATUS_OK;
+}
+
+/*
+  pull an array of uint32, see ndr_pull_array_uint16()
+*/
+_PUBLIC_ NTSTATUS ndr_pull_array_uint32(struct ndr_pull *ndr, int ndr_flags, uint32_t *data, uint32_t n)
+{
+	uint32_t i;
+
+	if (!(ndr_flags & NDR_SCALARS) || n == 0) {
+		return NT_STATUS_OK;
+	}
+	NDR_PULL_ALIGN(ndr, 4);
+	if (n > ndr->data_size / 4) {
+		return ndr_pull_error(ndr, NDR_ERR_BUFSIZE, "Pull array of %u uint32", n);
+	}
+	NDR_PULL_NEED_BYTES(ndr, n*4);
+	if (NDR_BE(ndr)) {
+		for (i=0;i<n;i++) {
+			data[i] = RIVAL(ndr->data, ndr->offset + i*4);
+		}
+	} else {
+#ifdef WORDS_BIGENDIAN
+		for (i=0;i<n;i++) {
+			data[i] = IVAL(ndr->data, ndr->offset + i*4);
+		}
+#else
+		memcpy(data, ndr->data + ndr->offset, n*4);
+#endif
+	}
+	ndr->offset += n*4;
+	return NT_STATUS_OK;
+}
+
 /*
   push a int8_t
 */
@@ -448,6 +514,70 @@ _PUBLIC_ NTSTATUS ndr_push_array_uint8(struct ndr_push *ndr, int ndr_flags, cons
 	return ndr_push_bytes(ndr, data, n);
 }
 
+/*
+  push an array of uint16, the counterpart of ndr_pull_array_uint16()
+*/
+_PUBLIC_ NTSTATUS ndr_push_array_uint16(struct ndr_push *ndr, int ndr_flags, const uint16_t *data, uint32_t n)
+{
+	uint32_t i;
+
+	if (!(ndr_flags & NDR_SCALARS) || n == 0) {
+		return NT_STATUS_OK;
+	}
+	NDR_PUSH_ALIGN(ndr, 2);
+	if (n > UINT32_MAX / 2) {
+		return ndr_push_error(ndr, NDR_ERR_LENGTH, "Push array of %u uint16", n);
+	}
+	NDR_PUSH_NEED_BYTES(ndr, n*2);
+	if (NDR_BE(ndr)) {
+		for (i=0;i<n;i++) {
+			RSSVAL(ndr->data, ndr->offset + i*2, data[i]);
+		}
+	} else {
+#ifdef WORDS_BIGENDIAN
+		for (i=0;i<n;i++) {
+			SSVAL(ndr->data, ndr->offset + i*2, data[i]);
+		}
+#else
+		memcpy(ndr->data + ndr->offset, data, n*2);
+#endif
+	}
+	ndr->offset += n*2;
+	return NT_STATUS_OK;
+}
+
+/*
+  push an array of uint32, the counterpart of ndr_pull_array_uint32()
+*/
+_PUBLIC_ NTSTATUS ndr_push_array_uint32(struct ndr_push *ndr, int ndr_flags, const uint32_t *data, uint32_t n)
+{
+	uint32_t i;
+
+	if (!(ndr_flags & NDR_SCALARS) || n == 0) {
+		return NT_STATUS_OK;
+	}
+	NDR_PUSH_ALIGN(ndr, 4);
+	if (n > UINT32_MAX / 4) {
+		return ndr_push_error(ndr, NDR_ERR_LENGTH, "Push array of %u uint32", n);
+	}
+	NDR_PUSH_NEED_BYTES(ndr, n*4);
+	if (NDR_BE(ndr)) {
+		for (i=0;i<n;i++) {
+			RSIVAL(ndr->data, ndr->offset + i*4, data[i]);
+		}
+	} else {
+#ifdef WORDS_BIGENDIAN
+		for (i=0;i<n;i++) {
+			SIVAL(ndr->data, ndr->offset + i*4, data[i]);
+		}
+#else
+		memcpy(ndr->data + ndr->offset, data, n*4);
+#endif
+	}
+	ndr->offset += n*4;
+	return NT_STATUS_OK;
+}
+
 /*
   save the current position
  */
@@ -784,6 +914,42 @@ _PUBLIC_ void ndr_print_array_uint8(struct ndr_print *ndr, const char *name,
 	ndr->depth--;	
 }
 
+_PUBLIC_ void ndr_print_array_uint16(struct ndr_print *ndr, const char *name, 
+			   const uint16_t *data, uint32_t count)
+{
+	uint32_t i;
+
+	ndr->print(ndr, "%s: ARRAY(%u)", name, count);
+	ndr->depth++;
+	for (i=0;i<count;i++) {
+		char *idx=NULL;
+		asprintf(&idx, "[%u]", i);
+		if (idx) {
+			ndr_print_uint16(ndr, idx, data[i]);
+			free(idx);
+		}
+	}
+	ndr->depth--;	
+}
+
+_PUBLIC_ void ndr_print_array_uint32(struct ndr_print *ndr, const char *name, 
+			   const uint32_t *data, uint32_t count)
+{
+	uint32_t i;
+
+	ndr->print(ndr, "%s: ARRAY(%u)", name, count);
+	ndr->depth++;
+	for (i=0;i<count;i++) {
+		char *idx=NULL;
+		asprintf(&idx, "[%u]", i);
+		if (idx) {
+			ndr_print_uint32(ndr, idx, data[i]);
+			free(idx);
+		}
+	}
+	ndr->depth--;	
+}
+
 _PUBLIC_ void ndr_print_DATA_BLOB(struct ndr_print *ndr, const char *name, DATA_BLOB r)
 {
 	ndr->print(ndr, "%-25s: DATA_BLOB length=%u", name, (unsigned)r.length);
@@ -398,6 +398,23 @@ NTSTATUS ndr_pull_DataWithStack(struct ndr_pull *ndr, ndr_pull_flags_fn_t fn, vo
         return NT_STATUS_OK;
 }
 
+/*
+  skip over a DataWithStack block without decoding it
+*/
+static NTSTATUS ndr_pull_skip_DataWithStack(struct ndr_pull *ndr)
+{
+	uint32_t end, size;
+
+	end = ndr->offset;
+	NDR_CHECK(ndr_pull_uint32(ndr, NDR_SCALARS, &size));
+	if (size < 4)
+		return ndr_pull_error(ndr, NDR_ERR_VALIDATE, "ndr_pull_skip_DataWithStack(%08X): Invalid block size 0x%08X", end, size);
+	NDR_PULL_NEED_BYTES(ndr, size - 4);
+	ndr->offset = end + size;
+
+        return NT_STATUS_OK;
+}
+
 NTSTATUS ndr_push_uint32_flags(struct ndr_push *ndr, int ndr_flags, uint32_t v)
 {
 	if (ndr_flags & NDR_SCALARS)
@@ -425,10 +442,14 @@ void copy_bits(const uint8_t *src, uint32_t bsrc, uint8_t *dst, uint32_t bdst, u
 	*dst |= ((*src >> bsrc) & mask) << bdst;
 }
 
+NTSTATUS ndr_pull_WbemInstance_all(const struct WbemClassObject *r, const uint8_t *selected);
+
 #define IS_CIMTYPE_PTR(t) (((t) & CIM_FLAG_ARRAY) || ((t) == CIM_STRING) || ((t) == CIM_DATETIME) || ((t) == CIM_REFERENCE))
 NTSTATUS ndr_push_WbemInstance_priv(struct ndr_push *ndr, int ndr_flags, const struct WbemClassObject *r)
 {
 	int i;
+
+	NDR_CHECK(ndr_pull_WbemInstance_all(r, NULL));
 	if (ndr_flags & NDR_SCALARS) {
 		uint32_t ofs, vofs;
 
@@ -497,6 +518,18 @@ DEBUG(1,("ndr_pull_WbemInstance_priv: There is no class for given instance\n"));
 
 		ofs = ndr->offset;
 		NDR_PULL_NEED_BYTES(ndr, r->obj_class->data_size);
+		if (r->instance->lazy_data) {
+			/* only remember where the values are, see ndr_pull_WbemInstance_property() */
+			r->instance->lazy_ofs = ofs;
+			r->instance->default_flags = NULL;
+			r->instance->data = NULL;
+			NDR_PULL_ALLOC_N(ndr, r->instance->lazy_decoded, (r->obj_class->__PROPERTY_COUNT + 7) >> 3);
+			memset(r->instance->lazy_decoded, 0, (r->obj_class->__PROPERTY_COUNT + 7) >> 3);
+			ndr->offset = ofs + r->obj_class->data_size;
+			NDR_CHECK(ndr_pull_uint32(ndr, NDR_SCALARS, &r->instance->u2_4));
+			NDR_CHECK(ndr_pull_uint8(ndr, NDR_SCALARS, &r->instance->u3_1));
+			goto buffers;
+		}
                 NDR_PULL_ALLOC_N(ndr, r->instance->default_flags, r->obj_class->__PROPERTY_COUNT);
 		for (i = 0; i < r->obj_class->__PROPERTY_COUNT; ++i) {
 			r->instance->default_flags[i] = 0;
@@ -516,6 +549,7 @@ DEBUG(1,("ndr_pull_WbemInstance_priv: There is no class for given instance\n"));
 		NDR_CHECK(ndr_pull_uint32(ndr, NDR_SCALARS, &r->instance->u2_4));
 		NDR_CHECK(ndr_pull_uint8(ndr, NDR_SCALARS, &r->instance->u3_1));
 	}
+buffers:
 	if (ndr_flags & NDR_BUFFERS) {
                 if (r->instance->__CLASS) {
                         struct ndr_pull_save _relative_save;
@@ -524,6 +558,11 @@ DEBUG(1,("ndr_pull_WbemInstance_priv: There is no class for given instance\n"));
                         NDR_CHECK(ndr_pull_CIMSTRING(ndr, NDR_SCALARS, &r->instance->__CLASS));
                         ndr_pull_restore(ndr, &_relative_save);
                 }
+		if (r->instance->lazy_data) {
+			r->instance->lazy_base = ndr->relative_base_offset;
+			r->instance->lazy_size = ndr->data_size;
+			return NT_STATUS_OK;
+		}
                 for (i = 0; i < r->obj_class->__PROPERTY_COUNT; ++i) {
 			NDR_CHECK(ndr_pull_CIMVAR(ndr, NDR_BUFFERS, &r->instance->data[i]));
 		}
@@ -531,10 +570,93 @@ DEBUG(1,("ndr_pull_WbemInstance_priv: There is no class for given instance\n"));
 	return NT_STATUS_OK;
 }
 
+/*
+  decode a single property of a lazily pulled instance
+
+  An instance pulled with instance->lazy_data preset to the buffer being
+  parsed keeps only a talloc reference to that buffer and the offsets of its
+  value table. Properties are decoded into instance->data[] on first use.
+*/
+NTSTATUS ndr_pull_WbemInstance_property(const struct WbemClassObject *r, uint32_t i)
+{
+	struct WbemInstance *inst = r->instance;
+	const struct WbemClass *cls = r->obj_class;
+	struct ndr_pull *ndr;
+	NTSTATUS status;
+
+	if (!inst || !inst->lazy_data) return NT_STATUS_OK;
+	if (i >= cls->__PROPERTY_COUNT) return NT_STATUS_INVALID_PARAMETER;
+	if (inst->lazy_decoded[i >> 3] & (1 << (i & 7))) return NT_STATUS_OK;
+
+	if (!inst->data) {
+		inst->default_flags = talloc_zero_array(inst, uint8_t, cls->__PROPERTY_COUNT);
+		inst->data = talloc_zero_array(inst, union CIMVAR, cls->__PROPERTY_COUNT);
+		if (!inst->default_flags || !inst->data) return NT_STATUS_NO_MEMORY;
+	}
+	copy_bits(inst->lazy_data + inst->lazy_ofs, 2*cls->properties[i].desc->nr, &inst->default_flags[i], 0, 2);
+
+	ndr = talloc_zero(inst, struct ndr_pull);
+	if (!ndr) return NT_STATUS_NO_MEMORY;
+	ndr->data = inst->lazy_data;
+	ndr->data_size = inst->lazy_size;
+	ndr->relative_base_offset = inst->lazy_base;
+	ndr->current_mem_ctx = inst;
+	ndr_set_flags(&ndr->flags, LIBNDR_FLAG_NOALIGN);
+	ndr->offset = inst->lazy_ofs + ((cls->__PROPERTY_COUNT + 3) >> 2) + cls->properties[i].desc->offset;
+
+	status = ndr_pull_set_switch_value(ndr, &inst->data[i], cls->properties[i].desc->cimtype & CIM_TYPEMASK);
+	if (NT_STATUS_IS_OK(status))
+		status = ndr_pull_CIMVAR(ndr, NDR_SCALARS, &inst->data[i]);
+	if (NT_STATUS_IS_OK(status))
+		status = ndr_pull_CIMVAR(ndr, NDR_BUFFERS, &inst->data[i]);
+	talloc_free(ndr);
+	if (NT_STATUS_IS_OK(status))
+		inst->lazy_decoded[i >> 3] |= 1 << (i & 7);
+	return status;
+}
+
+/*
+  decode whatever is left of a lazily pulled instance and release its
+  reference to the received buffer
+
+  If 'selected' is given, only properties whose bit is set in it are
+  decoded; the others are left empty.
+*/
+NTSTATUS ndr_pull_WbemInstance_all(const struct WbemClassObject *r, const uint8_t *selected)
+{
+	struct WbemInstance *inst = r->instance;
+	uint32_t i;
+
+	if (!inst || !inst->lazy_data) return NT_STATUS_OK;
+	if (!inst->data) {
+		inst->default_flags = talloc_zero_array(inst, uint8_t, r->obj_class->__PROPERTY_COUNT);
+		inst->data = talloc_zero_array(inst, union CIMVAR, r->obj_class->__PROPERTY_COUNT);
+		if (!inst->default_flags || !inst->data) return NT_STATUS_NO_MEMORY;
+	}
+	for (i = 0; i < r->obj_class->__PROPERTY_COUNT; ++i) {
+		if (selected && !(selected[i >> 3] & (1 << (i & 7)))) {
+			if (!(inst->lazy_decoded[i >> 3] & (1 << (i & 7))))
+				inst->default_flags[i] = DEFAULT_FLAG_EMPTY;
+			continue;
+		}
+		NDR_CHECK(ndr_pull_WbemInstance_property(r, i));
+	}
+	talloc_unlink(inst, inst->lazy_data);
+	inst->lazy_data = NULL;
+	talloc_free(inst->lazy_decoded);
+	inst->lazy_decoded = NULL;
+	return NT_STATUS_OK;
+}
+
 void ndr_print_WbemInstance_priv(struct ndr_print *ndr, const char *name, const struct WbemClassObject *r)
 {
 	int i;
 
+	if (!NT_STATUS_IS_OK(ndr_pull_WbemInstance_all(r, NULL))) {
+		ndr->print(ndr, "%s: <undecodable>", name);
+		return;
+	}
+
 	ndr_print_array_uint8(ndr, "default_flags", r->instance->default_flags, r->obj_class->__PROPERTY_COUNT);
 
 	ndr->print(ndr, "%s: ARRAY(%d)", "data", r->obj_class->__PROPERTY_COUNT);
@@ -595,10 +717,15 @@ NTSTATUS ndr_pull_WbemClassObject(struct ndr_pull *ndr, int ndr_flags, struct Wb
 	} else
 		r->sup_class = NULL;
 	if (r->flags & (WCF_CLASS | WCF_INSTANCE)) {
-		r->obj_class = talloc_zero(r, struct WbemClass);
-		NDR_PULL_SET_MEM_CTX(ndr, r->obj_class, 0);
-		NDR_CHECK(ndr_pull_DataWithStack(ndr, (ndr_pull_flags_fn_t)ndr_pull_WbemClass, r->obj_class));
-		NDR_PULL_SET_MEM_CTX(ndr, tc, 0);
+		if (r->obj_class) {
+			/* the caller already holds this class definition (see WBEMDATA_Parse) */
+			NDR_CHECK(ndr_pull_skip_DataWithStack(ndr));
+		} else {
+			r->obj_class = talloc_zero(r, struct WbemClass);
+			NDR_PULL_SET_MEM_CTX(ndr, r->obj_class, 0);
+			NDR_CHECK(ndr_pull_DataWithStack(ndr, (ndr_pull_flags_fn_t)ndr_pull_WbemClass, r->obj_class));
+			NDR_PULL_SET_MEM_CTX(ndr, tc, 0);
+		}
 	}
 	if (r->flags & WCF_DECORATIONS) {
 		r->obj_methods = talloc_zero(r, struct WbemMethods);
@@ -607,12 +734,16 @@ NTSTATUS ndr_pull_WbemClassObject(struct ndr_pull *ndr, int ndr_flags, struct Wb
 		NDR_PULL_SET_MEM_CTX(ndr, tc, 0);
 	}
 	if (r->flags & WCF_INSTANCE) {
-		r->instance = talloc_zero(r, struct WbemInstance);
+		/* a preset instance asks for lazy decoding */
+		if (!r->instance)
+			r->instance = talloc_zero(r, struct WbemInstance);
 		NDR_PULL_SET_MEM_CTX(ndr, r->instance, 0);
 		NDR_CHECK(ndr_pull_DataWithStack(ndr, (ndr_pull_flags_fn_t)ndr_pull_WbemInstance_priv, r));
 		NDR_PULL_SET_MEM_CTX(ndr, tc, 0);
-	} else
+	} else {
+		talloc_free(r->instance);
 		r->instance = NULL;
+	}
         return NT_STATUS_OK;
 }
 
@@ -628,12 +759,16 @@ NTSTATUS ndr_pull_WbemClassObject_Object(struct ndr_pull *ndr, int ndr_flags, st
                 NDR_CHECK(ndr_pull_CIMSTRING(ndr, NDR_SCALARS, &r->__NAMESPACE));
 	}
 	if (r->flags & WCF_INSTANCE) {
-		r->instance = talloc_zero(r, struct WbemInstance);
+		/* a preset instance asks for lazy decoding */
+		if (!r->instance)
+			r->instance = talloc_zero(r, struct WbemInstance);
 		NDR_PULL_SET_MEM_CTX(ndr, r->instance, 0);
 		NDR_CHECK(ndr_pull_DataWithStack(ndr, (ndr_pull_flags_fn_t)ndr_pull_WbemInstance_priv, r));
 		NDR_PULL_SET_MEM_CTX(ndr, tc, 0);
-	} else
+	} else {
+		talloc_free(r->instance);
 		r->instance = NULL;
+	}
         return NT_STATUS_OK;
 }
 
@@ -101,6 +101,8 @@ static struct dcerpc_connection *dcerpc_connection_init(TALLOC_CTX *mem_ctx,
 	c->srv_max_xmit_frag = 0;
 	c->srv_max_recv_frag = 0;
 	c->pending = NULL;
+	c->num_pending = 0;
+	c->max_in_flight = 1;
 
 	talloc_set_destructor(c, dcerpc_connection_destructor);
 
@@ -139,6 +141,73 @@ struct dcerpc_pipe *dcerpc_pipe_init(TALLOC_CTX *mem_ctx, struct event_context *
 }
 
 
+/*
+  put a request on the pending list, where replies are matched to it
+  by call_id
+*/
+static void dcerpc_pending_add(struct dcerpc_connection *c, struct rpc_request *req)
+{
+	struct rpc_request **bucket = &c->call_hash[req->call_id % DCERPC_CALL_HASH_SIZE];
+
+	DLIST_ADD_END(c->pending, req, struct rpc_request *);
+	req->hash_next = *bucket;
+	*bucket = req;
+	req->in_pending = True;
+	c->num_pending++;
+}
+
+/*
+  take a request off the pending list, a no-op if it is not on it
+*/
+static void dcerpc_pending_remove(struct dcerpc_connection *c, struct rpc_request *req)
+{
+	struct rpc_request **bucket;
+
+	if (!req->in_pending) {
+		return;
+	}
+
+	for (bucket = &c->call_hash[req->call_id % DCERPC_CALL_HASH_SIZE];
+	     *bucket != NULL; bucket = &(*bucket)->hash_next) {
+		if (*bucket == req) {
+			*bucket = req->hash_next;
+			break;
+		}
+	}
+	req->hash_next = NULL;
+	req->in_pending = False;
+	DLIST_REMOVE(c->pending, req);
+	c->num_pending--;
+}
+
+/*
+  find the pending request a reply belongs to
+*/
+static struct rpc_request *dcerpc_pending_find(struct dcerpc_connection *c, uint32_t call_id)
+{
+	struct rpc_request *req;
+
+	for (req = c->call_hash[call_id % DCERPC_CALL_HASH_SIZE]; req; req = req->hash_next) {
+		if (req->call_id == call_id) {
+			return req;
+		}
+	}
+	return NULL;
+}
+
+/*
+  set how many sync requests may be waiting for a reply on the
+  connection at once. A window of 1, the default, sends each request
+  only after the previous one has been answered.
+*/
+void dcerpc_set_call_window(struct dcerpc_connection *c, uint32_t window)
+{
+	c->max_in_flight = MAX(window, 1);
+	if (c->request_queue != NULL) {
+		dcerpc_ship_next_request(c);
+	}
+}
+
 /*
    choose the next call id to use
 */
@@ -563,6 +632,8 @@ static void dcerpc_connection_dead(struct dcerpc_connection *conn, NTSTATUS stat
 	void *reference_keeper = talloc_named_const(NULL, 1, "CONN_REFERENCE_KEEPER");
 	talloc_reference(reference_keeper, conn);
 
+	conn->dead = True;
+
 	/* make sure requests don't get destroyed too soon */
 	struct rpc_request *tmpreq;
 	for(tmpreq = conn->pending; tmpreq; tmpreq = tmpreq->next) {
@@ -579,7 +650,7 @@ static void dcerpc_connection_dead(struct dcerpc_connection *conn, NTSTATUS stat
 
 		req->state = RPC_REQUEST_DONE;
 		req->status = status;
-		DLIST_REMOVE(conn->pending, req);
+		dcerpc_pending_remove(conn, req);
 		if (req->async.callback) {
 			req->async.callback(req);
 		}
@@ -597,7 +668,8 @@ static void dcerpc_connection_dead(struct dcerpc_connection *conn, NTSTATUS stat
   packets we need to handle
 */
 static void dcerpc_request_recv_data(struct dcerpc_connection *c,
-				     DATA_BLOB *raw_packet, struct ncacn_packet *pkt);
+				     DATA_BLOB *raw_packet, TALLOC_CTX *mem_ctx,
+				     struct ncacn_packet *pkt);
 
 /*
   receive a dcerpc reply from the transport. Here we work out what
@@ -609,6 +681,7 @@ static void dcerpc_recv_data(struct dcerpc_connection *conn, DATA_BLOB *blob, NT
 	DEBUG_FN_ENTER;
 
         struct ncacn_packet pkt;
+	TALLOC_CTX *mem_ctx;
 
 	if (NT_STATUS_IS_OK(status) && blob->length == 0) {
 		status = NT_STATUS_UNEXPECTED_NETWORK_ERROR;
@@ -617,23 +690,105 @@ static void dcerpc_recv_data(struct dcerpc_connection *conn, DATA_BLOB *blob, NT
 	/* the transport may be telling us of a severe error, such as
 	   a dropped socket */
 	if (!NT_STATUS_IS_OK(status)) {
-		data_blob_free(blob);
+		if (!conn->transport.recv_borrowed) {
+			data_blob_free(blob);
+		}
 		dcerpc_connection_dead(conn, status);
 		return;
 	}
 
+	/* a packet the transport only lends us is parsed into memory of
+	   our own, otherwise the packet data carries the parsed form */
+	if (conn->transport.recv_borrowed) {
+		mem_ctx = talloc_new(conn);
+		if (mem_ctx == NULL) {
+			dcerpc_connection_dead(conn, NT_STATUS_NO_MEMORY);
+			return;
+		}
+	} else {
+		mem_ctx = blob->data;
+	}
+
 	/* parse the basic packet to work out what type of response this is */
-	status = ncacn_pull(conn, blob, blob->data, &pkt);
+	status = ncacn_pull(conn, blob, mem_ctx, &pkt);
 	if (!NT_STATUS_IS_OK(status)) {
-		data_blob_free(blob);
+		talloc_free(mem_ctx);
 		dcerpc_connection_dead(conn, status);
+		return;
 	}
 
-	dcerpc_request_recv_data(conn, blob, &pkt);
+	dcerpc_request_recv_data(conn, blob, mem_ctx, &pkt);
 	DEBUG_FN_EXIT;
 }
 
 
+/*
+  find a presentation context already accepted on a connection
+*/
+static struct dcerpc_presentation_context *dcerpc_context_find(struct dcerpc_connection *c,
+							       const struct dcerpc_syntax_id *syntax,
+							       const struct dcerpc_syntax_id *transfer_syntax)
+{
+	struct dcerpc_presentation_context *pc;
+
+	for (pc = c->contexts; pc; pc = pc->next) {
+		if (pc->syntax.if_version == syntax->if_version &&
+		    pc->transfer_syntax.if_version == transfer_syntax->if_version &&
+		    GUID_equal(&pc->syntax.uuid, &syntax->uuid) &&
+		    GUID_equal(&pc->transfer_syntax.uuid, &transfer_syntax->uuid)) {
+			return pc;
+		}
+	}
+	return NULL;
+}
+
+/*
+  remember a presentation context the server has accepted, so later
+  switches to the same interface need no alter_context round trip
+*/
+static void dcerpc_context_remember(struct dcerpc_connection *c,
+				    uint32_t context_id,
+				    const struct dcerpc_syntax_id *syntax,
+				    const struct dcerpc_syntax_id *transfer_syntax)
+{
+	struct dcerpc_presentation_context *pc;
+
+	pc = dcerpc_context_find(c, syntax, transfer_syntax);
+	if (pc == NULL) {
+		pc = talloc(c, struct dcerpc_presentation_context);
+		if (pc == NULL) {
+			return;
+		}
+		DLIST_ADD(c->contexts, pc);
+	}
+
+	pc->context_id = context_id;
+	pc->syntax = *syntax;
+	pc->transfer_syntax = *transfer_syntax;
+}
+
+/*
+  point a pipe at a presentation context already accepted on its
+  connection. Returns False if the context still has to be negotiated
+  with an alter_context request.
+*/
+BOOL dcerpc_select_context(struct dcerpc_pipe *p,
+			   const struct dcerpc_syntax_id *syntax,
+			   const struct dcerpc_syntax_id *transfer_syntax)
+{
+	struct dcerpc_presentation_context *pc;
+
+	pc = dcerpc_context_find(p->conn, syntax, transfer_syntax);
+	if (pc == NULL) {
+		return False;
+	}
+
+	p->context_id = pc->context_id;
+	p->syntax = pc->syntax;
+	p->transfer_syntax = pc->transfer_syntax;
+	return True;
+}
+
 /*
   Receive a bind reply from the transport
 */
@@ -677,6 +832,9 @@ static void dcerpc_bind_recv_handler(struct rpc_request *req,
 		if (!composite_is_ok(c)) return;
 	}
 
+	dcerpc_context_remember(conn, req->p->context_id, &req->p->syntax,
+				&req->p->transfer_syntax);
+
 	composite_done(c);
 	DEBUG_FN_EXIT;
 }
@@ -697,7 +855,10 @@ static void dcerpc_timeout_handler(struct event_context *ev, struct timed_event
 
 	req->status = NT_STATUS_IO_TIMEOUT;
 	req->state = RPC_REQUEST_DONE;
-	DLIST_REMOVE(req->p->conn->pending, req);
+	dcerpc_pending_remove(req->p->conn, req);
+	if (req->p->conn->request_queue != NULL) {
+		dcerpc_ship_next_request(req->p->conn);
+	}
 	if (req->async.callback) {
 		req->async.callback(req);
 	}
@@ -733,6 +894,9 @@ struct composite_context *dcerpc_bind_send(struct dcerpc_pipe *p,
 
 	pkt.ptype = DCERPC_PKT_BIND;
 	pkt.pfc_flags = DCERPC_PFC_FLAG_FIRST | DCERPC_PFC_FLAG_LAST;
+	if (p->conn->flags & DCERPC_CONC_MPX) {
+		pkt.pfc_flags |= DCERPC_PFC_FLAG_CONC_MPX;
+	}
 	pkt.call_id = p->conn->call_id;
 	pkt.auth_length = 0;
 
@@ -768,7 +932,7 @@ struct composite_context *dcerpc_bind_send(struct dcerpc_pipe *p,
 	req->async.callback = dcerpc_composite_fail;
 	req->p = p;
 	req->recv_handler = dcerpc_bind_recv_handler;
-	DLIST_ADD_END(p->conn->pending, req, struct rpc_request *);
+	dcerpc_pending_add(p->conn, req);
 
 	c->status = p->conn->transport.send_request(p->conn, &blob,
 						    True);
@@ -833,7 +997,8 @@ NTSTATUS dcerpc_auth3(struct dcerpc_connection *c,
   This function frees the data
 */
 static void dcerpc_request_recv_data(struct dcerpc_connection *c,
-				     DATA_BLOB *raw_packet, struct ncacn_packet *pkt)
+				     DATA_BLOB *raw_packet, TALLOC_CTX *mem_ctx,
+				     struct ncacn_packet *pkt)
 {
 	DEBUG_FN_ENTER;
 
@@ -851,13 +1016,11 @@ static void dcerpc_request_recv_data(struct dcerpc_connection *c,
 	*/
 	if (c->security_state.auth_info && c->security_state.generic_state &&
 	    pkt->ptype == DCERPC_PKT_RESPONSE) {
-		status = ncacn_pull_request_auth(c, raw_packet->data, raw_packet, pkt);
+		status = ncacn_pull_request_auth(c, mem_ctx, raw_packet, pkt);
 	}
 
 	/* find the matching request */
-	for (req=c->pending;req;req=req->next) {
-		if (pkt->call_id == req->call_id) break;
-	}
+	req = dcerpc_pending_find(c, pkt->call_id);
 
 #if 0
 	/* useful for testing certain vendors RPC servers */
@@ -869,15 +1032,18 @@ static void dcerpc_request_recv_data(struct dcerpc_connection *c,
 
 	if (req == NULL) {
 		DEBUG(2,("dcerpc_request: unmatched call_id %u in response packet\n", pkt->call_id));
-		data_blob_free(raw_packet);
+		talloc_free(mem_ctx);
 		return;
 	}
 
-	talloc_steal(req, raw_packet->data);
+	talloc_steal(req, mem_ctx);
 
 	if (req->recv_handler != NULL) {
 		req->state = RPC_REQUEST_DONE;
-		DLIST_REMOVE(c->pending, req);
+		dcerpc_pending_remove(c, req);
+		if (c->request_queue != NULL) {
+			dcerpc_ship_next_request(c);
+		}
 		req->recv_handler(req, raw_packet, pkt);
 		return;
 	}
@@ -914,15 +1080,31 @@ static void dcerpc_request_recv_data(struct dcerpc_connection *c,
 
 	length = pkt->u.response.stub_and_verifier.length;
 
-	if (length > 0) {
+	if (length > 0 && req->payload.length + length > req->payload_size) {
+		/* size the buffer from the server's alloc_hint, which
+		   covers this and all following fragments, and grow it
+		   geometrically should the hint be too small, so a reply
+		   of many fragments is not copied again for every one */
+		uint32_t size = req->payload.length +
+			MIN(pkt->u.response.alloc_hint, DCERPC_MAX_ALLOC_HINT);
+		if (size < req->payload_size * 2) {
+			size = req->payload_size * 2;
+		}
+		if (size < req->payload.length + length) {
+			size = req->payload.length + length;
+		}
 		req->payload.data = talloc_realloc(req,
 						   req->payload.data,
 						   uint8_t,
-						   req->payload.length + length);
+						   size);
 		if (!req->payload.data) {
 			req->status = NT_STATUS_NO_MEMORY;
 			goto req_done;
 		}
+		req->payload_size = size;
+	}
+
+	if (length > 0) {
 		memcpy(req->payload.data+req->payload.length,
 		       pkt->u.response.stub_and_verifier.data, length);
 		req->payload.length += length;
@@ -943,7 +1125,7 @@ static void dcerpc_request_recv_data(struct dcerpc_connection *c,
 req_done:
 	/* we've got the full payload */
 	req->state = RPC_REQUEST_DONE;
-	DLIST_REMOVE(c->pending, req);
+	dcerpc_pending_remove(c, req);
 
 	if (c->request_queue != NULL) {
 		/* We have to look at shipping further requests before calling
@@ -963,7 +1145,11 @@ static int dcerpc_req_destructor(struct rpc_request *req)
 {
 	DEBUG_FN_ENTER;
 
-        DLIST_REMOVE(req->p->conn->pending, req);
+	if (req->in_pending) {
+		dcerpc_pending_remove(req->p->conn, req);
+	} else if (req->state == RPC_REQUEST_PENDING) {
+		DLIST_REMOVE(req->p->conn->request_queue, req);
+	}
 	return 0;
 }
 
@@ -999,12 +1185,15 @@ static struct rpc_request *dcerpc_request_send(struct dcerpc_pipe *p,
 	req->status = NT_STATUS_OK;
 	req->state = RPC_REQUEST_PENDING;
 	req->payload = data_blob(NULL, 0);
+	req->payload_size = 0;
 	req->flags = 0;
 	req->fault_code = 0;
 	req->async_call = async;
 	req->async.callback = NULL;
 	req->async.private = NULL;
 	req->recv_handler = NULL;
+	req->hash_next = NULL;
+	req->in_pending = False;
 
 	if (object != NULL) {
 		req->object = talloc_memdup(req, object, sizeof(*object));
@@ -1037,36 +1226,78 @@ static struct rpc_request *dcerpc_request_send(struct dcerpc_pipe *p,
 	return req;
 }
 
+/*
+  hand one request fragment to the transport. Without signing or
+  sealing only the header is pushed, and the stub slice goes out
+  straight from the request buffer in the same gather send. A signed
+  or sealed fragment has to be flat to be signed, but it is handed
+  over to the transport rather than copied once more.
+*/
+static NTSTATUS dcerpc_send_request_fragment(struct rpc_request *req,
+					     struct ncacn_packet *pkt,
+					     BOOL last_frag)
+{
+	struct dcerpc_connection *c = req->p->conn;
+	DATA_BLOB blob, iov[2];
+	TALLOC_CTX *frag;
+	NTSTATUS status;
+
+	if (c->transport.send_request_iov == NULL) {
+		status = ncacn_push_request_sign(c, &blob, req, pkt);
+		NT_STATUS_NOT_OK_RETURN(status);
+		return c->transport.send_request(c, &blob, last_frag);
+	}
+
+	frag = talloc_new(req);
+	NT_STATUS_HAVE_NO_MEMORY(frag);
+
+	if (c->security_state.auth_info != NULL) {
+		status = ncacn_push_request_sign(c, &blob, frag, pkt);
+		if (!NT_STATUS_IS_OK(status)) {
+			talloc_free(frag);
+			return status;
+		}
+		return c->transport.send_request_iov(c, &blob, 1, frag, last_frag);
+	}
+
+	iov[1] = pkt->u.request.stub_and_verifier;
+	pkt->u.request.stub_and_verifier = data_blob(NULL, 0);
+	status = ncacn_push_auth(&iov[0], frag, pkt, NULL);
+	pkt->u.request.stub_and_verifier = iov[1];
+	if (!NT_STATUS_IS_OK(status)) {
+		talloc_free(frag);
+		return status;
+	}
+	dcerpc_set_frag_length(&iov[0], iov[0].length + iov[1].length);
+
+	/* the stub has to stay around until the fragment is on the wire,
+	   even if the request is freed before that */
+	if (iov[1].length != 0 &&
+	    talloc_reference(frag, req->request_data.data) == NULL) {
+		talloc_free(frag);
+		return NT_STATUS_NO_MEMORY;
+	}
+
+	return c->transport.send_request_iov(c, iov, 2, frag, last_frag);
+}
+
 /*
   Send a request using the transport
 */
 
-static void dcerpc_ship_next_request(struct dcerpc_connection *c)
+static void dcerpc_ship_request(struct dcerpc_connection *c, struct rpc_request *req)
 {
-	DEBUG_FN_ENTER;
-
-        struct rpc_request *req;
 	struct dcerpc_pipe *p;
 	DATA_BLOB *stub_data;
 	struct ncacn_packet pkt;
-	DATA_BLOB blob;
 	uint32_t remaining, chunk_size;
 	BOOL first_packet = True;
 
-	req = c->request_queue;
-	if (req == NULL) {
-		return;
-	}
-
 	p = req->p;
 	stub_data = &req->request_data;
 
-	if (!req->async_call && (c->pending != NULL)) {
-		return;
-	}
-
 	DLIST_REMOVE(c->request_queue, req);
-	DLIST_ADD(c->pending, req);
+	dcerpc_pending_add(c, req);
 
 	init_ncacn_hdr(p->conn, &pkt);
 
@@ -1110,21 +1341,33 @@ static void dcerpc_ship_next_request(struct dcerpc_connection *c)
 			(stub_data->length - remaining);
 		pkt.u.request.stub_and_verifier.length = chunk;
 
-		req->status = ncacn_push_request_sign(p->conn, &blob, req, &pkt);
+		req->status = dcerpc_send_request_fragment(req, &pkt, last_frag);
 		if (!NT_STATUS_IS_OK(req->status)) {
 			req->state = RPC_REQUEST_DONE;
-			DLIST_REMOVE(p->conn->pending, req);
+			dcerpc_pending_remove(p->conn, req);
 			return;
 		}
 
-		req->status = p->conn->transport.send_request(p->conn, &blob, last_frag);
-		if (!NT_STATUS_IS_OK(req->status)) {
-			req->state = RPC_REQUEST_DONE;
-			DLIST_REMOVE(p->conn->pending, req);
+		remaining -= chunk;
+	}
+}
+
+/*
+  ship queued requests while the call window has room. Requests go
+  out in the order they were queued, each one whole, so fragments of
+  different calls are never interleaved on the wire
+*/
+static void dcerpc_ship_next_request(struct dcerpc_connection *c)
+{
+	DEBUG_FN_ENTER;
+
+	struct rpc_request *req;
+
+	while ((req = c->request_queue) != NULL) {
+		if (!req->async_call && c->num_pending >= c->max_in_flight) {
 			return;
 		}
-
-		remaining -= chunk;
+		dcerpc_ship_request(c, req);
 	}
 }
 
@@ -1361,6 +1604,15 @@ static NTSTATUS dcerpc_ndr_validate_out(struct dcerpc_connection *c,
 }
 
 
+/*
+  the marshalling of an ndr request is carved out of a talloc pool of
+  this size, falling back to malloc once it is used up. The pool goes
+  with the request. The reply is unmarshalled into the caller's mem_ctx
+  instead, as callers often steal parts of it to longer lived contexts,
+  which would keep the whole pool alive.
+*/
+#define DCERPC_NDR_POOL_SIZE 4096
+
 /*
  send a rpc request given a dcerpc_call structure
  */
@@ -1378,12 +1630,19 @@ struct rpc_request *dcerpc_ndr_request_send(struct dcerpc_pipe *p,
 	NTSTATUS status;
 	DATA_BLOB request;
 	struct rpc_request *req;
+	TALLOC_CTX *pool;
 
 	call = &table->calls[opnum];
 
+	pool = talloc_pool(mem_ctx, DCERPC_NDR_POOL_SIZE);
+	if (!pool) {
+		return NULL;
+	}
+
 	/* setup for a ndr_push_* call */
-	push = ndr_push_init_ctx(mem_ctx);
+	push = ndr_push_init_ctx(pool);
 	if (!push) {
+		talloc_free(pool);
 		return NULL;
 	}
 
@@ -1396,7 +1655,7 @@ struct rpc_request *dcerpc_ndr_request_send(struct dcerpc_pipe *p,
 	if (!NT_STATUS_IS_OK(status)) {
 		DEBUG(2,("Unable to ndr_push structure in dcerpc_ndr_request_send - %s\n",
 			 nt_errstr(status)));
-		talloc_free(push);
+		talloc_free(pool);
 		return NULL;
 	}
 
@@ -1409,7 +1668,7 @@ struct rpc_request *dcerpc_ndr_request_send(struct dcerpc_pipe *p,
 		if (!NT_STATUS_IS_OK(status)) {
 			DEBUG(2,("Validation failed in dcerpc_ndr_request_send - %s\n",
 				 nt_errstr(status)));
-			talloc_free(push);
+			talloc_free(pool);
 			return NULL;
 		}
 	}
@@ -1421,13 +1680,18 @@ struct rpc_request *dcerpc_ndr_request_send(struct dcerpc_pipe *p,
 	req = dcerpc_request_send(p, object, opnum, table->calls[opnum].async,
 				  &request);
 
-	if (req != NULL) {
-		req->ndr.table = table;
-		req->ndr.opnum = opnum;
-		req->ndr.struct_ptr = r;
-		req->ndr.mem_ctx = mem_ctx;
+	if (req == NULL) {
+		talloc_free(pool);
+		return NULL;
 	}
 
+	req->ndr.table = table;
+	req->ndr.opnum = opnum;
+	req->ndr.struct_ptr = r;
+	req->ndr.mem_ctx = mem_ctx;
+
+	/* the request blob is referenced by req and moves to it */
+	talloc_steal(req, pool);
 	talloc_free(push);
 
 	return req;
@@ -1580,9 +1844,11 @@ static void dcerpc_alter_recv_handler(struct rpc_request *req,
 {
 	struct composite_context *c;
 	struct dcerpc_pipe *recv_pipe;
+	struct dcerpc_presentation_context *proposed;
 
 	c = talloc_get_type(req->async.private, struct composite_context);
-	recv_pipe = talloc_get_type(c->private_data, struct dcerpc_pipe);
+	proposed = talloc_get_type(c->private_data, struct dcerpc_presentation_context);
+	recv_pipe = req->p;
 
 	if (pkt->ptype == DCERPC_PKT_ALTER_RESP &&
 	    pkt->u.alter_resp.num_results == 1 &&
@@ -1610,6 +1876,9 @@ static void dcerpc_alter_recv_handler(struct rpc_request *req,
 		if (!composite_is_ok(c)) return;
 	}
 
+	dcerpc_context_remember(recv_pipe->conn, proposed->context_id,
+				&proposed->syntax, &proposed->transfer_syntax);
+
 	composite_done(c);
 }
 
@@ -1625,15 +1894,30 @@ struct composite_context *dcerpc_alter_context_send(struct dcerpc_pipe *p,
 	struct ncacn_packet pkt;
 	DATA_BLOB blob;
 	struct rpc_request *req;
+	struct dcerpc_presentation_context *proposed;
 
 	c = composite_create(mem_ctx, p->conn->event_ctx);
 	if (c == NULL) return NULL;
 
-	c->private_data = p;
+	/* a context negotiated earlier on this connection is just switched to */
+	if (dcerpc_select_context(p, syntax, transfer_syntax)) {
+		composite_done(c);
+		return c;
+	}
 
 	p->syntax = *syntax;
 	p->transfer_syntax = *transfer_syntax;
 
+	/* context ids belong to the connection, not to the pipe */
+	p->context_id = ++p->conn->next_context_id;
+
+	proposed = talloc(c, struct dcerpc_presentation_context);
+	if (composite_nomem(proposed, c)) return c;
+	proposed->context_id = p->context_id;
+	proposed->syntax = p->syntax;
+	proposed->transfer_syntax = p->transfer_syntax;
+	c->private_data = proposed;
+
 	init_ncacn_hdr(p->conn, &pkt);
 
 	pkt.ptype = DCERPC_PKT_ALTER;
@@ -1647,7 +1931,7 @@ struct composite_context *dcerpc_alter_context_send(struct dcerpc_pipe *p,
 	pkt.u.alter.num_contexts = 1;
 	pkt.u.alter.ctx_list = talloc_array(c, struct dcerpc_ctx_list, 1);
 	if (composite_nomem(pkt.u.alter.ctx_list, c)) return c;
-	pkt.u.alter.ctx_list[0].context_id = ++p->context_id;
+	pkt.u.alter.ctx_list[0].context_id = p->context_id;
 	pkt.u.alter.ctx_list[0].num_transfer_syntaxes = 1;
 	pkt.u.alter.ctx_list[0].abstract_syntax = p->syntax;
 	pkt.u.alter.ctx_list[0].transfer_syntaxes = &p->transfer_syntax;
@@ -1674,7 +1958,7 @@ struct composite_context *dcerpc_alter_context_send(struct dcerpc_pipe *p,
 	req->async.callback = dcerpc_composite_fail;
 	req->p = p;
 	req->recv_handler = dcerpc_alter_recv_handler;
-	DLIST_ADD_END(p->conn->pending, req, struct rpc_request *);
+	dcerpc_pending_add(p->conn, req);
 
 	c->status = p->conn->transport.send_request(p->conn, &blob, True);
 	if (!composite_is_ok(c)) return c;
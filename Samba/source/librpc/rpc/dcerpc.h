@@ -45,6 +45,9 @@ struct dcerpc_security {
 	NTSTATUS (*session_key)(struct dcerpc_connection *, DATA_BLOB *);
 };
 
+/* buckets in the call_id hash of pending requests */
+#define DCERPC_CALL_HASH_SIZE 64
+
 /*
   this holds the information that is not specific to a particular rpc context_id
 */
@@ -70,22 +73,50 @@ struct dcerpc_connection {
 		/* send a request to the server */
 		NTSTATUS (*send_request)(struct dcerpc_connection *, DATA_BLOB *, BOOL trigger_read);
 
+		/* optional, send a request made up of several buffers
+		   without copying them. The transport takes over owner,
+		   which keeps the buffers alive until they are sent */
+		NTSTATUS (*send_request_iov)(struct dcerpc_connection *, DATA_BLOB *blobs,
+					     int count, void *owner, BOOL trigger_read);
+
 		/* send a read request to the server */
 		NTSTATUS (*send_read)(struct dcerpc_connection *);
 
 		/* a callback to the dcerpc code when a full fragment
 		   has been received */
 		void (*recv_data)(struct dcerpc_connection *, DATA_BLOB *, NTSTATUS status);
+
+		/* set when the blobs given to recv_data are only valid
+		   for the duration of the call */
+		BOOL recv_borrowed;
 	} transport;
 
 	/* Requests that have been sent, waiting for a reply */
 	struct rpc_request *pending;
+	uint32_t num_pending;
+
+	/* the pending requests hashed by call_id */
+	struct rpc_request *call_hash[DCERPC_CALL_HASH_SIZE];
+
+	/* how many sync requests may be in flight at once */
+	uint32_t max_in_flight;
 
 	/* Sync requests waiting to be shipped */
 	struct rpc_request *request_queue;
 
 	/* the next context_id to be assigned */
 	uint32_t next_context_id;
+
+	/* presentation contexts the server has accepted so far */
+	struct dcerpc_presentation_context {
+		struct dcerpc_presentation_context *next, *prev;
+		uint32_t context_id;
+		struct dcerpc_syntax_id syntax;
+		struct dcerpc_syntax_id transfer_syntax;
+	} *contexts;
+
+	/* set once the transport has failed, the connection cannot be reused */
+	BOOL dead;
 };
 
 /*
@@ -110,6 +141,12 @@ struct dcerpc_pipe {
 /* default timeout for all rpc requests, in seconds */
 #define DCERPC_REQUEST_TIMEOUT 60
 
+/* largest response alloc_hint trusted when sizing the reassembly buffer */
+#define DCERPC_MAX_ALLOC_HINT (16*1024*1024)
+
+/* sync requests kept in flight on a connection bound with DCERPC_CONC_MPX */
+#define DCERPC_CALL_WINDOW 16
+
 
 /* dcerpc pipe flags */
 #define DCERPC_DEBUG_PRINT_IN          (1<<0)
@@ -151,6 +188,9 @@ struct dcerpc_pipe {
 /* select NTLM auth */
 #define DCERPC_AUTH_NTLM               (1<<18)
 
+/* multiplex several outstanding calls over the connection */
+#define DCERPC_CONC_MPX                (1<<19)
+
 /*
   this is used to find pointers to calls
 */
@@ -219,11 +259,14 @@ enum rpc_request_state {
 */
 struct rpc_request {
 	struct rpc_request *next, *prev;
+	struct rpc_request *hash_next;	/* call_id hash chain while pending */
+	BOOL in_pending;
 	struct dcerpc_pipe *p;
 	NTSTATUS status;
 	uint32_t call_id;
 	enum rpc_request_state state;
 	DATA_BLOB payload;
+	uint32_t payload_size;	/* bytes allocated behind payload.data */
 	uint32_t flags;
 	uint32_t fault_code;
 
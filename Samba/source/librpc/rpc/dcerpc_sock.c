@@ -30,6 +30,9 @@
 #include "librpc/rpc/dcerpc.h"
 #include "libcli/resolve/resolve.h"
 
+/* size of the receive buffer, several fragments are read in one go */
+#define SOCK_RECV_BUFFER_SIZE 0x10000
+
 /* transport private information used by general socket pipe transports */
 struct sock_private {
 	struct fd_event *fde;
@@ -196,6 +199,33 @@ static NTSTATUS sock_send_request(struct dcerpc_connection *p, DATA_BLOB *data,
 	return NT_STATUS_OK;
 }
 
+/*
+   send a pdu from several buffers, without copying them
+*/
+static NTSTATUS sock_send_request_iov(struct dcerpc_connection *p, DATA_BLOB *blobs,
+				      int count, void *owner, BOOL trigger_read)
+{
+	struct sock_private *sock = p->transport.private;
+	NTSTATUS status;
+
+	if (sock->sock == NULL) {
+		talloc_free(owner);
+		return NT_STATUS_CONNECTION_DISCONNECTED;
+	}
+
+	status = packet_sendv(sock->packet, blobs, count, owner);
+	if (!NT_STATUS_IS_OK(status)) {
+		talloc_free(owner);
+		return status;
+	}
+
+	if (trigger_read) {
+		sock_send_read(p);
+	}
+
+	return NT_STATUS_OK;
+}
+
 /*
    shutdown sock pipe connection
 */
@@ -274,6 +304,7 @@ static void continue_socket_connect(struct composite_context *ctx)
 	conn->transport.private         = NULL;
 
 	conn->transport.send_request    = sock_send_request;
+	conn->transport.send_request_iov = sock_send_request_iov;
 	conn->transport.send_read       = sock_send_read;
 	conn->transport.recv_data       = NULL;
 
@@ -306,7 +337,8 @@ static void continue_socket_connect(struct composite_context *ctx)
 	packet_set_fde(sock->packet, sock->fde);
 	packet_set_serialise(sock->packet);
 	packet_recv_disable(sock->packet);
-	packet_set_initial_read(sock->packet, 16);
+	packet_set_recv_buffer(sock->packet, SOCK_RECV_BUFFER_SIZE);
+	conn->transport.recv_borrowed = True;
 
 	/* ensure we don't get SIGPIPE */
 	BlockSignals(True,SIGPIPE);
@@ -147,7 +147,8 @@ static const struct {
 	{"print", DCERPC_DEBUG_PRINT_BOTH},
 	{"padcheck", DCERPC_DEBUG_PAD_CHECK},
 	{"bigendian", DCERPC_PUSH_BIGENDIAN},
-	{"smb2", DCERPC_SMB2}
+	{"smb2", DCERPC_SMB2},
+	{"mpx", DCERPC_CONC_MPX}
 };
 
 const char *epm_floor_string(TALLOC_CTX *mem_ctx, struct epm_floor *epm_floor)
@@ -1192,6 +1193,9 @@ struct composite_context *dcerpc_pipe_auth_send(struct dcerpc_pipe *p,
 
 	conn = s->pipe->conn;
 	conn->flags = binding->flags;
+	if (conn->flags & DCERPC_CONC_MPX) {
+		dcerpc_set_call_window(conn, DCERPC_CALL_WINDOW);
+	}
 	
 	/* remember the binding string for possible secondary connections */
 	conn->binding_string = dcerpc_binding_string(p, binding);
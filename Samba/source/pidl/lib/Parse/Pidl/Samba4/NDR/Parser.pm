@@ -65,8 +65,10 @@ sub has_fast_array($$)
 
 	my $t = getType($nl->{DATA_TYPE});
 
-	# Only uint8 and string have fast array functions at the moment
-	return ($t->{NAME} eq "uint8") or ($t->{NAME} eq "string");
+	# Only uint8, uint16, uint32 and string have fast array functions
+	# at the moment
+	return ($t->{NAME} eq "uint8" or $t->{NAME} eq "uint16" or
+		$t->{NAME} eq "uint32") or ($t->{NAME} eq "string");
 }
 
 sub is_charset_array($$)
@@ -4,7 +4,7 @@
 # Published under the GNU General Public License
 use strict;
 
-use Test::More tests => 8;
+use Test::More tests => 16;
 use FindBin qw($RealBin);
 use lib "$RealBin/../lib";
 use lib "$RealBin";
@@ -36,3 +36,28 @@ test_samba4_ndr(
 		if (r.in.x[i] != i+1) return 3;
 	}
 ');
+
+test_samba4_ndr(
+	'Fixed-Array-uint32',
+	
+	'[public] void Test([in] uint8 y, [in] uint32 x[3]);',
+	
+	'
+	uint8_t data[] = {0xff, 0, 0, 0, 1,0,0,0, 2,0,0,0, 0,0,0,0x80};
+	DATA_BLOB b;
+	struct ndr_pull *ndr;
+	struct Test r;
+
+	b.data = data;
+	b.length = sizeof(data);
+	ndr = ndr_pull_init_blob(&b, mem_ctx);
+
+	if (NT_STATUS_IS_ERR(ndr_pull_Test(ndr, NDR_IN, &r)))
+		return 1;
+
+	if (ndr->offset != 16)
+		return 2;
+	
+	if (r.in.x[0] != 1 || r.in.x[1] != 2 || r.in.x[2] != 0x80000000)
+		return 3;
+');
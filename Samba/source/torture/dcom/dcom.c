@@ -25,6 +25,7 @@
 #include "torture/torture.h"
 #include "librpc/rpc/dcerpc_table.h"
 #include "lib/util/dlinklist.h"
+#include "lib/events/events.h"
 #include "libcli/composite/composite.h"
 #include "lib/com/com.h"
 #include "librpc/gen_ndr/com_dcom.h"
@@ -354,6 +355,208 @@ static BOOL torture_wbem_exec_query_async(struct torture_context *torture)
     return ret;
 }
 
+/*
+ * Test that the class cache keeps definitions from different namespaces
+ * apart: __Win32Provider exists in both root\cimv2 and root\default.
+ */
+static BOOL torture_wbem_class_cache_namespace(struct torture_context *torture)
+{
+    BOOL ret = True;
+    TALLOC_CTX *mem_ctx = talloc_init("torture_wbem_class_cache_namespace");
+    struct com_context *com_ctx = NULL;
+    const char *binding = NULL;
+    const char *nspaces[2] = { "root\\cimv2", "root\\default" };
+    struct WbemClass *cls[2] = { NULL, NULL };
+    struct dcom_object_exporter *ox;
+    const char *host = "";
+    int i;
+
+    com_init_ctx(&com_ctx, NULL);
+    dcom_client_init(com_ctx, cmdline_credentials);
+
+    binding = torture_setting_string(torture, "binding", NULL);
+
+    for (i = 0; i < 2; ++i)
+    {
+        struct IWbemServices *pWS = NULL;
+        struct IEnumWbemClassObject *pEnum = NULL;
+        struct WbemClassObject *apObjects[1];
+        uint32_t uReturned = 0;
+        WERROR result;
+
+        result = WBEM_ConnectServer(com_ctx, binding, nspaces[i], NULL, NULL,
+                NULL, 0, NULL, NULL, &pWS);
+        if (W_ERROR_IS_OK(result))
+            result = IWbemServices_ExecQuery(pWS, mem_ctx, "WQL",
+                    "SELECT * FROM __Win32Provider",
+                    WBEM_FLAG_RETURN_IMMEDIATELY | WBEM_FLAG_ENSURE_LOCATABLE,
+                    NULL, &pEnum);
+        if (W_ERROR_IS_OK(result))
+            result = IEnumWbemClassObject_Reset(pEnum, mem_ctx);
+        if (W_ERROR_IS_OK(result))
+        {
+            IEnumWbemClassObject_SetNamespace(pEnum,
+                    WBEM_ServicesNamespace(pWS));
+            result = IEnumWbemClassObject_SmartNext(pEnum, mem_ctx,
+                    0xFFFFFFFF, 1, apObjects, &uReturned);
+        }
+        if (!W_ERROR_IS_OK(result) || uReturned == 0)
+        {
+            DEBUG(0, ("%s: query failed: %s\n", nspaces[i],
+                    wmi_errstr(result)));
+            ret = False;
+            goto done;
+        }
+
+        ox = object_exporter_by_ip(com_ctx, (struct IUnknown *)pEnum);
+        if (ox && ox->host) host = ox->host;
+        cls[i] = WBEMDATA_ClassCacheLookup(com_ctx, host, nspaces[i],
+                "__Win32Provider");
+        if (cls[i] == NULL || cls[i] != apObjects[0]->obj_class)
+        {
+            DEBUG(0, ("%s: class definition not cached\n", nspaces[i]));
+            ret = False;
+            goto done;
+        }
+    }
+
+    if (cls[0] == cls[1])
+    {
+        DEBUG(0, ("class definition shared between namespaces\n"));
+        ret = False;
+    }
+    if (WBEMDATA_ClassCacheLookup(com_ctx, host, "ROOT\\CIMV2",
+            "__WIN32PROVIDER") != cls[0])
+    {
+        DEBUG(0, ("namespace lookup is case sensitive\n"));
+        ret = False;
+    }
+
+done:
+    talloc_free(mem_ctx);
+    return ret;
+}
+
+/*
+ * Test delivery of results through a sink: the objects of a plain query,
+ * then an event of a notification query. Win32_LocalTime changes every
+ * second, so its modification events keep coming without anything having
+ * to be done on the server.
+ */
+struct wbem_sink_test_state
+{
+    const char *class_name;     /* expected of every object delivered */
+    uint32_t objects;
+    BOOL wrong_class;
+    BOOL finished;
+    WERROR result;
+};
+
+static void wbem_sink_test_indicate(void *private_data, uint32_t count,
+        struct WbemClassObject **objects)
+{
+    struct wbem_sink_test_state *st = private_data;
+    uint32_t i;
+
+    for (i = 0; i < count; ++i)
+    {
+        if (strcasecmp(objects[i]->obj_class->__CLASS, st->class_name) != 0)
+            st->wrong_class = True;
+    }
+    st->objects += count;
+}
+
+static void wbem_sink_test_status(void *private_data, WERROR result)
+{
+    struct wbem_sink_test_state *st = private_data;
+
+    st->finished = True;
+    st->result = result;
+}
+
+/*
+ * Run a query through a sink until it has finished or, if want is not 0, has
+ * delivered want objects, giving up after a minute.
+ */
+static BOOL wbem_sink_test_run(struct com_context *com_ctx,
+        struct IWbemServices *pWS, TALLOC_CTX *mem_ctx, const char *query,
+        BOOL notification, struct wbem_sink_test_state *st, uint32_t want)
+{
+    struct IEnumWbemClassObject_sink *sink;
+    struct timeval start = timeval_current();
+
+    sink = WBEM_ExecQuerySink(pWS, mem_ctx, "WQL", query, notification, 0,
+            wbem_sink_test_indicate, wbem_sink_test_status, st);
+    if (sink == NULL)
+    {
+        DEBUG(0, ("%s: no sink\n", query));
+        return False;
+    }
+    while (!st->finished && (want == 0 || st->objects < want)
+            && timeval_elapsed(&start) < 60)
+    {
+        if (event_loop_once(com_ctx->event_ctx) != 0) break;
+    }
+    talloc_free(sink);
+
+    DEBUG(1, ("%s: %u objects delivered%s, sink %s\n", query, st->objects,
+            st->wrong_class ? " (wrong class)" : "",
+            st->finished ? wmi_errstr(st->result) : "still waiting"));
+    return True;
+}
+
+static BOOL torture_wbem_exec_query_sink(struct torture_context *torture)
+{
+    BOOL ret = True;
+    TALLOC_CTX *mem_ctx = talloc_init("torture_wbem_exec_query_sink");
+    struct com_context *com_ctx = NULL;
+    struct IWbemServices *pWS = NULL;
+    struct wbem_sink_test_state st;
+    const char *binding = NULL;
+    WERROR result;
+
+    com_init_ctx(&com_ctx, NULL);
+    dcom_client_init(com_ctx, cmdline_credentials);
+
+    binding = torture_setting_string(torture, "binding", NULL);
+
+    result = WBEM_ConnectServer(com_ctx, binding, "root\\cimv2", NULL, NULL,
+            NULL, 0, NULL, NULL, &pWS);
+    if (!W_ERROR_IS_OK(result))
+    {
+        DEBUG(0, ("login failed: %s\n", wmi_errstr(result)));
+        talloc_free(mem_ctx);
+        return False;
+    }
+
+    /* a plain query ends, and reports that once all objects are through */
+    ZERO_STRUCT(st);
+    st.class_name = "Win32_OperatingSystem";
+    if (!wbem_sink_test_run(com_ctx, pWS, mem_ctx,
+            "SELECT * FROM Win32_OperatingSystem", False, &st, 0)
+            || !st.finished || !W_ERROR_IS_OK(st.result)
+            || st.objects == 0 || st.wrong_class)
+    {
+        DEBUG(0, ("query results not delivered through the sink\n"));
+        ret = False;
+    }
+
+    /* an event query never ends, stop at the first event */
+    ZERO_STRUCT(st);
+    st.class_name = "__InstanceModificationEvent";
+    if (!wbem_sink_test_run(com_ctx, pWS, mem_ctx,
+            "SELECT * FROM __InstanceModificationEvent WITHIN 1 "
+            "WHERE TargetInstance ISA 'Win32_LocalTime'", True, &st, 1)
+            || st.finished || st.objects == 0 || st.wrong_class)
+    {
+        DEBUG(0, ("event not delivered through the sink\n"));
+        ret = False;
+    }
+
+    talloc_free(mem_ctx);
+    return ret;
+}
+
 NTSTATUS torture_dcom_init(void)
 {
     struct torture_suite *suite = torture_suite_create(
@@ -385,6 +588,10 @@ NTSTATUS torture_dcom_init(void)
             torture_wbem_login_async);
     torture_suite_add_simple_test(suite, "WBEM-EXEC-QUERY-ASYNC",
             torture_wbem_exec_query_async);
+    torture_suite_add_simple_test(suite, "WBEM-CLASS-CACHE-NAMESPACE",
+            torture_wbem_class_cache_namespace);
+    torture_suite_add_simple_test(suite, "WBEM-EXEC-QUERY-SINK",
+            torture_wbem_exec_query_sink);
 
     /*
      * Finish configuring our test suite and pass it back to the test subsystem.
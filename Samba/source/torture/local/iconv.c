@@ -365,6 +365,79 @@ static bool test_random_5m(struct torture_context *tctx)
 	return true;
 }
 
+/*
+  convert a buffer with convert_string_talloc() and with the system
+  iconv, and check they agree wherever the system iconv succeeds
+*/
+static bool test_convert_buffer(struct torture_context *tctx,
+				charset_t from, const char *from_name,
+				charset_t to, const char *to_name,
+				uint8_t *inbuf, size_t size)
+{
+	uint8_t buf[4000];
+	char *ptr_in = (char *)inbuf, *ptr_out = (char *)buf;
+	size_t size_in = size, size_out = sizeof(buf), len;
+	void *out;
+	ssize_t ret;
+	iconv_t cd;
+
+	cd = iconv_open(to_name, from_name);
+	torture_assert(tctx, cd != (iconv_t)-1, "iconv_open failed");
+	ret = iconv(cd, &ptr_in, &size_in, &ptr_out, &size_out);
+	iconv_close(cd);
+	if (ret == -1) {
+		return true;
+	}
+	len = sizeof(buf) - size_out;
+
+	ret = convert_string_talloc(tctx, from, to, inbuf, size, &out);
+	torture_assert_int_equal(tctx, ret, len, "converted size mismatch");
+	if (memcmp(out, buf, len) != 0) {
+		show_buf(" IN:", inbuf, size);
+		show_buf("OUT:", out, ret);
+		show_buf("SYS:", buf, len);
+		torture_fail(tctx, "conversion mismatch");
+	}
+	talloc_free(out);
+	return true;
+}
+
+static bool test_convert_string(struct torture_context *tctx)
+{
+	unsigned char inbuf[1000];
+	unsigned int i, c;
+	size_t size;
+
+	for (i=0;i<100000;i++) {
+		size = random() % 200;
+		for (c=0;c<size;c++) {
+			if (random() % 100 < 80) {
+				inbuf[c] = random() % 128;
+			} else {
+				inbuf[c] = random();
+			}
+			if (random() % 10 == 0) {
+				inbuf[c] |= 0xd8;
+			}
+		}
+		/* mostly ASCII UTF-16, as found on the wire */
+		if (i % 2 == 0) {
+			for (c=1;c<size;c+=2) {
+				if (random() % 20 != 0) inbuf[c] = 0;
+			}
+		}
+
+		if (!test_convert_buffer(tctx, CH_UTF16, "UTF-16LE",
+					 CH_UTF8, "UTF-8", inbuf, size) ||
+		    !test_convert_buffer(tctx, CH_UTF8, "UTF-8",
+					 CH_UTF16, "UTF-16LE", inbuf, size)) {
+			printf("i=%d failed\n", i);
+			return false;
+		}
+	}
+	return true;
+}
+
 struct torture_suite *torture_local_iconv(TALLOC_CTX *mem_ctx)
 {
 	static iconv_t cd;
@@ -399,6 +472,9 @@ struct torture_suite *torture_local_iconv(TALLOC_CTX *mem_ctx)
 
 	torture_suite_add_simple_test(suite, "5M random UTF-16LE sequences",
 								   test_random_5m);
+
+	torture_suite_add_simple_test(suite, "convert_string_talloc()",
+				      test_convert_string);
 	return suite;
 }
 
@@ -70,6 +70,79 @@ static bool test_check_string_terminator(struct torture_context *tctx)
 	return true;
 }
 
+/*
+  push and pull arrays with the bulk uint16/uint32 functions, in both byte
+  orders, and compare the wire data and the values byte for byte
+*/
+static bool test_array_uint16_uint32(struct torture_context *tctx)
+{
+	const uint16_t v16[3] = { 0x1234, 0x5678, 0x9abc };
+	const uint32_t v32[2] = { 0x12345678, 0x9abcdef0 };
+	/* a uint8 first, so both arrays need alignment padding */
+	const uint8_t le[16] = {
+		0x01, 0x00, 0x34, 0x12, 0x78, 0x56, 0xbc, 0x9a,
+		0x78, 0x56, 0x34, 0x12, 0xf0, 0xde, 0xbc, 0x9a };
+	const uint8_t be[16] = {
+		0x01, 0x00, 0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc,
+		0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0 };
+	uint16_t p16[3];
+	uint32_t p32[2];
+	struct ndr_push *push;
+	struct ndr_pull *pull;
+	DATA_BLOB blob;
+	uint8_t u8;
+	int bigendian;
+
+	for (bigendian = 0; bigendian < 2; bigendian++) {
+		const uint8_t *expected = bigendian ? be : le;
+
+		push = ndr_push_init_ctx(tctx);
+		if (bigendian) push->flags |= LIBNDR_FLAG_BIGENDIAN;
+		torture_assert_ntstatus_ok(tctx, ndr_push_uint8(push, NDR_SCALARS, 1),
+					   "push uint8");
+		torture_assert_ntstatus_ok(tctx,
+			ndr_push_array_uint16(push, NDR_SCALARS, v16, 3),
+			"push array of uint16");
+		torture_assert_ntstatus_ok(tctx,
+			ndr_push_array_uint32(push, NDR_SCALARS, v32, 2),
+			"push array of uint32");
+		blob = ndr_push_blob(push);
+		torture_assert_int_equal(tctx, blob.length, sizeof(le),
+					 "pushed length");
+		torture_assert(tctx, memcmp(blob.data, expected, sizeof(le)) == 0,
+			       "pushed data differs");
+
+		pull = ndr_pull_init_blob(&blob, tctx);
+		if (bigendian) pull->flags |= LIBNDR_FLAG_BIGENDIAN;
+		torture_assert_ntstatus_ok(tctx, ndr_pull_uint8(pull, NDR_SCALARS, &u8),
+					   "pull uint8");
+		torture_assert_ntstatus_ok(tctx,
+			ndr_pull_array_uint16(pull, NDR_SCALARS, p16, 3),
+			"pull array of uint16");
+		torture_assert_ntstatus_ok(tctx,
+			ndr_pull_array_uint32(pull, NDR_SCALARS, p32, 2),
+			"pull array of uint32");
+		torture_assert_int_equal(tctx, pull->offset, sizeof(le),
+					 "pulled length");
+		torture_assert(tctx, memcmp(p16, v16, sizeof(v16)) == 0,
+			       "pulled uint16 values differ");
+		torture_assert(tctx, memcmp(p32, v32, sizeof(v32)) == 0,
+			       "pulled uint32 values differ");
+
+		/* one element more than there is data for */
+		pull->offset = 8;
+		torture_assert(tctx,
+			!NT_STATUS_IS_OK(ndr_pull_array_uint32(pull, NDR_SCALARS, p32, 3)),
+			"pull beyond the end of the data");
+		pull->offset = 8;
+		torture_assert(tctx,
+			!NT_STATUS_IS_OK(ndr_pull_array_uint32(pull, NDR_SCALARS, p32, 0x40000001)),
+			"pull of an overflowing array size");
+	}
+
+	return true;
+}
+
 struct torture_suite *torture_local_ndr(TALLOC_CTX *mem_ctx)
 {
 	struct torture_suite *suite = torture_suite_create(mem_ctx, "NDR");
@@ -77,5 +150,8 @@ struct torture_suite *torture_local_ndr(TALLOC_CTX *mem_ctx)
 	torture_suite_add_simple_test(suite, "string terminator", 
 								   test_check_string_terminator);
 
+	torture_suite_add_simple_test(suite, "array of uint16 and uint32",
+								   test_array_uint16_uint32);
+
 	return suite;
 }
@@ -52,12 +52,17 @@ struct WBEMOBJECT;
 
 
 /**
- * Initialize the Zenoss async event context. Will ensure that all
- * necessary Samba library initializtion takes place and that a root
- * event context for our local implementation is created.
+ * Perform the Samba library initialization needed before any WMI call: load
+ * the parameters and register the DCE/RPC interfaces and DCOM proxies. Safe
+ * to call more than once.
  */
-struct event_context* async_create_context(struct reactor_functions *funcs)
+void async_wmi_lib_init(void)
 {
+    static BOOL initialized = False;
+
+    if (initialized) return;
+    initialized = True;
+
     // load all Samba parameters
     lp_load();
 
@@ -71,6 +76,16 @@ struct event_context* async_create_context(struct reactor_functions *funcs)
     dcom_proxy_IRemUnknown_init();
     dcom_proxy_IWbemFetchSmartEnum_init();
     dcom_proxy_IWbemWCOSmartEnum_init();
+}
+
+/**
+ * Initialize the Zenoss async event context. Will ensure that all
+ * necessary Samba library initializtion takes place and that a root
+ * event context for our local implementation is created.
+ */
+struct event_context* async_create_context(struct reactor_functions *funcs)
+{
+    async_wmi_lib_init();
 
     // and finally create our top-level event context
     return zenoss_event_context_init(NULL, funcs);
@@ -109,6 +124,7 @@ WERROR ConnectAndQuery(struct com_context* ctx,
 					 NULL, 
 					 pEnum);
 	WERR_CHECK("WMI query execute.");
+	IEnumWbemClassObject_SetNamespace(*pEnum, "root\\cimv2");
 
 	result = IEnumWbemClassObject_Reset(*pEnum, ctx);
 	WERR_CHECK("Reset result of WMI query.");
@@ -10,7 +10,7 @@ PUBLIC_DEPENDENCIES = LIBCLI_SMB NDR_MISC LIBSAMBA-UTIL LIBSAMBA-CONFIG RPC_NDR_
 		wmi \
 		RPC_NDR_REMACT \
 		NDR_TABLE 
-OBJ_FILES = async_wmi_lib.o zenoss_events.o
+OBJ_FILES = async_wmi_lib.o zenoss_events.o wmi_client.o
 # End LIBRARY async_wmi_lib
 #######################
 
@@ -33,8 +33,11 @@
 #include "lib/talloc/talloc.h"
 #include "libcli/composite/composite.h"
 #include "wmi/wmi.h"
+#include "system/locale.h"
 
 NTSTATUS ndr_pull_WbemClassObject_Object(struct ndr_pull *ndr, int ndr_flags, struct WbemClassObject *r);
+NTSTATUS ndr_pull_WbemInstance_property(const struct WbemClassObject *r, uint32_t i);
+NTSTATUS ndr_pull_WbemInstance_all(const struct WbemClassObject *r, const uint8_t *selected);
 void duplicate_CIMVAR(TALLOC_CTX *mem_ctx, const union CIMVAR *src, union CIMVAR *dst, enum CIMTYPE_ENUMERATION cimtype);
 void duplicate_WbemClassObject(TALLOC_CTX *mem_ctx, const struct WbemClassObject *src, struct WbemClassObject *dst);
 
@@ -351,6 +354,7 @@ void duplicate_WbemClassObject(TALLOC_CTX *mem_ctx, const struct WbemClassObject
 		duplicate_WbemClass(dst->obj_class, src->obj_class, dst->obj_class);
 	}
 	if (src->flags & WCF_INSTANCE) {
+		ndr_pull_WbemInstance_all(src, NULL);
 		dst->instance = talloc_zero(mem_ctx, struct WbemInstance);
 		duplicate_WbemInstance(dst->instance, src->instance, dst->instance, src->obj_class);
 	}
@@ -423,8 +427,12 @@ void duplicate_CIMVAR(TALLOC_CTX *mem_ctx, const union CIMVAR *src, union CIMVAR
 WERROR WbemClassObject_Get(struct WbemClassObject *d, TALLOC_CTX *mem_ctx, const char *name, uint32_t flags, union CIMVAR *val, enum CIMTYPE_ENUMERATION *cimtype, uint32_t *flavor)
 {
 	uint32_t i;
+	NTSTATUS status;
+
 	for (i = 0; i < d->obj_class->__PROPERTY_COUNT; ++i) {
 		if (!strcmp(d->obj_class->properties[i].name, name)) {
+			status = ndr_pull_WbemInstance_property(d, i);
+			if (!NT_STATUS_IS_OK(status)) return ntstatus_to_werror(status);
 			duplicate_CIMVAR(mem_ctx, &d->instance->data[i], val, d->obj_class->properties[i].desc->cimtype);
 			if (cimtype) *cimtype = d->obj_class->properties[i].desc->cimtype;
 			if (flavor) *flavor = 0; // FIXME:avg implement flavor
@@ -440,6 +448,7 @@ WERROR IWbemClassObject_Put(struct IWbemClassObject *d, TALLOC_CTX *mem_ctx, con
 	uint32_t i;
 
 	wco = (struct WbemClassObject *)d->object_data;
+	if (!NT_STATUS_IS_OK(ndr_pull_WbemInstance_all(wco, NULL))) return WERR_GENERAL_FAILURE;
 	for (i = 0; i < wco->obj_class->__PROPERTY_COUNT; ++i) {
 		if (!strcmp(wco->obj_class->properties[i].name, name)) {
 			if (cimtype && cimtype != wco->obj_class->properties[i].desc->cimtype) return WERR_INVALID_PARAM;
@@ -480,10 +489,215 @@ static void add_pair_guid_ptr(TALLOC_CTX *mem_ctx, struct pair_guid_ptr **list,
 	e = talloc(mem_ctx, struct pair_guid_ptr);
 	e->guid = *uuid;
 	e->ptr = ptr;
-	talloc_steal(e, ptr);
+	(void)talloc_reference(e, ptr);
 	DLIST_ADD(*list, e);
 }
 
+/*
+ * Class definitions shared by all enumerations of a com_context. Entries are
+ * keyed by the class GUID sent with each object and by class name, both
+ * qualified by the host and namespace they came from, and are kept in LRU
+ * order. The namespace of an enumeration is set with
+ * IEnumWbemClassObject_SetNamespace; enumerations without one share the
+ * empty namespace. Objects hold a talloc reference to their WbemClass, so
+ * evicting an entry never invalidates objects already handed out.
+ */
+#define WBEM_CLASS_CACHE_BUCKETS	256
+#define WBEM_CLASS_CACHE_MAX_ENTRIES	4096
+
+struct wbem_class_cache_entry {
+	struct GUID guid;
+	const char *host;
+	const char *nspace;
+	const char *name;
+	struct WbemClass *cls;
+	struct wbem_class_cache_entry *guid_next, *name_next;
+	struct wbem_class_cache_entry *prev, *next;
+};
+
+struct wbem_class_cache {
+	struct wbem_class_cache_entry *by_guid[WBEM_CLASS_CACHE_BUCKETS];
+	struct wbem_class_cache_entry *by_name[WBEM_CLASS_CACHE_BUCKETS];
+	struct wbem_class_cache_entry *lru;
+	struct wbem_class_cache_entry *lru_tail;
+	struct wbem_class_cache_stats stats;
+};
+
+static uint32_t wbem_class_cache_hash_guid(const struct GUID *guid)
+{
+	uint32_t h;
+	int i;
+
+	h = guid->time_low ^ (guid->time_mid << 16) ^ guid->time_hi_and_version;
+	h ^= (guid->clock_seq[0] << 8) | guid->clock_seq[1];
+	for (i = 0; i < 6; ++i)
+		h = h * 31 + guid->node[i];
+	return h % WBEM_CLASS_CACHE_BUCKETS;
+}
+
+static uint32_t wbem_class_cache_hash_name(const char *host, const char *nspace, const char *name)
+{
+	uint32_t h = 0;
+
+	for (; *host; ++host)
+		h = h * 31 + (uint8_t)*host;
+	/* namespaces and class names are case insensitive */
+	for (; *nspace; ++nspace)
+		h = h * 31 + toupper((uint8_t)*nspace);
+	for (; *name; ++name)
+		h = h * 31 + toupper((uint8_t)*name);
+	return h % WBEM_CLASS_CACHE_BUCKETS;
+}
+
+static struct wbem_class_cache *wbem_class_cache(struct com_context *ctx, bool create)
+{
+	struct wbem_class_cache *cc;
+
+	cc = com_extension_by_id(ctx, COM_EXT_WMI_CLASS_CACHE);
+	if (cc == NULL && create) {
+		cc = talloc_zero(ctx, struct wbem_class_cache);
+		if (cc == NULL) return NULL;
+		com_extension_set(ctx, COM_EXT_WMI_CLASS_CACHE, cc);
+	}
+	return cc;
+}
+
+static void wbem_class_cache_touch(struct wbem_class_cache *cc, struct wbem_class_cache_entry *e)
+{
+	if (cc->lru == e) return;
+	if (cc->lru_tail == e) cc->lru_tail = e->prev;
+	DLIST_REMOVE(cc->lru, e);
+	DLIST_ADD(cc->lru, e);
+}
+
+static void wbem_class_cache_unlink(struct wbem_class_cache *cc, struct wbem_class_cache_entry *e)
+{
+	struct wbem_class_cache_entry **pp;
+
+	for (pp = &cc->by_guid[wbem_class_cache_hash_guid(&e->guid)]; *pp; pp = &(*pp)->guid_next) {
+		if (*pp == e) {
+			*pp = e->guid_next;
+			break;
+		}
+	}
+	if (e->name) {
+		for (pp = &cc->by_name[wbem_class_cache_hash_name(e->host, e->nspace, e->name)]; *pp; pp = &(*pp)->name_next) {
+			if (*pp == e) {
+				*pp = e->name_next;
+				break;
+			}
+		}
+	}
+	if (cc->lru_tail == e) cc->lru_tail = e->prev;
+	DLIST_REMOVE(cc->lru, e);
+	--cc->stats.entries;
+}
+
+static struct WbemClass *wbem_class_cache_find(struct wbem_class_cache *cc, const char *host, const char *nspace, const struct GUID *guid)
+{
+	struct wbem_class_cache_entry *e;
+
+	if (cc == NULL) return NULL;
+	for (e = cc->by_guid[wbem_class_cache_hash_guid(guid)]; e; e = e->guid_next) {
+		if (GUID_equal(&e->guid, guid) && !strcmp(e->host, host) && !strcasecmp(e->nspace, nspace)) {
+			wbem_class_cache_touch(cc, e);
+			return e->cls;
+		}
+	}
+	return NULL;
+}
+
+static void wbem_class_cache_add(struct wbem_class_cache *cc, const char *host, const char *nspace, const struct GUID *guid, struct WbemClass *cls)
+{
+	struct wbem_class_cache_entry *e;
+	uint32_t h;
+
+	if (cc == NULL || cls == NULL) return;
+
+	e = talloc_zero(cc, struct wbem_class_cache_entry);
+	if (e == NULL) return;
+	e->guid = *guid;
+	e->host = talloc_strdup(e, host);
+	e->nspace = talloc_strdup(e, nspace);
+	if (e->host == NULL || e->nspace == NULL) {
+		talloc_free(e);
+		return;
+	}
+	if (cls->__CLASS) e->name = talloc_strdup(e, cls->__CLASS);
+	e->cls = cls;
+	if (talloc_reference(e, cls) == NULL) {
+		talloc_free(e);
+		return;
+	}
+
+	h = wbem_class_cache_hash_guid(guid);
+	e->guid_next = cc->by_guid[h];
+	cc->by_guid[h] = e;
+	if (e->name) {
+		h = wbem_class_cache_hash_name(e->host, e->nspace, e->name);
+		e->name_next = cc->by_name[h];
+		cc->by_name[h] = e;
+	}
+	DLIST_ADD(cc->lru, e);
+	if (cc->lru_tail == NULL) cc->lru_tail = e;
+	++cc->stats.entries;
+
+	while (cc->stats.entries > WBEM_CLASS_CACHE_MAX_ENTRIES) {
+		e = cc->lru_tail;
+		wbem_class_cache_unlink(cc, e);
+		talloc_free(e);
+		++cc->stats.evictions;
+	}
+}
+
+/*
+ * Look up a cached class definition by host, namespace and name; a NULL
+ * namespace stands for enumerations that were not given one. The result
+ * stays valid until the com_context is freed or the entry is evicted;
+ * callers that keep it longer should take a talloc reference.
+ */
+struct WbemClass *WBEMDATA_ClassCacheLookup(struct com_context *ctx, const char *host, const char *nspace, const char *name)
+{
+	struct wbem_class_cache *cc;
+	struct wbem_class_cache_entry *e;
+
+	cc = wbem_class_cache(ctx, false);
+	if (cc == NULL || host == NULL || name == NULL) return NULL;
+	if (nspace == NULL) nspace = "";
+	for (e = cc->by_name[wbem_class_cache_hash_name(host, nspace, name)]; e; e = e->name_next) {
+		if (!strcasecmp(e->name, name) && !strcmp(e->host, host) && !strcasecmp(e->nspace, nspace)) {
+			wbem_class_cache_touch(cc, e);
+			return e->cls;
+		}
+	}
+	return NULL;
+}
+
+void WBEMDATA_ClassCacheStats(struct com_context *ctx, struct wbem_class_cache_stats *stats)
+{
+	struct wbem_class_cache *cc;
+
+	cc = wbem_class_cache(ctx, false);
+	if (cc) {
+		*stats = cc->stats;
+	} else {
+		ZERO_STRUCTP(stats);
+	}
+}
+
+void WBEMDATA_ClassCacheFlush(struct com_context *ctx)
+{
+	struct wbem_class_cache *cc;
+
+	cc = wbem_class_cache(ctx, false);
+	if (cc == NULL) return;
+	while (cc->lru) {
+		struct wbem_class_cache_entry *e = cc->lru;
+		wbem_class_cache_unlink(cc, e);
+		talloc_free(e);
+	}
+}
+
 struct IEnumWbemClassObject_data {
     struct GUID guid;
     struct IWbemFetchSmartEnum *pFSE;
@@ -491,12 +705,126 @@ struct IEnumWbemClassObject_data {
     struct pair_guid_ptr *cache;
     int32_t lTimeout;
     uint32_t uCount;
-    uint32_t uReturned;
-    uint32_t size;
-    uint8_t *pData;
+    uint32_t decode_flags;
+    const char **projection;
+    struct projection_map *maps;
+    const char *nspace;                 /* for the class cache */
+};
+
+/*
+ * Which properties of a class the projection of an enumeration selects,
+ * one bit per property index.
+ */
+struct projection_map {
+    const struct WbemClass *cls;
+    uint8_t *selected;
+    struct projection_map *prev, *next;
 };
 
-NTSTATUS WBEMDATA_Parse(uint8_t *data, uint32_t size, struct IEnumWbemClassObject *d, uint32_t uCount, struct WbemClassObject **apObjects)
+static const uint8_t *projection_map(struct IEnumWbemClassObject_data *s,
+        const struct WbemClass *cls)
+{
+    struct projection_map *m;
+    uint32_t i;
+
+    if (s->projection == NULL || cls == NULL) return NULL;
+    for (m = s->maps; m; m = m->next)
+    {
+        if (m->cls == cls) return m->selected;
+    }
+
+    m = talloc_zero(s, struct projection_map);
+    if (m == NULL) return NULL;
+    m->selected = talloc_zero_array(m, uint8_t, (cls->__PROPERTY_COUNT + 7) >> 3);
+    if (m->selected == NULL || talloc_reference(m, cls) == NULL)
+    {
+        talloc_free(m);
+        return NULL;
+    }
+    m->cls = cls;
+    for (i = 0; i < cls->__PROPERTY_COUNT; ++i)
+    {
+        if (str_list_check_ci(s->projection, cls->properties[i].name))
+            m->selected[i >> 3] |= 1 << (i & 7);
+    }
+    DLIST_ADD(s->maps, m);
+    return m->selected;
+}
+
+/*
+ * Extract the column list of a "SELECT a, b FROM ..." WQL query. Returns
+ * NULL for "SELECT *" and for anything that is not a plain select.
+ */
+const char **WBEMDATA_QueryColumns(TALLOC_CTX *mem_ctx, const char *query)
+{
+    const char *p, *end;
+    const char **cols;
+    char *list;
+
+    p = query;
+    while (isspace((uint8_t)*p)) ++p;
+    if (strncasecmp(p, "SELECT", 6) != 0 || !isspace((uint8_t)p[6])) return NULL;
+    p += 6;
+
+    for (end = p; *end; ++end)
+    {
+        if (isspace((uint8_t)end[0]) && strncasecmp(end + 1, "FROM", 4) == 0
+            && (end[5] == '\0' || isspace((uint8_t)end[5])))
+            break;
+    }
+    if (*end == '\0') return NULL;
+
+    list = talloc_strndup(mem_ctx, p, end - p);
+    if (list == NULL) return NULL;
+    cols = str_list_make(mem_ctx, list, ", \t\r\n");
+    talloc_free(list);
+    if (cols == NULL || cols[0] == NULL || str_list_check(cols, "*"))
+    {
+        talloc_free(cols);
+        return NULL;
+    }
+    return cols;
+}
+
+/*
+ * Prepare an instance for lazy decoding of the buffer data. The instance
+ * holds a reference to the buffer, so it stays valid after the SmartNext
+ * reply it came in has been freed.
+ */
+static NTSTATUS wbemdata_lazy_instance(struct WbemClassObject *wco, uint8_t *data)
+{
+	wco->instance = talloc_zero(wco, struct WbemInstance);
+	if (wco->instance == NULL) return NT_STATUS_NO_MEMORY;
+	if (talloc_reference(wco->instance, data) == NULL) return NT_STATUS_NO_MEMORY;
+	wco->instance->lazy_data = data;
+	return NT_STATUS_OK;
+}
+
+/*
+ * Create a context to receive one batch of objects in. Everything decoded
+ * for the batch (objects, instances, strings and arrays) is allocated below
+ * it, so the whole batch goes with a single talloc_free(), while the class
+ * definitions it uses stay with the class cache and the enumerator. The
+ * context is a talloc pool, so most of those small allocations do not go to
+ * malloc() at all.
+ */
+#define WBEMDATA_BATCH_POOL_SIZE (64*1024)
+
+TALLOC_CTX *WBEMDATA_BatchArena(TALLOC_CTX *mem_ctx)
+{
+	TALLOC_CTX *arena = talloc_pool(mem_ctx, WBEMDATA_BATCH_POOL_SIZE);
+
+	if (arena != NULL) {
+		talloc_set_name_const(arena, "WBEMDATA batch");
+	}
+	return arena;
+}
+
+/*
+ * Decode a SmartNext reply into apObjects. The objects are allocated on
+ * obj_ctx, or on the COM context of the enumerator if that is NULL.
+ */
+NTSTATUS WBEMDATA_Parse(uint8_t *data, uint32_t size, struct IEnumWbemClassObject *d, uint32_t uCount, struct WbemClassObject **apObjects, TALLOC_CTX *obj_ctx)
 {
 	struct ndr_pull *ndr;
 	TALLOC_CTX *mem_ctx;
@@ -505,14 +833,27 @@ NTSTATUS WBEMDATA_Parse(uint8_t *data, uint32_t size, struct IEnumWbemClassObjec
 	NTSTATUS status;
 	struct GUID guid;
 	struct IEnumWbemClassObject_data *ecod;
+	struct wbem_class_cache *cc;
+	struct dcom_object_exporter *ox;
+	struct WbemClass *cls;
+	const char *host, *nspace;
+	bool lazy, project;
 
 	if (!uCount) return NT_STATUS_NOT_IMPLEMENTED;
 
 	ecod = d->object_data;
+	/* projection goes through lazy decoding and then decodes just the selection */
+	lazy = (ecod->decode_flags & WBEMDATA_DECODE_LAZY) || ecod->projection;
+	project = ecod->projection && !(ecod->decode_flags & WBEMDATA_DECODE_LAZY);
+	cc = wbem_class_cache(d->ctx, true);
+	ox = object_exporter_by_ip(d->ctx, (struct IUnknown *)d);
+	host = (ox && ox->host) ? ox->host : "";
+	nspace = ecod->nspace ? ecod->nspace : "";
+	if (obj_ctx == NULL) obj_ctx = d->ctx;
 	mem_ctx = talloc_new(0);
 
 	ndr = talloc_zero(mem_ctx, struct ndr_pull);
-	ndr->current_mem_ctx = d->ctx;
+	ndr->current_mem_ctx = obj_ctx;
 	ndr->data = data;
 	ndr->data_size = size;
 	ndr_set_flags(&ndr->flags, LIBNDR_FLAG_NOALIGN);
@@ -558,19 +899,47 @@ NTSTATUS WBEMDATA_Parse(uint8_t *data, uint32_t size, struct IEnumWbemClassObjec
 		NDR_CHECK(ndr_pull_GUID(ndr, NDR_SCALARS, &guid));
 		switch (datatype) {
 		case DATATYPE_CLASSOBJECT:
-			apObjects[i] = talloc_zero(d->ctx, struct WbemClassObject);
+			apObjects[i] = talloc_zero(obj_ctx, struct WbemClassObject);
+			/* a known definition is skipped rather than decoded again */
+			cls = wbem_class_cache_find(cc, host, nspace, &guid);
+			if (cls) {
+				++cc->stats.hits;
+				apObjects[i]->obj_class = cls;
+				(void)talloc_reference(apObjects[i], cls);
+			}
+			if (lazy) {
+				NTERR_CHECK(wbemdata_lazy_instance(apObjects[i], data));
+			}
 			ndr->current_mem_ctx = apObjects[i];
 			NDR_CHECK(ndr_pull_WbemClassObject(ndr, NDR_SCALARS|NDR_BUFFERS, apObjects[i]));
-			ndr->current_mem_ctx = d->ctx;
-			add_pair_guid_ptr(ecod, &ecod->cache, &guid, apObjects[i]->obj_class);
+			ndr->current_mem_ctx = obj_ctx;
+			if (project) {
+				NTERR_CHECK(ndr_pull_WbemInstance_all(apObjects[i], projection_map(ecod, apObjects[i]->obj_class)));
+			}
+			if (!cls) {
+				if (cc) ++cc->stats.misses;
+				wbem_class_cache_add(cc, host, nspace, &guid, apObjects[i]->obj_class);
+			}
+			if (!get_ptr_by_guid(ecod->cache, &guid))
+				add_pair_guid_ptr(ecod, &ecod->cache, &guid, apObjects[i]->obj_class);
 			break;
 		case DATATYPE_OBJECT:
-			apObjects[i] = talloc_zero(d->ctx, struct WbemClassObject);
-			apObjects[i]->obj_class = get_ptr_by_guid(ecod->cache, &guid);
+			apObjects[i] = talloc_zero(obj_ctx, struct WbemClassObject);
+			/* the enumerator's own list covers entries evicted meanwhile */
+			cls = wbem_class_cache_find(cc, host, nspace, &guid);
+			if (!cls)
+				cls = get_ptr_by_guid(ecod->cache, &guid);
+			apObjects[i]->obj_class = cls;
 			(void)talloc_reference(apObjects[i], apObjects[i]->obj_class);
+			if (lazy) {
+				NTERR_CHECK(wbemdata_lazy_instance(apObjects[i], data));
+			}
 			ndr->current_mem_ctx = apObjects[i];
 			NDR_CHECK(ndr_pull_WbemClassObject_Object(ndr, NDR_SCALARS|NDR_BUFFERS, apObjects[i]));
-			ndr->current_mem_ctx = d->ctx;
+			ndr->current_mem_ctx = obj_ctx;
+			if (project) {
+				NTERR_CHECK(ndr_pull_WbemInstance_all(apObjects[i], projection_map(ecod, apObjects[i]->obj_class)));
+			}
 			break;
 		default:
 			DEBUG(0, ("WBEMDATA_Parse: Data type %d not supported\n", datatype));
@@ -591,17 +960,10 @@ end:
 struct composite_context *dcom_proxy_IEnumWbemClassObject_Release_send(
         struct IUnknown *d, TALLOC_CTX *mem_ctx)
 {
-    struct composite_context *c, *cr;
     struct REMINTERFACEREF iref[3];
-    struct dcom_object_exporter *ox;
     struct IEnumWbemClassObject_data *ecod;
     int n;
 
-    c = composite_create(d->ctx, d->ctx->event_ctx);
-    if (c == NULL) return NULL;
-    c->private_data = d;
-
-    ox = object_exporter_by_ip(d->ctx, d);
     iref[0].ipid = IUnknown_ipid(d);
     iref[0].cPublicRefs = 5;
     iref[0].cPrivateRefs = 0;
@@ -625,9 +987,114 @@ struct composite_context *dcom_proxy_IEnumWbemClassObject_Release_send(
         }
     }
 
-    cr = IRemUnknown_RemRelease_send(ox->rem_unknown, mem_ctx, n, iref);
-    composite_continue(c, cr, dcom_release_continue, c);
-    return c;
+    return dcom_release_refs_send(d, mem_ctx, n, iref);
+}
+
+/*
+ * Return the enumeration state of d, allocating it on first use.
+ */
+static struct IEnumWbemClassObject_data *enum_data(struct IEnumWbemClassObject *d)
+{
+    struct IEnumWbemClassObject_data *s = d->object_data;
+
+    if (s == NULL)
+    {
+        s = talloc_zero(d, struct IEnumWbemClassObject_data);
+        if (s == NULL) return NULL;
+        d->object_data = s;
+
+        /* TODO: why?! */
+        d->vtable->Release_send = dcom_proxy_IEnumWbemClassObject_Release_send;
+    }
+    return s;
+}
+
+/*
+ * Select how objects returned by later SmartNext calls on d are decoded.
+ * With WBEMDATA_DECODE_LAZY, instances keep a reference to the received
+ * buffer and each property is decoded on its first WbemClassObject_Get.
+ * Code reading instance->data directly must call WbemClassObject_Decode
+ * first.
+ */
+WERROR IEnumWbemClassObject_SetDecodeFlags(struct IEnumWbemClassObject *d,
+        uint32_t flags)
+{
+    struct IEnumWbemClassObject_data *s = enum_data(d);
+
+    if (s == NULL) return WERR_NOMEM;
+    s->decode_flags = flags;
+    return WERR_OK;
+}
+
+/*
+ * Tell d which namespace its query ran in, so that class definitions are
+ * only shared with enumerations of the same namespace. Normally the
+ * namespace given to WBEM_ConnectServer, see WBEM_ServicesNamespace.
+ */
+WERROR IEnumWbemClassObject_SetNamespace(struct IEnumWbemClassObject *d,
+        const char *nspace)
+{
+    struct IEnumWbemClassObject_data *s = enum_data(d);
+
+    if (s == NULL) return WERR_NOMEM;
+    talloc_free(discard_const(s->nspace));
+    s->nspace = NULL;
+    if (nspace)
+    {
+        s->nspace = talloc_strdup(s, nspace);
+        if (s->nspace == NULL) return WERR_NOMEM;
+    }
+    return WERR_OK;
+}
+
+/*
+ * Restrict decoding of objects returned by later SmartNext calls on d to the
+ * named properties (typically from WBEMDATA_QueryColumns); NULL selects all
+ * of them again. Unselected properties are left empty unless lazy decoding
+ * is also enabled, in which case they can still be decoded on demand.
+ */
+WERROR IEnumWbemClassObject_SetProjection(struct IEnumWbemClassObject *d,
+        const char **names)
+{
+    struct IEnumWbemClassObject_data *s = enum_data(d);
+
+    if (s == NULL) return WERR_NOMEM;
+    while (s->maps)
+    {
+        struct projection_map *m = s->maps;
+        DLIST_REMOVE(s->maps, m);
+        talloc_free(m);
+    }
+    talloc_free(s->projection);
+    s->projection = NULL;
+    if (names)
+    {
+        s->projection = str_list_copy(s, names);
+        if (s->projection == NULL) return WERR_NOMEM;
+    }
+    return WERR_OK;
+}
+
+/*
+ * Return the projection bitmap of d for objects of class cls, one bit per
+ * property index, or NULL if all properties are selected.
+ */
+const uint8_t *IEnumWbemClassObject_GetProjection(struct IEnumWbemClassObject *d,
+        const struct WbemClass *cls)
+{
+    struct IEnumWbemClassObject_data *s = d->object_data;
+
+    if (s == NULL) return NULL;
+    return projection_map(s, cls);
+}
+
+/*
+ * Make sure all properties of a lazily decoded object are in
+ * instance->data.
+ */
+WERROR WbemClassObject_Decode(struct WbemClassObject *wco)
+{
+    return ntstatus_to_werror(ndr_pull_WbemInstance_all(wco, NULL));
 }
 
 /* TODO: BUGGY dcom proxy generation misnames this function */
@@ -635,6 +1102,20 @@ extern WERROR IWbemWCOSmartEnum_IWbemWCOSmartEnum_Next_recv(
         struct composite_context *c, uint32_t *puReturned, uint32_t *pSize,
         uint8_t **pData);
 
+/*
+ * State of a single SmartNext call. The raw IWbemWCOSmartEnum:Next reply is
+ * kept here rather than in the enumerator so that several calls may be
+ * outstanding on one enumerator at the same time.
+ */
+struct smart_next_state {
+    struct IEnumWbemClassObject *d;
+    WERROR result;
+    uint32_t uCount;
+    uint32_t uReturned;
+    uint32_t size;
+    uint8_t *pData;
+};
+
 /*
  * Continue a SmartNext enumeration request by processing the returned results
  * and setting up the data for processing by the parent composite.
@@ -642,8 +1123,7 @@ extern WERROR IWbemWCOSmartEnum_IWbemWCOSmartEnum_Next_recv(
 static void smart_next_enum_continue(struct composite_context *ctx)
 {
     struct composite_context *c = NULL;
-    struct IEnumWbemClassObject *d = NULL;
-    struct IEnumWbemClassObject_data *s = NULL;
+    struct smart_next_state *sn = NULL;
     uint32_t uReturned = 0;
     uint32_t size = 0;
     uint8_t *pData = NULL;
@@ -652,10 +1132,8 @@ static void smart_next_enum_continue(struct composite_context *ctx)
     /* retrieve the parent composite context */
     c = talloc_get_type(ctx->async.private_data, struct composite_context);
 
-    /* retrieve the enumeration state data */
-    d = (struct IEnumWbemClassObject *)talloc_get_type(c->private_data,
-            struct IUnknown);
-    s = d->object_data;
+    /* retrieve the state data of this call */
+    sn = talloc_get_type(c->private_data, struct smart_next_state);
 
     /*
      * The successful method execution MUST return WBEM_S_NO_ERROR. If the
@@ -670,9 +1148,10 @@ static void smart_next_enum_continue(struct composite_context *ctx)
         || W_ERROR_V(result) == WBEM_S_FALSE
         || W_ERROR_V(result) == WBEM_S_TIMEDOUT)
     {
-        s->uReturned = uReturned;
-        s->size = size;
-        s->pData = pData;
+        sn->result = result;
+        sn->uReturned = uReturned;
+        sn->size = size;
+        sn->pData = pData;
         c->status = NT_STATUS_OK;
         composite_done(c);
     }
@@ -690,7 +1169,7 @@ static void smart_next_fetch_enum_continue(struct composite_context *ctx)
 {
     struct composite_context *c = NULL;
     struct composite_context *new_ctx = NULL;
-    struct IEnumWbemClassObject *d = NULL;
+    struct smart_next_state *sn = NULL;
     struct IEnumWbemClassObject_data *s = NULL;
     struct IWbemWCOSmartEnum *pSmartEnum = NULL;
     WERROR result;
@@ -699,9 +1178,8 @@ static void smart_next_fetch_enum_continue(struct composite_context *ctx)
     c = talloc_get_type(ctx->async.private_data, struct composite_context);
 
     /* retrieve the enumeration state data */
-    d = (struct IEnumWbemClassObject *)talloc_get_type(c->private_data,
-            struct IUnknown);
-    s = d->object_data;
+    sn = talloc_get_type(c->private_data, struct smart_next_state);
+    s = sn->d->object_data;
 
     /* retrieve the results of the IWbemFetchSmartEnum:GetSmartEnum request */
     result = IWbemFetchSmartEnum_Fetch_recv(ctx, &pSmartEnum);
@@ -721,7 +1199,7 @@ static void smart_next_fetch_enum_continue(struct composite_context *ctx)
         s->guid = GUID_random();
 
         new_ctx = IWbemWCOSmartEnum_Next_send(s->pSE, c, &s->guid,
-                s->lTimeout, s->uCount);
+                s->lTimeout, sn->uCount);
         if (composite_nomem(new_ctx, c)) return;
 
         composite_continue(c, new_ctx, smart_next_enum_continue, c);
@@ -737,7 +1215,7 @@ static void smart_next_query_interface_continue(struct composite_context *ctx)
 {
     struct composite_context *c = NULL;
     struct composite_context *new_ctx = NULL;
-    struct IEnumWbemClassObject *d = NULL;
+    struct smart_next_state *sn = NULL;
     struct IEnumWbemClassObject_data *s = NULL;
     struct IUnknown **interfaces = NULL;
 
@@ -745,9 +1223,8 @@ static void smart_next_query_interface_continue(struct composite_context *ctx)
     c = talloc_get_type(ctx->async.private_data, struct composite_context);
 
     /* retrieve the enumeration state data */
-    d = (struct IEnumWbemClassObject *)talloc_get_type(c->private_data,
-            struct IUnknown);
-    s = d->object_data;
+    sn = talloc_get_type(c->private_data, struct smart_next_state);
+    s = sn->d->object_data;
 
     /* process the results of the RemQueryInterface call */
     c->status = dcom_query_interface_recv(ctx, c, &interfaces);
@@ -776,26 +1253,28 @@ struct composite_context *IEnumWbemClassObject_SmartNext_send(
     struct composite_context *c = NULL;
     struct composite_context *new_ctx = NULL;
     struct IEnumWbemClassObject_data *s = NULL;
+    struct smart_next_state *sn = NULL;
     struct GUID iid;
 
     /* create a new composite to be used for this call sequence */
     c = composite_create(parent_ctx, d->ctx->event_ctx);
     if (c == NULL) return NULL;
 
+    sn = talloc_zero(c, struct smart_next_state);
+    if (composite_nomem(sn, c)) return c;
+    c->private_data = sn;
+    sn->d = d;
+    sn->uCount = uCount;
+
     /* if we're not continuing an existing enumeration then allocate state */
     s = d->object_data;
-    if (s == NULL)
+    if (s == NULL || s->pSE == NULL)
     {
-        s = talloc_zero(d, struct IEnumWbemClassObject_data);
+        s = enum_data(d);
         if (composite_nomem(s, c)) return c;
-        d->object_data = s;
-        c->private_data = d;
         s->lTimeout = lTimeout;
         s->uCount = uCount;
 
-        /* TODO: why?! */
-        d->vtable->Release_send = dcom_proxy_IEnumWbemClassObject_Release_send;
-
         /*
          * retrieve the IWbemFetchSmartEnum interface so that we can then ask it
          * for an IWbemWCOSmartEnum enumerator, which is a network optimized
@@ -811,13 +1290,12 @@ struct composite_context *IEnumWbemClassObject_SmartNext_send(
     else
     {
         /*
-         * we're just continuing an existing enumeration request, so save the
-         * state data in our new composite and issue the next
-         * IWbemWCOSmartEnum:Next call.
+         * we're just continuing an existing enumeration request, so issue
+         * the next IWbemWCOSmartEnum:Next call.
          */
-        c->private_data = d;
+        s->lTimeout = lTimeout;
         new_ctx = IWbemWCOSmartEnum_Next_send(s->pSE, c, &s->guid,
-                s->lTimeout, s->uCount);
+                s->lTimeout, uCount);
         if (composite_nomem(new_ctx, c)) return c;
 
         composite_continue(c, new_ctx, smart_next_enum_continue, c);
@@ -827,14 +1305,15 @@ struct composite_context *IEnumWbemClassObject_SmartNext_send(
 }
 
 /*
- * Asynchronously receive a SmartNext enumeration request.
+ * Asynchronously receive a SmartNext enumeration request. The objects are
+ * allocated on parent_ctx (the COM context of the enumerator if NULL); pass
+ * a context from WBEMDATA_BatchArena() to release the batch in one go.
  */
 WERROR IEnumWbemClassObject_SmartNext_recv(struct composite_context *c,
         TALLOC_CTX *parent_ctx, struct WbemClassObject **apObjects,
         uint32_t *puReturned)
 {
-    struct IEnumWbemClassObject *d = c->private_data;
-    struct IEnumWbemClassObject_data *s = d->object_data;
+    struct smart_next_state *sn = NULL;
     WERROR result = WERR_OK;
     NTSTATUS status;
 
@@ -852,13 +1331,14 @@ WERROR IEnumWbemClassObject_SmartNext_recv(struct composite_context *c,
     }
     else
     {
-        if (s->pData != NULL)
+        sn = talloc_get_type(c->private_data, struct smart_next_state);
+        if (sn->pData != NULL)
         {
-            status = WBEMDATA_Parse(s->pData, s->size, d, s->uReturned,
-                    apObjects);
+            status = WBEMDATA_Parse(sn->pData, sn->size, sn->d, sn->uReturned,
+                    apObjects, parent_ctx);
             if (NT_STATUS_IS_OK(status))
             {
-                *puReturned = s->uReturned;
+                *puReturned = sn->uReturned;
             }
             result = ntstatus_to_werror(status);
         }
@@ -881,6 +1361,609 @@ WERROR IEnumWbemClassObject_SmartNext(struct IEnumWbemClassObject *d,
             puReturned);
 }
 
+/*
+ * Prefetching enumerator. Keeps up to 'depth' IWbemWCOSmartEnum:Next calls
+ * outstanding so that the next batch is already on the wire while the caller
+ * parses and consumes the current one. Raw replies are queued in order and
+ * only parsed when handed to the caller.
+ *
+ * The batch size adapts to what the server returns: it aims for batches of
+ * about PREFETCH_TARGET_BYTES of marshalled data and is halved whenever a
+ * single batch takes longer than PREFETCH_TARGET_MSEC to arrive.
+ */
+#define PREFETCH_TARGET_BYTES (256 * 1024)
+#define PREFETCH_TARGET_MSEC 2000
+#define PREFETCH_DEFAULT_MAX_COUNT 1000
+
+struct prefetch_batch {
+    struct IEnumWbemClassObject_prefetch *pf;
+    struct composite_context *c;
+    struct timeval sent;
+    BOOL done;
+    WERROR result;
+    uint32_t uCount;
+    uint32_t uReturned;
+    uint32_t size;
+    uint8_t *pData;
+    struct prefetch_batch *prev, *next;
+};
+
+struct IEnumWbemClassObject_prefetch {
+    struct IEnumWbemClassObject *d;
+    int32_t lTimeout;
+    uint32_t uCount;
+    uint32_t max_count;
+    uint32_t depth;
+    uint32_t outstanding;
+    BOOL eof;
+    struct prefetch_batch *batches;
+    struct composite_context *waiter;
+};
+
+static void prefetch_fill(struct IEnumWbemClassObject_prefetch *pf);
+static void prefetch_deliver(struct IEnumWbemClassObject_prefetch *pf);
+
+/*
+ * Pick the size of the next batch from the average object size and the
+ * round trip time of the batch that just arrived.
+ */
+static void prefetch_adapt(struct IEnumWbemClassObject_prefetch *pf,
+        struct prefetch_batch *b)
+{
+    uint32_t want;
+    double msec;
+
+    if (b->uReturned == 0) return;
+
+    want = PREFETCH_TARGET_BYTES / ((b->size / b->uReturned) + 1);
+    msec = timeval_elapsed(&b->sent) * 1000;
+    if (msec > PREFETCH_TARGET_MSEC && want > b->uCount / 2)
+        want = b->uCount / 2;
+
+    /* move half way towards the target to avoid oscillating */
+    want = (pf->uCount + want) / 2;
+    if (want < 1) want = 1;
+    if (want > pf->max_count) want = pf->max_count;
+    if (want != pf->uCount)
+    {
+        DEBUG(3, ("prefetch: batch size %u -> %u (%u bytes, %.0f ms)\n",
+                pf->uCount, want, b->size, msec));
+        pf->uCount = want;
+    }
+}
+
+static void prefetch_batch_continue(struct composite_context *ctx)
+{
+    struct prefetch_batch *b = talloc_get_type(ctx->async.private_data,
+            struct prefetch_batch);
+    struct IEnumWbemClassObject_prefetch *pf = b->pf;
+    struct smart_next_state *sn;
+    NTSTATUS status;
+
+    status = composite_wait(ctx);
+    if (NT_STATUS_IS_OK(status))
+    {
+        sn = talloc_get_type(ctx->private_data, struct smart_next_state);
+        b->result = sn->result;
+        b->uReturned = sn->uReturned;
+        b->size = sn->size;
+        b->pData = talloc_steal(b, sn->pData);
+    }
+    else
+    {
+        b->result = ntstatus_to_werror(status);
+    }
+    talloc_free(ctx);
+    b->c = NULL;
+    b->done = True;
+    pf->outstanding--;
+
+    /*
+     * A short batch means the enumeration is exhausted, unless the server
+     * merely timed out waiting for more objects.
+     */
+    if (!W_ERROR_IS_OK(b->result)
+        || (b->uReturned < b->uCount && W_ERROR_V(b->result) != WBEM_S_TIMEDOUT))
+    {
+        pf->eof = True;
+    }
+    prefetch_adapt(pf, b);
+
+    /* get the next request on the wire before the caller parses this one */
+    prefetch_fill(pf);
+    prefetch_deliver(pf);
+}
+
+static void prefetch_fill(struct IEnumWbemClassObject_prefetch *pf)
+{
+    struct IEnumWbemClassObject_data *ecod = pf->d->object_data;
+    struct prefetch_batch *b;
+
+    while (!pf->eof && pf->outstanding < pf->depth)
+    {
+        /*
+         * the first call negotiates the IWbemWCOSmartEnum interface, so
+         * nothing else can be sent until it has completed
+         */
+        if ((ecod == NULL || ecod->pSE == NULL) && pf->outstanding > 0)
+            break;
+
+        b = talloc_zero(pf, struct prefetch_batch);
+        if (b == NULL) break;
+        b->pf = pf;
+        b->uCount = pf->uCount;
+        b->sent = timeval_current();
+        b->c = IEnumWbemClassObject_SmartNext_send(pf->d, b, pf->lTimeout,
+                b->uCount);
+        if (b->c == NULL)
+        {
+            talloc_free(b);
+            break;
+        }
+        b->c->async.fn = prefetch_batch_continue;
+        b->c->async.private_data = b;
+        DLIST_ADD_END(pf->batches, b, struct prefetch_batch *);
+        pf->outstanding++;
+        ecod = pf->d->object_data;
+    }
+}
+
+/*
+ * Hand the oldest completed batch to a waiting caller, if there is one.
+ */
+static void prefetch_deliver(struct IEnumWbemClassObject_prefetch *pf)
+{
+    struct composite_context *c = pf->waiter;
+    struct prefetch_batch *b;
+
+    if (c == NULL) return;
+
+    /* empty batches (timeouts, the tail of the enumeration) carry nothing */
+    while ((b = pf->batches) != NULL && b->done && b->uReturned == 0
+           && (W_ERROR_IS_OK(b->result) || W_ERROR_V(b->result) == WBEM_S_FALSE
+               || W_ERROR_V(b->result) == WBEM_S_TIMEDOUT))
+    {
+        DLIST_REMOVE(pf->batches, b);
+        talloc_free(b);
+    }
+
+    b = pf->batches;
+    if (b == NULL)
+    {
+        if (!pf->eof) return;
+        /* enumeration finished and everything has been handed out */
+        pf->waiter = NULL;
+        talloc_set_destructor(c, NULL);
+        c->private_data = NULL;
+        composite_done(c);
+        return;
+    }
+    if (!b->done) return;
+
+    DLIST_REMOVE(pf->batches, b);
+    pf->waiter = NULL;
+    talloc_set_destructor(c, NULL);
+    talloc_steal(c, b);
+    c->private_data = b;
+    if (W_ERROR_IS_OK(b->result) || W_ERROR_V(b->result) == WBEM_S_FALSE
+        || W_ERROR_V(b->result) == WBEM_S_TIMEDOUT)
+    {
+        composite_done(c);
+    }
+    else
+    {
+        composite_error(c, werror_to_ntstatus(b->result));
+    }
+}
+
+/*
+ * A caller may free its fetch request before it completes; forget about it.
+ */
+static int prefetch_waiter_destructor(struct composite_context *c)
+{
+    struct IEnumWbemClassObject_prefetch *pf = talloc_get_type(
+            c->private_data, struct IEnumWbemClassObject_prefetch);
+
+    if (pf != NULL && pf->waiter == c) pf->waiter = NULL;
+    return 0;
+}
+
+/*
+ * Create a prefetching enumerator on top of IEnumWbemClassObject_SmartNext.
+ *
+ * uCount       initial number of objects requested per batch
+ * max_count    upper bound for the adaptive batch size (0 for the default)
+ * depth        number of Next calls kept outstanding (0 for the default of 2)
+ */
+struct IEnumWbemClassObject_prefetch *IEnumWbemClassObject_Prefetch_init(
+        struct IEnumWbemClassObject *d, TALLOC_CTX *mem_ctx,
+        int32_t lTimeout, uint32_t uCount, uint32_t max_count, uint32_t depth)
+{
+    struct IEnumWbemClassObject_prefetch *pf;
+
+    pf = talloc_zero(mem_ctx, struct IEnumWbemClassObject_prefetch);
+    if (pf == NULL) return NULL;
+
+    pf->d = d;
+    pf->lTimeout = lTimeout;
+    pf->max_count = max_count ? max_count : PREFETCH_DEFAULT_MAX_COUNT;
+    pf->uCount = uCount ? uCount : 1;
+    if (pf->uCount > pf->max_count) pf->uCount = pf->max_count;
+    pf->depth = depth ? depth : 2;
+
+    return pf;
+}
+
+/*
+ * Asynchronously fetch the next batch from a prefetching enumerator. Only one
+ * fetch may be waiting at any time.
+ */
+struct composite_context *IEnumWbemClassObject_PrefetchNext_send(
+        struct IEnumWbemClassObject_prefetch *pf, TALLOC_CTX *parent_ctx)
+{
+    struct composite_context *c = NULL;
+
+    c = composite_create(parent_ctx, pf->d->ctx->event_ctx);
+    if (c == NULL) return NULL;
+
+    if (pf->waiter != NULL)
+    {
+        composite_error(c, NT_STATUS_INVALID_PARAMETER_MIX);
+        return c;
+    }
+    pf->waiter = c;
+    c->private_data = pf;
+    talloc_set_destructor(c, prefetch_waiter_destructor);
+
+    prefetch_fill(pf);
+    prefetch_deliver(pf);
+    return c;
+}
+
+/*
+ * Receive the next batch of a prefetching enumerator. The object array is
+ * allocated on parent_ctx and the objects below it, so freeing the array
+ * releases the whole batch. WBEM_S_FALSE with no objects is returned once
+ * the enumeration is exhausted.
+ */
+WERROR IEnumWbemClassObject_PrefetchNext_recv(struct composite_context *c,
+        TALLOC_CTX *parent_ctx, struct WbemClassObject ***apObjects,
+        uint32_t *puReturned)
+{
+    struct prefetch_batch *b = NULL;
+    WERROR result = WERR_OK;
+    NTSTATUS status;
+
+    *apObjects = NULL;
+    *puReturned = 0;
+
+    status = composite_wait(c);
+    if (!NT_STATUS_IS_OK(status))
+    {
+        result = ntstatus_to_werror(status);
+    }
+    else if ((b = c->private_data) == NULL)
+    {
+        result = W_ERROR(WBEM_S_FALSE);
+    }
+    else if (b->pData != NULL && b->uReturned)
+    {
+        *apObjects = talloc_array(parent_ctx, struct WbemClassObject *,
+                b->uReturned);
+        if (*apObjects == NULL)
+        {
+            result = WERR_NOMEM;
+        }
+        else
+        {
+            status = WBEMDATA_Parse(b->pData, b->size, b->pf->d,
+                    b->uReturned, *apObjects, *apObjects);
+            if (NT_STATUS_IS_OK(status))
+            {
+                *puReturned = b->uReturned;
+            }
+            else
+            {
+                talloc_free(*apObjects);
+                *apObjects = NULL;
+            }
+            result = ntstatus_to_werror(status);
+        }
+    }
+
+    talloc_free(c);
+    return result;
+}
+
+/*
+ * Synchronously fetch the next batch from a prefetching enumerator.
+ */
+WERROR IEnumWbemClassObject_PrefetchNext(
+        struct IEnumWbemClassObject_prefetch *pf, TALLOC_CTX *mem_ctx,
+        struct WbemClassObject ***apObjects, uint32_t *puReturned)
+{
+    struct composite_context *c = IEnumWbemClassObject_PrefetchNext_send(pf,
+            mem_ctx);
+    return IEnumWbemClassObject_PrefetchNext_recv(c, mem_ctx, apObjects,
+            puReturned);
+}
+
+/*
+ * Push delivery of the objects of a semi-synchronous enumeration, such as the
+ * events of an ExecNotificationQuery, to callbacks in the style of an
+ * IWbemObjectSink. Rather than the caller polling, the sink keeps one Next
+ * call waiting at the server with a timeout of WBEM_SINK_WAIT_MSEC. For
+ * events a single object is asked for, so each one is passed on as soon as it
+ * occurs, and once one has arrived any backlog is drained without waiting in
+ * batches of up to uCount before the sink goes back to waiting.
+ *
+ * The wait stays below the DCE/RPC request timeout, after which the call
+ * would be abandoned and an event arriving late lost.
+ */
+#define WBEM_SINK_WAIT_MSEC 20000
+#define WBEM_SINK_DEFAULT_COUNT 100
+
+struct IEnumWbemClassObject_sink {
+    struct IEnumWbemClassObject *d;
+    BOOL owns_enum;                     /* release d when done */
+    BOOL notification;
+    uint32_t uCount;
+    BOOL draining;
+    BOOL busy;                          /* inside a callback */
+    BOOL cancelled;                     /* freed from a callback */
+    struct composite_context *c;        /* outstanding call */
+    const char *nspace;                 /* of the query, for the enumerator */
+    wbem_sink_indicate_fn indicate;
+    wbem_sink_status_fn set_status;
+    void *private_data;
+};
+
+static void sink_next(struct IEnumWbemClassObject_sink *sink);
+
+static void sink_release_continue(struct composite_context *ctx)
+{
+    (void)IUnknown_Release_recv(ctx);
+}
+
+static int sink_destructor(struct IEnumWbemClassObject_sink *sink)
+{
+    struct composite_context *c;
+
+    if (sink->busy)
+    {
+        /* finish the callback first, sink_callback_done frees us */
+        sink->cancelled = True;
+        return -1;
+    }
+
+    talloc_free(sink->c);
+    sink->c = NULL;
+    if (sink->owns_enum && sink->d != NULL)
+    {
+        c = IUnknown_Release_send((struct IUnknown *)sink->d, NULL);
+        if (c != NULL) c->async.fn = sink_release_continue;
+    }
+    return 0;
+}
+
+/*
+ * Returns True if the sink was freed by the callback that just returned.
+ */
+static BOOL sink_callback_done(struct IEnumWbemClassObject_sink *sink)
+{
+    sink->busy = False;
+    if (!sink->cancelled) return False;
+    sink->cancelled = False;
+    talloc_free(sink);
+    return True;
+}
+
+/*
+ * Report the end of the enumeration or a failure. The sink is idle from then
+ * on and only waits to be freed.
+ */
+static void sink_finish(struct IEnumWbemClassObject_sink *sink, WERROR result)
+{
+    if (sink->set_status == NULL) return;
+    sink->busy = True;
+    sink->set_status(sink->private_data, result);
+    sink_callback_done(sink);
+}
+
+static void sink_next_continue(struct composite_context *ctx)
+{
+    struct IEnumWbemClassObject_sink *sink = talloc_get_type(
+            ctx->async.private_data, struct IEnumWbemClassObject_sink);
+    struct smart_next_state *sn;
+    struct WbemClassObject **objects;
+    TALLOC_CTX *arena;
+    uint32_t uCount;
+    WERROR result;
+    NTSTATUS status;
+
+    sink->c = NULL;
+    status = composite_wait(ctx);
+    if (!NT_STATUS_IS_OK(status))
+    {
+        talloc_free(ctx);
+        sink_finish(sink, ntstatus_to_werror(status));
+        return;
+    }
+    sn = talloc_get_type(ctx->private_data, struct smart_next_state);
+    result = sn->result;
+    uCount = sn->uCount;
+
+    if (sn->uReturned > 0 && sn->pData != NULL)
+    {
+        arena = WBEMDATA_BatchArena(sink);
+        objects = talloc_array(arena, struct WbemClassObject *, sn->uReturned);
+        if (objects == NULL)
+        {
+            talloc_free(arena);
+            talloc_free(ctx);
+            sink_finish(sink, WERR_NOMEM);
+            return;
+        }
+        status = WBEMDATA_Parse(sn->pData, sn->size, sink->d, sn->uReturned,
+                objects, arena);
+        if (!NT_STATUS_IS_OK(status))
+        {
+            talloc_free(arena);
+            talloc_free(ctx);
+            sink_finish(sink, ntstatus_to_werror(status));
+            return;
+        }
+
+        sink->busy = True;
+        sink->indicate(sink->private_data, sn->uReturned, objects);
+        talloc_free(arena);
+
+        /* ctx went along with the sink */
+        if (sink_callback_done(sink)) return;
+    }
+
+    /*
+     * A short answer without a timeout is the end of the enumeration. Event
+     * queries never end, a short drain just means the backlog is gone.
+     */
+    if (W_ERROR_V(result) == WBEM_S_TIMEDOUT)
+    {
+        sink->draining = False;
+    }
+    else if (sn->uReturned < uCount && !sink->notification)
+    {
+        talloc_free(ctx);
+        sink_finish(sink, WERR_OK);
+        return;
+    }
+    else
+    {
+        sink->draining = (sn->uReturned == uCount || !sink->draining);
+    }
+    talloc_free(ctx);
+
+    sink_next(sink);
+}
+
+static void sink_next(struct IEnumWbemClassObject_sink *sink)
+{
+    if (sink->draining)
+        sink->c = IEnumWbemClassObject_SmartNext_send(sink->d, sink, 0,
+                sink->uCount);
+    else
+        sink->c = IEnumWbemClassObject_SmartNext_send(sink->d, sink,
+                WBEM_SINK_WAIT_MSEC, sink->notification ? 1 : sink->uCount);
+    if (sink->c == NULL)
+    {
+        sink_finish(sink, WERR_NOMEM);
+        return;
+    }
+    sink->c->async.fn = sink_next_continue;
+    sink->c->async.private_data = sink;
+}
+
+static struct IEnumWbemClassObject_sink *sink_create(TALLOC_CTX *mem_ctx,
+        uint32_t uCount, wbem_sink_indicate_fn indicate,
+        wbem_sink_status_fn set_status, void *private_data)
+{
+    struct IEnumWbemClassObject_sink *sink;
+
+    sink = talloc_zero(mem_ctx, struct IEnumWbemClassObject_sink);
+    if (sink == NULL) return NULL;
+
+    sink->uCount = uCount ? uCount : WBEM_SINK_DEFAULT_COUNT;
+    sink->indicate = indicate;
+    sink->set_status = set_status;
+    sink->private_data = private_data;
+    talloc_set_destructor(sink, sink_destructor);
+    return sink;
+}
+
+/*
+ * Deliver the objects of an existing enumerator to indicate as they become
+ * available. The objects passed to indicate are freed when it returns unless
+ * it steals them. set_status is called once the enumeration has ended or
+ * failed. Freeing the sink, from a callback too, stops the delivery; the
+ * enumerator stays with the caller.
+ */
+struct IEnumWbemClassObject_sink *IEnumWbemClassObject_Sink_init(
+        struct IEnumWbemClassObject *d, TALLOC_CTX *mem_ctx, BOOL notification,
+        uint32_t uCount, wbem_sink_indicate_fn indicate,
+        wbem_sink_status_fn set_status, void *private_data)
+{
+    struct IEnumWbemClassObject_sink *sink;
+
+    sink = sink_create(mem_ctx, uCount, indicate, set_status, private_data);
+    if (sink == NULL) return NULL;
+    sink->d = d;
+    sink->notification = notification;
+
+    sink_next(sink);
+    return sink;
+}
+
+static void sink_query_continue(struct composite_context *ctx)
+{
+    struct IEnumWbemClassObject_sink *sink = talloc_get_type(
+            ctx->async.private_data, struct IEnumWbemClassObject_sink);
+    struct IEnumWbemClassObject *pEnum = NULL;
+    WERROR result;
+
+    sink->c = NULL;
+    if (sink->notification)
+        result = IWbemServices_ExecNotificationQuery_recv(ctx, &pEnum);
+    else
+        result = IWbemServices_ExecQuery_recv(ctx, &pEnum);
+    if (!W_ERROR_IS_OK(result))
+    {
+        sink_finish(sink, result);
+        return;
+    }
+
+    sink->d = talloc_steal(sink, pEnum);
+    sink->owns_enum = True;
+    if (sink->nspace != NULL)
+        IEnumWbemClassObject_SetNamespace(sink->d, sink->nspace);
+    sink_next(sink);
+}
+
+/*
+ * Run a query and deliver its results to a sink, the asynchronous
+ * counterpart of IWbemServices::ExecQueryAsync and, with notification set,
+ * ExecNotificationQueryAsync. The enumerator is released when the sink is
+ * freed.
+ */
+struct IEnumWbemClassObject_sink *WBEM_ExecQuerySink(
+        struct IWbemServices *services, TALLOC_CTX *mem_ctx,
+        const char *language, const char *query, BOOL notification,
+        uint32_t uCount, wbem_sink_indicate_fn indicate,
+        wbem_sink_status_fn set_status, void *private_data)
+{
+    struct IEnumWbemClassObject_sink *sink;
+    int32_t flags = WBEM_FLAG_RETURN_IMMEDIATELY | WBEM_FLAG_FORWARD_ONLY;
+
+    sink = sink_create(mem_ctx, uCount, indicate, set_status, private_data);
+    if (sink == NULL) return NULL;
+    sink->notification = notification;
+    if (WBEM_ServicesNamespace(services) != NULL)
+        sink->nspace = talloc_strdup(sink, WBEM_ServicesNamespace(services));
+
+    if (notification)
+        sink->c = IWbemServices_ExecNotificationQuery_send(services, sink,
+                language, query, flags, NULL);
+    else
+        sink->c = IWbemServices_ExecQuery_send(services, sink, language,
+                query, flags | WBEM_FLAG_ENSURE_LOCATABLE, NULL);
+    if (sink->c == NULL)
+    {
+        talloc_free(sink);
+        return NULL;
+    }
+    sink->c->async.fn = sink_query_continue;
+    sink->c->async.private_data = sink;
+    return sink;
+}
+
 NTSTATUS dcom_proxy_IWbemClassObject_init()
 {
 	struct GUID clsid;
@@ -33,6 +33,44 @@ extern struct composite_context *WBEM_ConnectServer_send(struct com_context *ctx
         const char *user, const char *password, const char *locale,
         uint32_t flags, const char *authority, struct IWbemContext* wbem_ctx);
 
+extern const char *WBEM_ServicesNamespace(struct IWbemServices *services);
+
+struct wbem_session_pool_stats {
+        uint32_t sessions;
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t reconnects;
+        uint32_t evictions;
+        uint32_t failures;
+};
+
+extern struct composite_context *WBEM_SessionPool_Connect_send(
+        struct com_context *ctx, TALLOC_CTX *parent_ctx, const char *server,
+        const char *nspace, const char *user, const char *password,
+        const char *locale, uint32_t flags, const char *authority,
+        struct IWbemContext *wbem_ctx);
+
+extern WERROR WBEM_SessionPool_Connect_recv(struct composite_context *c,
+        struct IWbemServices **services);
+
+extern void WBEM_SessionPool_Release(struct com_context *ctx,
+        struct IWbemServices *services, WERROR result);
+
+extern struct composite_context *WBEM_SessionPool_ExecQuery_send(
+        struct com_context *ctx, TALLOC_CTX *parent_ctx, const char *server,
+        const char *nspace, const char *user, const char *password,
+        const char *language, const char *query, int32_t flags);
+
+extern WERROR WBEM_SessionPool_ExecQuery_recv(struct composite_context *c,
+        TALLOC_CTX *parent_ctx, struct IWbemServices **services,
+        struct IEnumWbemClassObject **ppEnum);
+
+extern void WBEM_SessionPool_SetLimits(struct com_context *ctx,
+        uint32_t max_sessions, uint32_t idle_timeout);
+extern void WBEM_SessionPool_Stats(struct com_context *ctx,
+        struct wbem_session_pool_stats *stats);
+extern void WBEM_SessionPool_Flush(struct com_context *ctx);
+
 extern struct composite_context *IEnumWbemClassObject_SmartNext_send(
         struct IEnumWbemClassObject *d, TALLOC_CTX *parent_ctx,
         int32_t lTimeout, uint32_t uCount);
@@ -45,6 +83,65 @@ extern WERROR IEnumWbemClassObject_SmartNext(struct IEnumWbemClassObject *d,
         TALLOC_CTX *mem_ctx, int32_t lTimeout, uint32_t uCount,
         struct WbemClassObject **apObjects, uint32_t *puReturned);
 
+extern TALLOC_CTX *WBEMDATA_BatchArena(TALLOC_CTX *mem_ctx);
+
+struct IEnumWbemClassObject_prefetch;
+
+extern struct IEnumWbemClassObject_prefetch *IEnumWbemClassObject_Prefetch_init(
+        struct IEnumWbemClassObject *d, TALLOC_CTX *mem_ctx,
+        int32_t lTimeout, uint32_t uCount, uint32_t max_count, uint32_t depth);
+
+extern struct composite_context *IEnumWbemClassObject_PrefetchNext_send(
+        struct IEnumWbemClassObject_prefetch *pf, TALLOC_CTX *parent_ctx);
+
+extern WERROR IEnumWbemClassObject_PrefetchNext_recv(struct composite_context *c,
+        TALLOC_CTX *parent_ctx, struct WbemClassObject ***apObjects,
+        uint32_t *puReturned);
+
+extern WERROR IEnumWbemClassObject_PrefetchNext(
+        struct IEnumWbemClassObject_prefetch *pf, TALLOC_CTX *mem_ctx,
+        struct WbemClassObject ***apObjects, uint32_t *puReturned);
+
+struct IEnumWbemClassObject_sink;
+
+typedef void (*wbem_sink_indicate_fn)(void *private_data, uint32_t count,
+        struct WbemClassObject **objects);
+typedef void (*wbem_sink_status_fn)(void *private_data, WERROR result);
+
+extern struct IEnumWbemClassObject_sink *IEnumWbemClassObject_Sink_init(
+        struct IEnumWbemClassObject *d, TALLOC_CTX *mem_ctx, BOOL notification,
+        uint32_t uCount, wbem_sink_indicate_fn indicate,
+        wbem_sink_status_fn set_status, void *private_data);
+
+extern struct IEnumWbemClassObject_sink *WBEM_ExecQuerySink(
+        struct IWbemServices *services, TALLOC_CTX *mem_ctx,
+        const char *language, const char *query, BOOL notification,
+        uint32_t uCount, wbem_sink_indicate_fn indicate,
+        wbem_sink_status_fn set_status, void *private_data);
+
+/* decode instance properties on first access, see IEnumWbemClassObject_SetDecodeFlags */
+#define WBEMDATA_DECODE_LAZY 0x00000001
+extern WERROR IEnumWbemClassObject_SetDecodeFlags(struct IEnumWbemClassObject *d,
+        uint32_t flags);
+extern WERROR WbemClassObject_Decode(struct WbemClassObject *wco);
+extern const char **WBEMDATA_QueryColumns(TALLOC_CTX *mem_ctx, const char *query);
+extern WERROR IEnumWbemClassObject_SetProjection(struct IEnumWbemClassObject *d,
+        const char **names);
+extern WERROR IEnumWbemClassObject_SetNamespace(struct IEnumWbemClassObject *d,
+        const char *nspace);
+extern const uint8_t *IEnumWbemClassObject_GetProjection(
+        struct IEnumWbemClassObject *d, const struct WbemClass *cls);
+struct wbem_class_cache_stats {
+        uint32_t entries;
+        uint32_t hits;
+        uint32_t misses;
+        uint32_t evictions;
+};
+extern struct WbemClass *WBEMDATA_ClassCacheLookup(struct com_context *ctx,
+        const char *host, const char *nspace, const char *name);
+extern void WBEMDATA_ClassCacheStats(struct com_context *ctx,
+        struct wbem_class_cache_stats *stats);
+extern void WBEMDATA_ClassCacheFlush(struct com_context *ctx);
 extern const char *wmi_errstr(WERROR werror);
 
 extern WERROR IWbemClassObject_GetMethod(struct IWbemClassObject *d,
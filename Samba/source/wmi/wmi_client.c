@@ -0,0 +1,283 @@
+/*
+   Asynchronous WMI client API
+
+   Copyright (C) Zenoss, Inc. 2008
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+#include "includes.h"
+#include "librpc/gen_ndr/com_dcom.h"
+#include "lib/com/dcom/dcom.h"
+#include "libcli/composite/composite.h"
+#include "lib/events/events.h"
+#include "lib/util/dlinklist.h"
+#include "lib/com/com.h"
+#include "wmi/wmi.h"
+#include "wmi/wmi_client.h"
+
+struct wmi_client
+{
+    struct event_context *ev;
+    struct com_context *ctx;
+    BOOL external;                      /* driven by reactor functions */
+};
+
+struct wmi_session
+{
+    struct wmi_client *client;
+    struct composite_context *c;        /* the pool connect, while opening */
+    struct IWbemServices *services;     /* pooled, handed back on close */
+    WERROR result;                      /* last failure, for the pool */
+    wmi_session_open_fn fn;
+    void *private_data;
+    struct wmi_query *queries;
+    BOOL busy;                          /* in the open callback */
+    BOOL closed;                        /* closed from the open callback */
+};
+
+struct wmi_query
+{
+    struct wmi_session *session;
+    struct IEnumWbemClassObject_sink *sink;
+    wmi_query_objects_fn objects_fn;
+    wmi_query_done_fn done_fn;
+    void *private_data;
+    BOOL busy;                          /* in the done callback */
+    struct wmi_query *prev, *next;
+};
+
+struct wmi_client *wmi_client_init(TALLOC_CTX *mem_ctx,
+        struct reactor_functions *funcs)
+{
+    struct wmi_client *client;
+
+    async_wmi_lib_init();
+
+    client = talloc_zero(mem_ctx, struct wmi_client);
+    if (client == NULL) return NULL;
+
+    client->external = (funcs != NULL);
+    if (client->external)
+        client->ev = zenoss_event_context_init_epoll(client, funcs);
+    else
+        client->ev = event_context_init(client);
+    if (client->ev == NULL)
+    {
+        talloc_free(client);
+        return NULL;
+    }
+
+    /* allocated after the event context so that it goes first */
+    com_init_ctx(&client->ctx, client->ev);
+    if (client->ctx == NULL)
+    {
+        talloc_free(client);
+        return NULL;
+    }
+    talloc_steal(client, client->ctx);
+    dcom_client_init(client->ctx, NULL);
+
+    return client;
+}
+
+int wmi_client_loop_once(struct wmi_client *client)
+{
+    return event_loop_once(client->ev);
+}
+
+void wmi_client_fd_ready(struct wmi_client *client, int fd, uint16_t flags)
+{
+    if (flags & EVENT_FD_READ)
+        zenoss_read_ready(client->ev, fd);
+    if (flags & EVENT_FD_WRITE)
+        zenoss_write_ready(client->ev, fd);
+}
+
+struct timeval wmi_client_next_timeout(struct wmi_client *client)
+{
+    struct timeval tv;
+
+    zenoss_get_next_timeout(client->ev, &tv);
+    return tv;
+}
+
+struct com_context *wmi_client_com_context(struct wmi_client *client)
+{
+    return client->ctx;
+}
+
+static int wmi_session_destructor(struct wmi_session *s)
+{
+    if (s->busy)
+    {
+        /* wmi_session_open_continue frees us after the callback */
+        s->closed = True;
+        return -1;
+    }
+
+    while (s->queries)
+        talloc_free(s->queries);
+    if (s->services != NULL)
+        WBEM_SessionPool_Release(s->client->ctx, s->services, s->result);
+    return 0;
+}
+
+static void wmi_session_open_continue(struct composite_context *ctx)
+{
+    struct wmi_session *s = talloc_get_type(ctx->async.private_data,
+            struct wmi_session);
+    WERROR result;
+
+    s->c = NULL;
+    result = WBEM_SessionPool_Connect_recv(ctx, &s->services);
+    if (!W_ERROR_IS_OK(result))
+    {
+        DEBUG(2, ("wmi_session_open: %s\n", win_errstr(result)));
+        s->services = NULL;
+    }
+
+    s->busy = True;
+    s->fn(s->private_data, s, result);
+    s->busy = False;
+
+    if (s->closed || !W_ERROR_IS_OK(result))
+        talloc_free(s);
+}
+
+struct wmi_session *wmi_session_open(struct wmi_client *client,
+        const char *host, const char *nspace, const char *user,
+        const char *password, wmi_session_open_fn fn, void *private_data)
+{
+    struct wmi_session *s;
+
+    s = talloc_zero(client, struct wmi_session);
+    if (s == NULL) return NULL;
+
+    s->client = client;
+    s->result = WERR_OK;
+    s->fn = fn;
+    s->private_data = private_data;
+    talloc_set_destructor(s, wmi_session_destructor);
+
+    s->c = WBEM_SessionPool_Connect_send(client->ctx, s, host,
+            nspace ? nspace : "root\\cimv2", user, password, NULL, 0, NULL,
+            NULL);
+    if (s->c == NULL)
+    {
+        talloc_free(s);
+        return NULL;
+    }
+    s->c->async.fn = wmi_session_open_continue;
+    s->c->async.private_data = s;
+    return s;
+}
+
+struct IWbemServices *wmi_session_services(struct wmi_session *session)
+{
+    return session->services;
+}
+
+void wmi_session_close(struct wmi_session *session)
+{
+    talloc_free(session);
+}
+
+int wmi_session_set_memlimit(struct wmi_session *session, size_t max_bytes)
+{
+    return talloc_set_memlimit(session, max_bytes);
+}
+
+int wmi_session_memstats(struct wmi_session *session,
+        struct talloc_memstats *stats)
+{
+    return talloc_get_memstats(session, stats);
+}
+
+static int wmi_query_destructor(struct wmi_query *q)
+{
+    if (q->session != NULL)
+    {
+        DLIST_REMOVE(q->session->queries, q);
+        q->session = NULL;
+    }
+    /* wmi_query_status frees us after the callback */
+    return q->busy ? -1 : 0;
+}
+
+static void wmi_query_indicate(void *private_data, uint32_t count,
+        struct WbemClassObject **objects)
+{
+    struct wmi_query *q = talloc_get_type(private_data, struct wmi_query);
+
+    q->objects_fn(q->private_data, q, count, objects);
+}
+
+static void wmi_query_status(void *private_data, WERROR result)
+{
+    struct wmi_query *q = talloc_get_type(private_data, struct wmi_query);
+
+    if (!W_ERROR_IS_OK(result) && q->session != NULL)
+        q->session->result = result;
+
+    q->busy = True;
+    if (q->done_fn != NULL)
+        q->done_fn(q->private_data, q, result);
+    q->busy = False;
+
+    talloc_free(q);
+}
+
+struct wmi_query *wmi_query_start(struct wmi_session *session,
+        const char *query, uint32_t flags, uint32_t batch_size,
+        wmi_query_objects_fn objects_fn, wmi_query_done_fn done_fn,
+        void *private_data)
+{
+    struct wmi_query *q;
+
+    if (session->services == NULL) return NULL;
+
+    q = talloc_zero(session, struct wmi_query);
+    if (q == NULL) return NULL;
+
+    q->session = session;
+    q->objects_fn = objects_fn;
+    q->done_fn = done_fn;
+    q->private_data = private_data;
+    DLIST_ADD(session->queries, q);
+    talloc_set_destructor(q, wmi_query_destructor);
+
+    q->sink = WBEM_ExecQuerySink(session->services, q, "WQL", query,
+            (flags & WMI_QUERY_NOTIFICATION) != 0, batch_size,
+            wmi_query_indicate, wmi_query_status, q);
+    if (q->sink == NULL)
+    {
+        talloc_free(q);
+        return NULL;
+    }
+    return q;
+}
+
+void wmi_query_cancel(struct wmi_query *query)
+{
+    talloc_free(query);
+}
+
+WERROR wmi_object_get(struct WbemClassObject *object, TALLOC_CTX *mem_ctx,
+        const char *name, union CIMVAR *value,
+        enum CIMTYPE_ENUMERATION *cimtype)
+{
+    return WbemClassObject_Get(object, mem_ctx, name, 0, value, cimtype,
+            NULL);
+}
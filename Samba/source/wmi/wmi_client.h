@@ -0,0 +1,165 @@
+#ifndef WMI_CLIENT_H_
+#define WMI_CLIENT_H_
+/*
+   Asynchronous WMI client API
+
+   Copyright (C) Zenoss, Inc. 2008
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/*
+ * A callback based interface to the asynchronous WMI calls for collectors
+ * written in C, so that they do not need to drive the composite contexts of
+ * the DCOM and WBEM layers themselves.
+ *
+ * A client owns an event context and a COM context, and is used from one
+ * thread. Its events are processed in one of two ways:
+ *
+ *  - by the client itself: pass NULL to wmi_client_init() and call
+ *    wmi_client_loop_once() whenever the collector is ready to wait for
+ *    WMI traffic.
+ *
+ *  - by the collector's own poll loop: pass reactor functions to
+ *    wmi_client_init(). update_reactor_callback(fd, flags) is called whenever
+ *    the client wants to wait on a descriptor (flags is a mask of
+ *    EVENT_FD_READ and EVENT_FD_WRITE, 0 to stop watching it). Where epoll is
+ *    available that is a single epoll descriptor for all of the client's
+ *    sockets, otherwise every socket. The collector polls those descriptors,
+ *    calls wmi_client_fd_ready() for the ones that are ready and uses
+ *    wmi_client_next_timeout() as the longest time to wait.
+ *    reactor_once() is only called by the blocking calls of the library, which
+ *    an asynchronous collector does not use.
+ *
+ * Sessions and queries are talloc children of the client; freeing the client
+ * closes everything. Callbacks may close the session or query they are called
+ * for.
+ */
+
+#include "wmi/zenoss_events.h"
+
+struct wmi_client;
+struct wmi_session;
+struct wmi_query;
+struct WbemClassObject;
+
+/*
+ * Called when a session has been opened, or could not be. On failure the
+ * session is freed once the callback returns.
+ */
+typedef void (*wmi_session_open_fn)(void *private_data,
+        struct wmi_session *session, WERROR result);
+
+/*
+ * Called with each batch of objects returned by a query. The objects and the
+ * array are only valid until the callback returns; use talloc_steal() or
+ * talloc_reference() on an object to keep it.
+ */
+typedef void (*wmi_query_objects_fn)(void *private_data,
+        struct wmi_query *query, uint32_t count,
+        struct WbemClassObject **objects);
+
+/*
+ * Called once a query has ended, with WERR_OK when all objects have been
+ * delivered. The query is freed once the callback returns.
+ */
+typedef void (*wmi_query_done_fn)(void *private_data,
+        struct wmi_query *query, WERROR result);
+
+/* the query is an event query, results are delivered as the events occur */
+#define WMI_QUERY_NOTIFICATION	0x00000001
+
+/*
+ * Create a client. funcs is NULL for a client that runs its own event loop,
+ * or the functions to hook it into the collector's loop.
+ */
+extern struct wmi_client *wmi_client_init(TALLOC_CTX *mem_ctx,
+        struct reactor_functions *funcs);
+
+/* Wait for and process one event. Only for clients without reactor functions. */
+extern int wmi_client_loop_once(struct wmi_client *client);
+
+/*
+ * Process a socket reported ready by the collector's poll loop. Only for
+ * clients with reactor functions, as is wmi_client_next_timeout().
+ */
+extern void wmi_client_fd_ready(struct wmi_client *client, int fd,
+        uint16_t flags);
+
+/*
+ * Run the timers that are due and return how long the collector may wait for
+ * the next one.
+ */
+extern struct timeval wmi_client_next_timeout(struct wmi_client *client);
+
+/* The COM context of the client, for use with the rest of the WMI library. */
+extern struct com_context *wmi_client_com_context(struct wmi_client *client);
+
+/*
+ * Open a session to a namespace on a host. Sessions for the same host,
+ * namespace and credentials share one connection through the session pool.
+ * user and password may be NULL to use the default credentials.
+ */
+extern struct wmi_session *wmi_session_open(struct wmi_client *client,
+        const char *host, const char *nspace, const char *user,
+        const char *password, wmi_session_open_fn fn, void *private_data);
+
+/* The IWbemServices pointer of an open session, owned by the session. */
+extern struct IWbemServices *wmi_session_services(struct wmi_session *session);
+
+/*
+ * Close a session, or abandon its opening. Queries still running on it are
+ * cancelled without their done callbacks being called.
+ */
+extern void wmi_session_close(struct wmi_session *session);
+
+/*
+ * Count the memory used by the queries of a session, and fail the queries
+ * that would take it over max_bytes (0 to only count) with WERR_NOMEM.
+ * Result batches are allocated 64k at a time, so a limit needs to be well
+ * above that. Returns -1 if out of memory.
+ */
+extern int wmi_session_set_memlimit(struct wmi_session *session,
+        size_t max_bytes);
+
+/*
+ * Copy out the counters of a session given to wmi_session_set_memlimit(),
+ * returns -1 for other sessions.
+ */
+extern int wmi_session_memstats(struct wmi_session *session,
+        struct talloc_memstats *stats);
+
+/*
+ * Start a WQL query on an open session. Batches of up to batch_size objects
+ * (0 for the default) are passed to objects_fn as they are fetched, then
+ * done_fn is called. Returns NULL if the query could not be started.
+ */
+extern struct wmi_query *wmi_query_start(struct wmi_session *session,
+        const char *query, uint32_t flags, uint32_t batch_size,
+        wmi_query_objects_fn objects_fn, wmi_query_done_fn done_fn,
+        void *private_data);
+
+/* Stop a query. done_fn is not called. */
+extern void wmi_query_cancel(struct wmi_query *query);
+
+/*
+ * Get a property of an object passed to a wmi_query_objects_fn. The value is
+ * allocated on mem_ctx where it needs memory.
+ */
+extern WERROR wmi_object_get(struct WbemClassObject *object,
+        TALLOC_CTX *mem_ctx, const char *name, union CIMVAR *value,
+        enum CIMTYPE_ENUMERATION *cimtype);
+
+#endif /* WMI_CLIENT_H_ */
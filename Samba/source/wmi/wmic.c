@@ -29,6 +29,11 @@
 #include "librpc/gen_ndr/com_dcom.h"
 #include "librpc/rpc/dcerpc_table.h"
 
+#include "lib/events/events.h"
+#include "lib/util/dlinklist.h"
+#include "libcli/composite/composite.h"
+#include "system/filesys.h"
+
 #include "lib/com/dcom/dcom.h"
 #include "lib/com/proto.h"
 #include "lib/com/dcom/proto.h"
@@ -45,6 +50,10 @@ struct program_args {
     char *query;
     char *ns;
     char *delim;
+    char *format;
+    char *hosts_file;
+    int max_inflight;
+    int host_timeout;
 };
 
 static void parse_args(int argc, char *argv[], struct program_args *pmyargs)
@@ -64,14 +73,22 @@ static void parse_args(int argc, char *argv[], struct program_args *pmyargs)
         {"namespace", 0, POPT_ARG_STRING, &pmyargs->ns, 0,
          "WMI namespace, default to root\\cimv2", 0},
 	{"delimiter", 0, POPT_ARG_STRING, &pmyargs->delim, 0,
-	 "delimiter to use when querying multiple values, default to '|'", 0},
+	 "delimiter to use when querying multiple values, default to '|' (',' for csv)", 0},
+	{"format", 0, POPT_ARG_STRING, &pmyargs->format, 0,
+	 "output format: line (default), csv, json or influx", "FORMAT"},
+	{"hosts-file", 0, POPT_ARG_STRING, &pmyargs->hosts_file, 0,
+	 "query every host listed in FILE ('-' for stdin), one per line", "FILE"},
+	{"max-inflight", 0, POPT_ARG_INT, &pmyargs->max_inflight, 0,
+	 "maximum number of hosts queried concurrently, default to 32", 0},
+	{"host-timeout", 0, POPT_ARG_INT, &pmyargs->host_timeout, 0,
+	 "seconds allowed per host before it is abandoned, default to 120, 0 for no limit", 0},
 	POPT_TABLEEND
     };
 
     pc = poptGetContext("wmi", argc, (const char **) argv,
 	        long_options, POPT_CONTEXT_KEEP_FIRST);
 
-    poptSetOtherOptionHelp(pc, "//host query\n\nExample: wmic -U [domain/]adminuser%password //host \"select * from Win32_ComputerSystem\"");
+    poptSetOtherOptionHelp(pc, "//host query\n       --hosts-file=FILE query\n\nExample: wmic -U [domain/]adminuser%password //host \"select * from Win32_ComputerSystem\"");
 
     while ((opt = poptGetNextOpt(pc)) != -1) {
 	poptPrintUsage(pc, stdout, 0);
@@ -89,6 +106,18 @@ static void parse_args(int argc, char *argv[], struct program_args *pmyargs)
 	}
     }
 
+    /* in fan-out mode the hosts come from --hosts-file, so only the query is given */
+    if (pmyargs->hosts_file) {
+	if (argc_new != 2) {
+	    poptPrintUsage(pc, stdout, 0);
+	    poptFreeContext(pc);
+	    exit(1);
+	}
+	pmyargs->query = argv_new[1];
+	poptFreeContext(pc);
+	return;
+    }
+
     if (argc_new != 3
 	|| strncmp(argv_new[1], "//", 2) != 0) {
 	poptPrintUsage(pc, stdout, 0);
@@ -109,73 +138,901 @@ static void parse_args(int argc, char *argv[], struct program_args *pmyargs)
 			    DEBUG(1, ("OK   : %s\n", msg)); \
 			}
 
-#define RETURN_CVAR_ARRAY_STR(fmt, arr) {\
-        uint32_t i;\
-	char *r;\
+/*
+ * Output stage. Values are formatted straight into one reusable buffer that
+ * is written out with write(2) when full, so printing a result set does no
+ * per-value allocation and memory does not grow with the size of the result.
+ */
+enum wmic_format {
+	WMIC_FORMAT_LINE = 0,
+	WMIC_FORMAT_CSV,
+	WMIC_FORMAT_JSON,
+	WMIC_FORMAT_INFLUX
+};
+
+/* how text is escaped on its way into the buffer */
+enum wmic_escape {
+	WMIC_ESC_NONE = 0,
+	WMIC_ESC_CSV,		/* inside a quoted CSV field */
+	WMIC_ESC_JSON,		/* inside a JSON string */
+	WMIC_ESC_INFLUX_STRING,	/* inside a quoted line-protocol field value */
+	WMIC_ESC_INFLUX_KEY,	/* line-protocol tag key/value or field key */
+	WMIC_ESC_INFLUX_NAME	/* line-protocol measurement */
+};
+
+#define WMIC_OUTBUF_SIZE 65536
+
+struct wmic_output {
+	enum wmic_format format;
+	const char *delim;
+	size_t delim_len;
+	int fd;
+	BOOL flush_each_batch;
+	BOOL failed;
+	char *csv_class;	/* class of the last CSV header row */
+	size_t len;
+	char buf[WMIC_OUTBUF_SIZE];
+};
+
+static struct wmic_output *wmic_output_init(TALLOC_CTX *mem_ctx,
+					    enum wmic_format format,
+					    const char *delim, int fd)
+{
+	struct wmic_output *o;
+
+	o = talloc(mem_ctx, struct wmic_output);
+	if (o == NULL) return NULL;
+	o->format = format;
+	o->delim = delim;
+	o->delim_len = strlen(delim);
+	o->fd = fd;
+	/* keep an interactive terminal up to date, batch everything else */
+	o->flush_each_batch = isatty(fd) ? True : False;
+	o->failed = False;
+	o->csv_class = NULL;
+	o->len = 0;
+	return o;
+}
+
+static void wmic_write_fd(struct wmic_output *o, const char *p, size_t n)
+{
+	while (n > 0 && !o->failed) {
+		ssize_t ret = write(o->fd, p, n);
+		if (ret == -1) {
+			if (errno == EINTR) continue;
+			o->failed = True;
+			break;
+		}
+		p += ret;
+		n -= ret;
+	}
+}
+
+static void wmic_flush(struct wmic_output *o)
+{
+	wmic_write_fd(o, o->buf, o->len);
+	o->len = 0;
+}
+
+static void wmic_write(struct wmic_output *o, const char *p, size_t n)
+{
+	if (o->len + n > WMIC_OUTBUF_SIZE) {
+		wmic_flush(o);
+		if (n > WMIC_OUTBUF_SIZE) {
+			wmic_write_fd(o, p, n);
+			return;
+		}
+	}
+	memcpy(o->buf + o->len, p, n);
+	o->len += n;
+}
+
+static inline void wmic_putc(struct wmic_output *o, char c)
+{
+	if (o->len == WMIC_OUTBUF_SIZE) wmic_flush(o);
+	o->buf[o->len++] = c;
+}
+
+static inline void wmic_puts(struct wmic_output *o, const char *s)
+{
+	wmic_write(o, s, strlen(s));
+}
+
+static void wmic_put_uint(struct wmic_output *o, uint64_t v)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+
+	do {
+		*--p = '0' + (v % 10);
+		v /= 10;
+	} while (v);
+	wmic_write(o, p, tmp + sizeof(tmp) - p);
+}
+
+static void wmic_put_int(struct wmic_output *o, int64_t v)
+{
+	if (v < 0) {
+		wmic_putc(o, '-');
+		wmic_put_uint(o, -(uint64_t)v);
+	} else {
+		wmic_put_uint(o, v);
+	}
+}
+
+/* CIM reals are carried as their IEEE bit patterns */
+static inline double wmic_real32(uint32_t bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static inline double wmic_real64(uint64_t bits)
+{
+	double d;
+	memcpy(&d, &bits, sizeof(d));
+	return d;
+}
+
+/* x - x is 0 for every finite x, NaN for infinities and NaN */
+static inline BOOL wmic_real_is_finite(double d)
+{
+	return (d - d) == 0 ? True : False;
+}
+
+/*
+ * Line and CSV output print reals exactly as wmic always has, as "%f" of the
+ * integer value of their bits, so existing parsers see no change. JSON and
+ * line protocol print the IEEE value in the shortest form that round-trips.
+ * JSON has no nan or inf, so non-finite values print as null there, also
+ * inside arrays.
+ */
+static void wmic_put_real(struct wmic_output *o, uint64_t bits, BOOL is_float)
+{
+	char tmp[512];
+	double v;
+	int n;
+
+	if (o->format == WMIC_FORMAT_LINE || o->format == WMIC_FORMAT_CSV) {
+		n = snprintf(tmp, sizeof(tmp), "%f", (double)bits);
+	} else {
+		v = is_float ? wmic_real32(bits) : wmic_real64(bits);
+		if (o->format == WMIC_FORMAT_JSON && !wmic_real_is_finite(v)) {
+			wmic_puts(o, "null");
+			return;
+		}
+		n = snprintf(tmp, sizeof(tmp), is_float ? "%.9g" : "%.17g", v);
+	}
+	if (n < 0) return;
+	if ((size_t)n >= sizeof(tmp)) n = sizeof(tmp) - 1;
+	wmic_write(o, tmp, n);
+}
+
+static void wmic_put_text(struct wmic_output *o, const char *s, enum wmic_escape esc)
+{
+	const char *run = s;
+	char hex[7];
+
+	if (esc == WMIC_ESC_NONE) {
+		wmic_puts(o, s);
+		return;
+	}
+
+	/* copy unescaped runs in one go, break out only for special bytes */
+	for (; *s; ++s) {
+		unsigned char c = *s;
+		const char *rep = NULL;
+
+		switch (esc) {
+		case WMIC_ESC_CSV:
+			if (c == '"') rep = "\"\"";
+			break;
+		case WMIC_ESC_JSON:
+			if (c == '"') rep = "\\\"";
+			else if (c == '\\') rep = "\\\\";
+			else if (c == '\n') rep = "\\n";
+			else if (c == '\r') rep = "\\r";
+			else if (c == '\t') rep = "\\t";
+			else if (c < 0x20) {
+				snprintf(hex, sizeof(hex), "\\u%04x", c);
+				rep = hex;
+			}
+			break;
+		case WMIC_ESC_INFLUX_STRING:
+			if (c == '"') rep = "\\\"";
+			else if (c == '\\') rep = "\\\\";
+			else if (c == '\n') rep = "\\n";
+			break;
+		case WMIC_ESC_INFLUX_KEY:
+			if (c == ',') rep = "\\,";
+			else if (c == '=') rep = "\\=";
+			else if (c == ' ') rep = "\\ ";
+			else if (c == '\n') rep = "\\n";
+			break;
+		case WMIC_ESC_INFLUX_NAME:
+			if (c == ',') rep = "\\,";
+			else if (c == ' ') rep = "\\ ";
+			else if (c == '\n') rep = "\\n";
+			break;
+		default:
+			break;
+		}
+		if (rep == NULL) continue;
+		wmic_write(o, run, s - run);
+		wmic_puts(o, rep);
+		run = s + 1;
+	}
+	wmic_write(o, run, s - run);
+}
+
+/* RFC 4180: quote a field only if it holds the delimiter, a quote or a newline */
+static void wmic_put_csv_field(struct wmic_output *o, const char *s)
+{
+	if (strpbrk(s, "\"\r\n") || (o->delim_len && strstr(s, o->delim))) {
+		wmic_putc(o, '"');
+		wmic_put_text(o, s, WMIC_ESC_CSV);
+		wmic_putc(o, '"');
+	} else {
+		wmic_puts(o, s);
+	}
+}
+
+/*
+ * Returns True for values that have no representation in JSON or line
+ * protocol: null strings and arrays, non-finite reals and unsupported types.
+ * JSON prints them as null and line protocol leaves the field out.
+ */
+static BOOL wmic_value_is_null(union CIMVAR *v, enum CIMTYPE_ENUMERATION cimtype)
+{
+	switch (cimtype) {
+	case CIM_SINT8: case CIM_UINT8: case CIM_SINT16: case CIM_UINT16:
+	case CIM_SINT32: case CIM_UINT32: case CIM_SINT64: case CIM_UINT64:
+	case CIM_BOOLEAN:
+		return False;
+	case CIM_REAL32:
+		return !wmic_real_is_finite(wmic_real32(v->v_real32));
+	case CIM_REAL64:
+		return !wmic_real_is_finite(wmic_real64(v->v_real64));
+	case CIM_STRING:
+	case CIM_DATETIME:
+	case CIM_REFERENCE:
+		return v->v_string == NULL;
+	case CIM_ARR_SINT8: return v->a_sint8 == NULL;
+	case CIM_ARR_UINT8: return v->a_uint8 == NULL;
+	case CIM_ARR_SINT16: return v->a_sint16 == NULL;
+	case CIM_ARR_UINT16: return v->a_uint16 == NULL;
+	case CIM_ARR_SINT32: return v->a_sint32 == NULL;
+	case CIM_ARR_UINT32: return v->a_uint32 == NULL;
+	case CIM_ARR_SINT64: return v->a_sint64 == NULL;
+	case CIM_ARR_UINT64: return v->a_uint64 == NULL;
+	case CIM_ARR_REAL32: return v->a_real32 == NULL;
+	case CIM_ARR_REAL64: return v->a_real64 == NULL;
+	case CIM_ARR_BOOLEAN: return v->a_boolean == NULL;
+	case CIM_ARR_STRING: return v->a_string == NULL;
+	case CIM_ARR_DATETIME: return v->a_datetime == NULL;
+	case CIM_ARR_REFERENCE: return v->a_reference == NULL;
+	default:
+		return True;
+	}
+}
+
+/*
+ * Arrays are "(a,b)" in line and CSV output (CSV quotes the whole field),
+ * [a,b] in JSON and a "(a,b)" string field in line protocol.
+ */
+#define PUT_CVAR_ARRAY(arr, put_item) {\
+	uint32_t i;\
 \
-        if (!arr) {\
-                return talloc_strdup(mem_ctx, "NULL");\
-        }\
-	r = talloc_strdup(mem_ctx, "(");\
-        for (i = 0; i < arr->count; ++i) {\
-		r = talloc_asprintf_append(r, fmt "%s", arr->item[i], (i+1 == arr->count)?"":",");\
-        }\
-        return talloc_asprintf_append(r, ")");\
+	if (!arr) {\
+		if (o->format == WMIC_FORMAT_LINE) wmic_puts(o, "NULL");\
+		else if (o->format == WMIC_FORMAT_JSON) wmic_puts(o, "null");\
+		return;\
+	}\
+	if (o->format == WMIC_FORMAT_CSV) wmic_putc(o, '"');\
+	else if (o->format == WMIC_FORMAT_INFLUX) wmic_putc(o, '"');\
+	wmic_putc(o, o->format == WMIC_FORMAT_JSON ? '[' : '(');\
+	for (i = 0; i < arr->count; ++i) {\
+		if (i) wmic_putc(o, ',');\
+		put_item;\
+	}\
+	wmic_putc(o, o->format == WMIC_FORMAT_JSON ? ']' : ')');\
+	if (o->format == WMIC_FORMAT_CSV) wmic_putc(o, '"');\
+	else if (o->format == WMIC_FORMAT_INFLUX) wmic_putc(o, '"');\
+	return;\
+}
+
+static void wmic_put_string_item(struct wmic_output *o, const char *s)
+{
+	switch (o->format) {
+	case WMIC_FORMAT_LINE:
+		wmic_puts(o, s ? s : "(null)");
+		break;
+	case WMIC_FORMAT_CSV:
+		if (s) wmic_put_text(o, s, WMIC_ESC_CSV);
+		break;
+	case WMIC_FORMAT_JSON:
+		if (!s) {
+			wmic_puts(o, "null");
+			break;
+		}
+		wmic_putc(o, '"');
+		wmic_put_text(o, s, WMIC_ESC_JSON);
+		wmic_putc(o, '"');
+		break;
+	case WMIC_FORMAT_INFLUX:
+		if (s) wmic_put_text(o, s, WMIC_ESC_INFLUX_STRING);
+		break;
+	}
+}
+
+static void wmic_put_bool_item(struct wmic_output *o, uint16_t b)
+{
+	if (o->format == WMIC_FORMAT_JSON) wmic_puts(o, b ? "true" : "false");
+	else wmic_put_uint(o, b);
 }
 
-char *string_CIMVAR(TALLOC_CTX *mem_ctx, union CIMVAR *v, enum CIMTYPE_ENUMERATION cimtype)
+static void wmic_put_value(struct wmic_output *o, union CIMVAR *v,
+			   enum CIMTYPE_ENUMERATION cimtype)
 {
+	/* line protocol marks integers with an 'i'; an unsuffixed number is a float */
+	const char *isuffix = o->format == WMIC_FORMAT_INFLUX ? "i" : "";
+
 	switch (cimtype) {
-        case CIM_SINT8: return talloc_asprintf(mem_ctx, "%d", v->v_sint8);
-        case CIM_UINT8: return talloc_asprintf(mem_ctx, "%u", v->v_uint8);
-        case CIM_SINT16: return talloc_asprintf(mem_ctx, "%d", v->v_sint16);
-        case CIM_UINT16: return talloc_asprintf(mem_ctx, "%u", v->v_uint16);
-        case CIM_SINT32: return talloc_asprintf(mem_ctx, "%d", v->v_sint32);
-        case CIM_UINT32: return talloc_asprintf(mem_ctx, "%u", v->v_uint32);
-        case CIM_SINT64: return talloc_asprintf(mem_ctx, "%lld", v->v_sint64);
-        case CIM_UINT64: return talloc_asprintf(mem_ctx, "%llu", v->v_sint64);
-        case CIM_REAL32: return talloc_asprintf(mem_ctx, "%f", (double)v->v_uint32);
-        case CIM_REAL64: return talloc_asprintf(mem_ctx, "%f", (double)v->v_uint64);
-        case CIM_BOOLEAN: return talloc_asprintf(mem_ctx, "%s", v->v_boolean?"True":"False");
-        case CIM_STRING:
-        case CIM_DATETIME:
-        case CIM_REFERENCE: return talloc_asprintf(mem_ctx, "%s", v->v_string);
-        case CIM_CHAR16: return talloc_asprintf(mem_ctx, "Unsupported");
-        case CIM_OBJECT: return talloc_asprintf(mem_ctx, "Unsupported");
-        case CIM_ARR_SINT8: RETURN_CVAR_ARRAY_STR("%d", v->a_sint8);
-        case CIM_ARR_UINT8: RETURN_CVAR_ARRAY_STR("%u", v->a_uint8);
-        case CIM_ARR_SINT16: RETURN_CVAR_ARRAY_STR("%d", v->a_sint16);
-        case CIM_ARR_UINT16: RETURN_CVAR_ARRAY_STR("%u", v->a_uint16);
-        case CIM_ARR_SINT32: RETURN_CVAR_ARRAY_STR("%d", v->a_sint32);
-        case CIM_ARR_UINT32: RETURN_CVAR_ARRAY_STR("%u", v->a_uint32);
-        case CIM_ARR_SINT64: RETURN_CVAR_ARRAY_STR("%lld", v->a_sint64);
-        case CIM_ARR_UINT64: RETURN_CVAR_ARRAY_STR("%llu", v->a_uint64);
-        case CIM_ARR_REAL32: RETURN_CVAR_ARRAY_STR("%f", v->a_real32);
-        case CIM_ARR_REAL64: RETURN_CVAR_ARRAY_STR("%f", v->a_real64);
-        case CIM_ARR_BOOLEAN: RETURN_CVAR_ARRAY_STR("%d", v->a_boolean);
-        case CIM_ARR_STRING: RETURN_CVAR_ARRAY_STR("%s", v->a_string);
-        case CIM_ARR_DATETIME: RETURN_CVAR_ARRAY_STR("%s", v->a_datetime);
-        case CIM_ARR_REFERENCE: RETURN_CVAR_ARRAY_STR("%s", v->a_reference);
-	default: return talloc_asprintf(mem_ctx, "Unsupported");
-	}
-}
-
-#undef RETURN_CVAR_ARRAY_STR
+	case CIM_SINT8: wmic_put_int(o, v->v_sint8); wmic_puts(o, isuffix); return;
+	case CIM_UINT8: wmic_put_uint(o, v->v_uint8); wmic_puts(o, isuffix); return;
+	case CIM_SINT16: wmic_put_int(o, v->v_sint16); wmic_puts(o, isuffix); return;
+	case CIM_UINT16: wmic_put_uint(o, v->v_uint16); wmic_puts(o, isuffix); return;
+	case CIM_SINT32: wmic_put_int(o, v->v_sint32); wmic_puts(o, isuffix); return;
+	case CIM_UINT32: wmic_put_uint(o, v->v_uint32); wmic_puts(o, isuffix); return;
+	case CIM_SINT64: wmic_put_int(o, v->v_sint64); wmic_puts(o, isuffix); return;
+	case CIM_UINT64:
+		wmic_put_uint(o, v->v_uint64);
+		if ((int64_t)v->v_uint64 >= 0) wmic_puts(o, isuffix);
+		return;
+	case CIM_REAL32: wmic_put_real(o, v->v_real32, True); return;
+	case CIM_REAL64: wmic_put_real(o, v->v_real64, False); return;
+	case CIM_BOOLEAN:
+		if (o->format == WMIC_FORMAT_LINE || o->format == WMIC_FORMAT_CSV)
+			wmic_puts(o, v->v_boolean ? "True" : "False");
+		else
+			wmic_puts(o, v->v_boolean ? "true" : "false");
+		return;
+	case CIM_STRING:
+	case CIM_DATETIME:
+	case CIM_REFERENCE:
+		switch (o->format) {
+		case WMIC_FORMAT_CSV:
+			if (v->v_string) wmic_put_csv_field(o, v->v_string);
+			return;
+		case WMIC_FORMAT_JSON:
+			wmic_put_string_item(o, v->v_string);
+			return;
+		case WMIC_FORMAT_INFLUX:
+			wmic_putc(o, '"');
+			wmic_put_string_item(o, v->v_string);
+			wmic_putc(o, '"');
+			return;
+		default:
+			wmic_put_string_item(o, v->v_string);
+			return;
+		}
+	case CIM_ARR_SINT8: PUT_CVAR_ARRAY(v->a_sint8, wmic_put_int(o, v->a_sint8->item[i]));
+	case CIM_ARR_UINT8: PUT_CVAR_ARRAY(v->a_uint8, wmic_put_uint(o, v->a_uint8->item[i]));
+	case CIM_ARR_SINT16: PUT_CVAR_ARRAY(v->a_sint16, wmic_put_int(o, v->a_sint16->item[i]));
+	case CIM_ARR_UINT16: PUT_CVAR_ARRAY(v->a_uint16, wmic_put_uint(o, v->a_uint16->item[i]));
+	case CIM_ARR_SINT32: PUT_CVAR_ARRAY(v->a_sint32, wmic_put_int(o, v->a_sint32->item[i]));
+	case CIM_ARR_UINT32: PUT_CVAR_ARRAY(v->a_uint32, wmic_put_uint(o, v->a_uint32->item[i]));
+	case CIM_ARR_SINT64: PUT_CVAR_ARRAY(v->a_sint64, wmic_put_int(o, v->a_sint64->item[i]));
+	case CIM_ARR_UINT64: PUT_CVAR_ARRAY(v->a_uint64, wmic_put_uint(o, v->a_uint64->item[i]));
+	case CIM_ARR_REAL32: PUT_CVAR_ARRAY(v->a_real32, wmic_put_real(o, v->a_real32->item[i], True));
+	case CIM_ARR_REAL64: PUT_CVAR_ARRAY(v->a_real64, wmic_put_real(o, v->a_real64->item[i], False));
+	case CIM_ARR_BOOLEAN: PUT_CVAR_ARRAY(v->a_boolean, wmic_put_bool_item(o, v->a_boolean->item[i]));
+	case CIM_ARR_STRING: PUT_CVAR_ARRAY(v->a_string, wmic_put_string_item(o, v->a_string->item[i]));
+	case CIM_ARR_DATETIME: PUT_CVAR_ARRAY(v->a_datetime, wmic_put_string_item(o, v->a_datetime->item[i]));
+	case CIM_ARR_REFERENCE: PUT_CVAR_ARRAY(v->a_reference, wmic_put_string_item(o, v->a_reference->item[i]));
+	default:
+		if (o->format == WMIC_FORMAT_JSON) wmic_puts(o, "null");
+		else if (o->format != WMIC_FORMAT_INFLUX) wmic_puts(o, "Unsupported");
+		return;
+	}
+}
+
+#undef PUT_CVAR_ARRAY
+
+/* initial SmartNext batch size; the prefetcher adapts it from there */
+#define WMIC_BATCH_SIZE 5
+
+#define IS_SELECTED(sel, j) (!(sel) || ((sel)[(j) >> 3] & (1 << ((j) & 7))))
+
+/*
+ * Header printed whenever the class changes: the class name and column names
+ * for line output, a header row for CSV. The hosts of fan-out mode share one
+ * CSV header row as long as they return the same class. JSON and line
+ * protocol name the class in every record instead.
+ */
+static void print_header(struct wmic_output *o, const char *host,
+			 const struct WbemClass *cls, const uint8_t *sel)
+{
+	uint32_t j;
+	BOOL first = True;
+
+	switch (o->format) {
+	case WMIC_FORMAT_LINE:
+		if (host) {
+			wmic_puts(o, host);
+			wmic_write(o, o->delim, o->delim_len);
+		}
+		wmic_puts(o, "CLASS: ");
+		wmic_puts(o, cls->__CLASS);
+		wmic_putc(o, '\n');
+		if (host) {
+			wmic_puts(o, host);
+			wmic_write(o, o->delim, o->delim_len);
+		}
+		for (j = 0; j < cls->__PROPERTY_COUNT; ++j) {
+			if (!IS_SELECTED(sel, j)) continue;
+			if (!first) wmic_write(o, o->delim, o->delim_len);
+			wmic_puts(o, cls->properties[j].name);
+			first = False;
+		}
+		wmic_putc(o, '\n');
+		break;
+	case WMIC_FORMAT_CSV:
+		if (o->csv_class && strcmp(o->csv_class, cls->__CLASS) == 0) break;
+		talloc_free(o->csv_class);
+		o->csv_class = talloc_strdup(o, cls->__CLASS);
+		if (host) {
+			wmic_puts(o, "__HOST");
+			first = False;
+		}
+		for (j = 0; j < cls->__PROPERTY_COUNT; ++j) {
+			if (!IS_SELECTED(sel, j)) continue;
+			if (!first) wmic_write(o, o->delim, o->delim_len);
+			wmic_put_csv_field(o, cls->properties[j].name);
+			first = False;
+		}
+		wmic_putc(o, '\n');
+		break;
+	default:
+		break;
+	}
+}
+
+static void print_object(struct wmic_output *o, const char *host,
+			 struct WbemClassObject *co, const uint8_t *sel)
+{
+	const struct WbemClass *cls = co->obj_class;
+	uint32_t j;
+	BOOL first = True;
+
+	switch (o->format) {
+	case WMIC_FORMAT_LINE:
+	case WMIC_FORMAT_CSV:
+		if (host) {
+			if (o->format == WMIC_FORMAT_CSV) wmic_put_csv_field(o, host);
+			else wmic_puts(o, host);
+			first = False;
+		}
+		for (j = 0; j < cls->__PROPERTY_COUNT; ++j) {
+			if (!IS_SELECTED(sel, j)) continue;
+			if (!first) wmic_write(o, o->delim, o->delim_len);
+			wmic_put_value(o, &co->instance->data[j], cls->properties[j].desc->cimtype & CIM_TYPEMASK);
+			first = False;
+		}
+		wmic_putc(o, '\n');
+		break;
+	case WMIC_FORMAT_JSON:
+		wmic_puts(o, "{\"__CLASS\":\"");
+		wmic_put_text(o, cls->__CLASS, WMIC_ESC_JSON);
+		wmic_putc(o, '"');
+		if (host) {
+			wmic_puts(o, ",\"__HOST\":\"");
+			wmic_put_text(o, host, WMIC_ESC_JSON);
+			wmic_putc(o, '"');
+		}
+		for (j = 0; j < cls->__PROPERTY_COUNT; ++j) {
+			union CIMVAR *v = &co->instance->data[j];
+			enum CIMTYPE_ENUMERATION t = cls->properties[j].desc->cimtype & CIM_TYPEMASK;
+
+			if (!IS_SELECTED(sel, j)) continue;
+			wmic_puts(o, ",\"");
+			wmic_put_text(o, cls->properties[j].name, WMIC_ESC_JSON);
+			wmic_puts(o, "\":");
+			if (wmic_value_is_null(v, t)) wmic_puts(o, "null");
+			else wmic_put_value(o, v, t);
+		}
+		wmic_puts(o, "}\n");
+		break;
+	case WMIC_FORMAT_INFLUX:
+		/* a line needs at least one field, null values are left out */
+		for (j = 0; j < cls->__PROPERTY_COUNT; ++j) {
+			if (IS_SELECTED(sel, j)
+			    && !wmic_value_is_null(&co->instance->data[j], cls->properties[j].desc->cimtype & CIM_TYPEMASK))
+				break;
+		}
+		if (j == cls->__PROPERTY_COUNT) break;
+		wmic_put_text(o, cls->__CLASS, WMIC_ESC_INFLUX_NAME);
+		if (host) {
+			wmic_puts(o, ",host=");
+			wmic_put_text(o, host, WMIC_ESC_INFLUX_KEY);
+		}
+		wmic_putc(o, ' ');
+		for (; j < cls->__PROPERTY_COUNT; ++j) {
+			union CIMVAR *v = &co->instance->data[j];
+			enum CIMTYPE_ENUMERATION t = cls->properties[j].desc->cimtype & CIM_TYPEMASK;
+
+			if (!IS_SELECTED(sel, j) || wmic_value_is_null(v, t)) continue;
+			if (!first) wmic_putc(o, ',');
+			wmic_put_text(o, cls->properties[j].name, WMIC_ESC_INFLUX_KEY);
+			wmic_putc(o, '=');
+			wmic_put_value(o, v, t);
+			first = False;
+		}
+		wmic_putc(o, '\n');
+		break;
+	}
+}
+
+/*
+ * Print a batch of objects returned by SmartNext. 'host' is the host name in
+ * fan-out mode and NULL otherwise. Only the columns selected by the
+ * projection of pEnum are printed.
+ */
+static void print_objects(struct wmic_output *o, TALLOC_CTX *mem_ctx,
+			  const char *host, char **class_name,
+			  struct IEnumWbemClassObject *pEnum,
+			  struct WbemClassObject **co, uint32_t ret)
+{
+	uint32_t i;
+	const uint8_t *sel;
+
+	for (i = 0; i < ret; ++i) {
+		sel = IEnumWbemClassObject_GetProjection(pEnum, co[i]->obj_class);
+		if (!*class_name || strcmp(co[i]->obj_class->__CLASS, *class_name)) {
+			if (*class_name) talloc_free(*class_name);
+			*class_name = talloc_strdup(mem_ctx, co[i]->obj_class->__CLASS);
+			print_header(o, host, co[i]->obj_class, sel);
+		}
+		print_object(o, host, co[i], sel);
+	}
+	if (o->flush_each_batch) wmic_flush(o);
+}
+
+#undef IS_SELECTED
+
+/*
+ * Fan-out mode: many hosts are driven through connect, query and enumeration
+ * on the single event context of the COM context, with at most
+ * 'max_inflight' hosts in progress at any time.
+ */
+struct wmic_scheduler {
+	struct com_context *ctx;
+	struct program_args *args;
+	struct wmic_output *out;
+	char **hosts;
+	const char **columns;
+	int num_hosts;
+	int next_host;
+	int inflight;
+	int failed;
+};
+
+struct wmic_host_state {
+	struct wmic_scheduler *sched;
+	const char *host;
+	char *class_name;
+	struct IWbemServices *pWS;
+	struct dcom_object_exporter *ox;	/* referenced while connected */
+	struct IEnumWbemClassObject *pEnum;
+	struct IEnumWbemClassObject_prefetch *prefetch;
+	struct timed_event *deadline;
+	BOOL finished;
+};
+
+static void wmic_start_next_hosts(struct wmic_scheduler *sched);
+
+/*
+ * Returns True if a call is still being made, or about to be, on one of the
+ * pipes of an object exporter.
+ */
+static BOOL wmic_ox_busy(struct dcom_object_exporter *ox)
+{
+	struct dcom_ox_pipe *op;
+	struct rpc_request *req;
+
+	for (op = ox->pipes; op; op = op->next) {
+		if (op->handouts) return True;
+		for (req = op->pipe->conn->pending; req; req = req->next) {
+			if (req->p == op->pipe) return True;
+		}
+		for (req = op->pipe->conn->request_queue; req; req = req->next) {
+			if (req->p == op->pipe) return True;
+		}
+	}
+	return False;
+}
+
+/*
+ * Let go of the object exporter used for a host once it has been dealt
+ * with. Hosts listed more than once, or under several names, share one
+ * object exporter, so it (and so its TCP connections) is only dropped once
+ * no other host holds it and nothing is in flight on it; otherwise
+ * thousands of hosts exhaust descriptors.
+ */
+static void wmic_host_disconnect(struct wmic_host_state *hs)
+{
+	struct com_context *ctx = hs->sched->ctx;
+	struct dcom_object_exporter *ox = hs->ox;
+
+	if (ox == NULL) return;
+	hs->ox = NULL;
+	talloc_unlink(hs, ox);
+	if (talloc_reference_count(ox) == 0 && !wmic_ox_busy(ox)) {
+		DLIST_REMOVE(ctx->dcom->object_exporters, ox);
+		talloc_free(ox);
+	}
+}
+
+/*
+ * Called when a host has completed, failed or timed out. The slot is handed
+ * to the next host straight away; if an RPC is still outstanding (timeout)
+ * the state is kept until that RPC reports back and is then freed.
+ */
+static void wmic_host_finish(struct wmic_host_state *hs, NTSTATUS status,
+			     BOOL pending)
+{
+	struct wmic_scheduler *sched = hs->sched;
+
+	if (!hs->finished) {
+		hs->finished = True;
+		talloc_free(hs->deadline);
+		hs->deadline = NULL;
+		if (!NT_STATUS_IS_OK(status)) {
+			fprintf(stderr, "%s: NTSTATUS: %s - %s\n", hs->host,
+				nt_errstr(status), get_friendly_nt_error_msg(status));
+			sched->failed++;
+		}
+		sched->inflight--;
+		wmic_start_next_hosts(sched);
+	}
+
+	if (!pending) {
+		wmic_host_disconnect(hs);
+		talloc_free(hs);
+	}
+}
+
+/*
+ * Returns True if the host already timed out while this step was in flight,
+ * in which case the host state has now been released.
+ */
+static BOOL wmic_host_abandoned(struct wmic_host_state *hs)
+{
+	if (!hs->finished) return False;
+	wmic_host_finish(hs, NT_STATUS_OK, False);
+	return True;
+}
+
+static void wmic_host_timeout(struct event_context *ev, struct timed_event *te,
+			      struct timeval t, void *private_data)
+{
+	struct wmic_host_state *hs = talloc_get_type(private_data,
+						     struct wmic_host_state);
+
+	hs->deadline = NULL;
+	wmic_host_finish(hs, NT_STATUS_IO_TIMEOUT, True);
+}
+
+static void wmic_smart_next_continue(struct composite_context *ctx)
+{
+	struct wmic_host_state *hs = talloc_get_type(ctx->async.private_data,
+						     struct wmic_host_state);
+	struct wmic_scheduler *sched = hs->sched;
+	struct composite_context *c;
+	struct WbemClassObject **co;
+	uint32_t ret;
+	WERROR result;
+
+	result = IEnumWbemClassObject_PrefetchNext_recv(ctx, hs, &co, &ret);
+	if (wmic_host_abandoned(hs)) return;
+	/* WBEM_S_FALSE means the enumeration has been exhausted */
+	if (W_ERROR_V(result) == WBEM_S_FALSE) {
+		wmic_host_finish(hs, NT_STATUS_OK, False);
+		return;
+	}
+	if (!W_ERROR_IS_OK(result)) {
+		wmic_host_finish(hs, werror_to_ntstatus(result), False);
+		return;
+	}
+
+	print_objects(sched->out, hs, hs->host, &hs->class_name, hs->pEnum, co, ret);
+	/* the objects of the batch live below the array */
+	talloc_free(co);
+
+	c = IEnumWbemClassObject_PrefetchNext_send(hs->prefetch, hs);
+	if (c == NULL) {
+		wmic_host_finish(hs, NT_STATUS_NO_MEMORY, False);
+		return;
+	}
+	c->async.fn = wmic_smart_next_continue;
+	c->async.private_data = hs;
+}
+
+static void wmic_exec_query_continue(struct composite_context *ctx)
+{
+	struct wmic_host_state *hs = talloc_get_type(ctx->async.private_data,
+						     struct wmic_host_state);
+	struct composite_context *c;
+	WERROR result;
+
+	result = IWbemServices_ExecQuery_recv(ctx, &hs->pEnum);
+	if (wmic_host_abandoned(hs)) return;
+	if (!W_ERROR_IS_OK(result)) {
+		wmic_host_finish(hs, werror_to_ntstatus(result), False);
+		return;
+	}
+	talloc_steal(hs, hs->pEnum);
+	IEnumWbemClassObject_SetNamespace(hs->pEnum, hs->sched->args->ns);
+	IEnumWbemClassObject_SetProjection(hs->pEnum, hs->sched->columns);
+
+	hs->prefetch = IEnumWbemClassObject_Prefetch_init(hs->pEnum, hs, 0xFFFFFFFF,
+							  WMIC_BATCH_SIZE, 0, 0);
+	if (hs->prefetch == NULL) {
+		wmic_host_finish(hs, NT_STATUS_NO_MEMORY, False);
+		return;
+	}
+
+	c = IEnumWbemClassObject_PrefetchNext_send(hs->prefetch, hs);
+	if (c == NULL) {
+		wmic_host_finish(hs, NT_STATUS_NO_MEMORY, False);
+		return;
+	}
+	c->async.fn = wmic_smart_next_continue;
+	c->async.private_data = hs;
+}
+
+static void wmic_connect_continue(struct composite_context *ctx)
+{
+	struct wmic_host_state *hs = talloc_get_type(ctx->async.private_data,
+						     struct wmic_host_state);
+	struct composite_context *c;
+	WERROR result;
+
+	result = WBEM_ConnectServer_recv(ctx, hs, &hs->pWS);
+	if (W_ERROR_IS_OK(result)) {
+		hs->ox = object_exporter_by_ip(hs->sched->ctx,
+					       (struct IUnknown *)hs->pWS);
+		if (hs->ox) talloc_reference(hs, hs->ox);
+	}
+	if (wmic_host_abandoned(hs)) return;
+	if (!W_ERROR_IS_OK(result)) {
+		wmic_host_finish(hs, werror_to_ntstatus(result), False);
+		return;
+	}
+
+	c = IWbemServices_ExecQuery_send(hs->pWS, hs, "WQL", hs->sched->args->query,
+					 WBEM_FLAG_RETURN_IMMEDIATELY | WBEM_FLAG_ENSURE_LOCATABLE,
+					 NULL);
+	if (c == NULL) {
+		wmic_host_finish(hs, NT_STATUS_NO_MEMORY, False);
+		return;
+	}
+	c->async.fn = wmic_exec_query_continue;
+	c->async.private_data = hs;
+}
+
+/*
+ * Fill every free slot with the next host from the list.
+ */
+static void wmic_start_next_hosts(struct wmic_scheduler *sched)
+{
+	while (sched->inflight < sched->args->max_inflight
+	       && sched->next_host < sched->num_hosts) {
+		struct wmic_host_state *hs;
+		struct composite_context *c;
+		const char *host = sched->hosts[sched->next_host++];
+
+		/* accept the same "//host" form as single host mode */
+		if (strncmp(host, "//", 2) == 0) host += 2;
+		if (*host == '\0' || *host == '#') continue;
+
+		hs = talloc_zero(sched->ctx, struct wmic_host_state);
+		if (hs == NULL) {
+			fprintf(stderr, "%s: out of memory\n", host);
+			sched->failed++;
+			continue;
+		}
+		hs->sched = sched;
+		hs->host = talloc_strdup(hs, host);
+		sched->inflight++;
+
+		if (sched->args->host_timeout > 0) {
+			hs->deadline = event_add_timed(sched->ctx->event_ctx, hs,
+						       timeval_current_ofs(sched->args->host_timeout, 0),
+						       wmic_host_timeout, hs);
+		}
+
+		c = WBEM_ConnectServer_send(sched->ctx, hs, hs->host, sched->args->ns,
+					    0, 0, 0, 0, 0, 0);
+		if (c == NULL) {
+			wmic_host_finish(hs, NT_STATUS_NO_MEMORY, False);
+			continue;
+		}
+		c->async.fn = wmic_connect_continue;
+		c->async.private_data = hs;
+	}
+}
+
+static int run_fanout(struct com_context *ctx, struct program_args *args,
+		      struct wmic_output *out)
+{
+	struct wmic_scheduler *sched;
+	struct wbem_class_cache_stats cs;
+	int i;
+
+	sched = talloc_zero(ctx, struct wmic_scheduler);
+	sched->ctx = ctx;
+	sched->args = args;
+	sched->out = out;
+	sched->columns = WBEMDATA_QueryColumns(sched, args->query);
+
+	if (strcmp(args->hosts_file, "-") == 0) {
+		sched->hosts = fd_lines_load(0, &sched->num_hosts, sched);
+	} else {
+		sched->hosts = file_lines_load(args->hosts_file, &sched->num_hosts, sched);
+	}
+	if (sched->hosts == NULL) {
+		fprintf(stderr, "Unable to read hosts from %s\n", args->hosts_file);
+		return 1;
+	}
+	for (i = 0; i < sched->num_hosts; i++) {
+		trim_string(sched->hosts[i], " \t", " \t\r");
+	}
+
+	wmic_start_next_hosts(sched);
+	while (sched->inflight > 0) {
+		if (event_loop_once(ctx->event_ctx) != 0) break;
+	}
+
+	wmic_flush(out);
+	WBEMDATA_ClassCacheStats(ctx, &cs);
+	DEBUG(1, ("Class cache: %u entries, %u hits, %u misses, %u evictions\n",
+		  cs.entries, cs.hits, cs.misses, cs.evictions));
+
+	return (sched->failed || out->failed) ? 1 : 0;
+}
 
 int main(int argc, char **argv)
 {
 	struct program_args args = {};
-	uint32_t cnt = 5, ret;
+	uint32_t ret;
 	char *class_name = NULL;
 	WERROR result;
 	NTSTATUS status;
 	struct IWbemServices *pWS = NULL;
+	struct wmic_output *out;
+	enum wmic_format format = WMIC_FORMAT_LINE;
+	struct IEnumWbemClassObject_prefetch *pf;
 
+	args.host_timeout = 120;
         parse_args(argc, argv, &args);
+
+	if (args.format) {
+		if (strcasecmp(args.format, "line") == 0) format = WMIC_FORMAT_LINE;
+		else if (strcasecmp(args.format, "csv") == 0) format = WMIC_FORMAT_CSV;
+		else if (strcasecmp(args.format, "json") == 0) format = WMIC_FORMAT_JSON;
+		else if (strcasecmp(args.format, "influx") == 0) format = WMIC_FORMAT_INFLUX;
+		else {
+			fprintf(stderr, "Unknown output format '%s'\n", args.format);
+			return 1;
+		}
+	}
 	
 	/* apply default values if not given by user*/
 	if (!args.ns) args.ns = "root\\cimv2";
-	if (!args.delim) args.delim = "|";
+	if (!args.delim) args.delim = (format == WMIC_FORMAT_CSV) ? "," : "|";
+	if (args.max_inflight <= 0) args.max_inflight = 32;
 
 	dcerpc_init();
 	dcerpc_table_init();
@@ -192,6 +1049,14 @@ int main(int argc, char **argv)
 	com_init_ctx(&ctx, NULL);
 	dcom_client_init(ctx, cmdline_credentials);
 
+	out = wmic_output_init(ctx, format, args.delim, 1);
+
+	if (args.hosts_file) {
+		int rc = run_fanout(ctx, &args, out);
+		talloc_free(ctx);
+		return rc;
+	}
+
 	result = WBEM_ConnectServer(ctx, args.hostname, args.ns, 0, 0, 0, 0, 0, 0, &pWS);
 	WERR_CHECK("Login to remote object.");
 
@@ -202,39 +1067,35 @@ int main(int argc, char **argv)
 	IEnumWbemClassObject_Reset(pEnum, ctx);
 	WERR_CHECK("Reset result of WMI query.");
 
+	IEnumWbemClassObject_SetNamespace(pEnum, args.ns);
+
+	/* only decode and print the columns the query asks for */
+	IEnumWbemClassObject_SetProjection(pEnum, WBEMDATA_QueryColumns(ctx, args.query));
+
+	pf = IEnumWbemClassObject_Prefetch_init(pEnum, ctx, 0xFFFFFFFF, WMIC_BATCH_SIZE, 0, 0);
+	result = pf ? WERR_OK : WERR_NOMEM;
+	WERR_CHECK("Start fetching the results.");
+
 	do {
-		uint32_t i, j;
-		struct WbemClassObject *co[cnt];
-
-		result = IEnumWbemClassObject_SmartNext(pEnum, ctx, 0xFFFFFFFF, cnt, co, &ret);
-		/* WERR_BADFUNC is OK, it means only that there is less returned objects than requested */
-		if (!W_ERROR_EQUAL(result, WERR_BADFUNC)) {
-			WERR_CHECK("Retrieve result data.");
-		} else {
-			DEBUG(1, ("OK   : Retrieved less objects than requested (it is normal).\n"));
-		}
-		if (!ret) break;
-
-		for (i = 0; i < ret; ++i) {
-			if (!class_name || strcmp(co[i]->obj_class->__CLASS, class_name)) {
-				if (class_name) talloc_free(class_name);
-				class_name = talloc_strdup(ctx, co[i]->obj_class->__CLASS);
-				printf("CLASS: %s\n", class_name);
-				for (j = 0; j < co[i]->obj_class->__PROPERTY_COUNT; ++j)
-					printf("%s%s", j?args.delim:"", co[i]->obj_class->properties[j].name);
-				printf("\n");
-			}
-			for (j = 0; j < co[i]->obj_class->__PROPERTY_COUNT; ++j) {
-				char *s;
-				s = string_CIMVAR(ctx, &co[i]->instance->data[j], co[i]->obj_class->properties[j].desc->cimtype & CIM_TYPEMASK);
-				printf("%s%s", j?args.delim:"", s);
-			}
-			printf("\n");
+		struct WbemClassObject **co;
+
+		result = IEnumWbemClassObject_PrefetchNext(pf, ctx, &co, &ret);
+		/* WBEM_S_FALSE means the enumeration has been exhausted */
+		if (W_ERROR_V(result) == WBEM_S_FALSE) {
+			DEBUG(1, ("OK   : Retrieved all objects.\n"));
+			break;
 		}
-	} while (ret == cnt);
+		WERR_CHECK("Retrieve result data.");
+
+		print_objects(out, ctx, NULL, &class_name, pEnum, co, ret);
+		talloc_free(co);
+	} while (ret);
+	wmic_flush(out);
+	ret = out->failed ? 1 : 0;
 	talloc_free(ctx);
-	return 0;
+	return ret;
 error:
+	wmic_flush(out);
 	status = werror_to_ntstatus(result);
 	fprintf(stderr, "NTSTATUS: %s - %s\n", nt_errstr(status), get_friendly_nt_error_msg(status));
 	talloc_free(ctx);
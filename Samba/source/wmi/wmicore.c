@@ -21,6 +21,10 @@
 #include "librpc/gen_ndr/com_dcom.h"
 #include "lib/com/dcom/dcom.h"
 #include "libcli/composite/composite.h"
+#include "librpc/rpc/dcerpc.h"
+#include "lib/events/events.h"
+#include "lib/util/dlinklist.h"
+#include "lib/com/com.h"
 #include "wmi/wmi.h"
 
 /*
@@ -39,21 +43,99 @@ struct wbem_connect_context
 };
 
 /*
- * Finish off the WBEM connect host request by receiving the results of the
- * IUnknown:Release call of the IWbemLevel1Login interface pointer and then
- * letting the parent composite continue.
+ * The namespaces IWbemServices pointers from WBEM_ConnectServer were
+ * connected to, kept in the COM_EXT_WMI_SERVICES_NAMESPACES extension of the
+ * com_context. The enumerations a pointer creates use it to key the class
+ * cache. Each entry is allocated below its IWbemServices pointer and goes
+ * with it.
  */
-static void wbem_release_continue(struct composite_context *ctx)
+struct wbem_services_nspace {
+    struct wbem_services_nspace_list *list;     /* NULL once it is gone */
+    struct IWbemServices *services;
+    const char *nspace;
+    struct wbem_services_nspace *prev, *next;
+};
+
+struct wbem_services_nspace_list {
+    struct wbem_services_nspace *entries;
+};
+
+static int wbem_services_nspace_destructor(struct wbem_services_nspace *e)
 {
-    struct composite_context *c = NULL;
+    if (e->list != NULL)
+        DLIST_REMOVE(e->list->entries, e);
+    return 0;
+}
 
-    /* retrieve the parent composite context */
-    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+static int wbem_services_nspace_list_destructor(
+        struct wbem_services_nspace_list *list)
+{
+    struct wbem_services_nspace *e;
+
+    for (e = list->entries; e; e = e->next)
+        e->list = NULL;
+    return 0;
+}
+
+static void wbem_services_set_namespace(struct IWbemServices *services,
+        const char *nspace)
+{
+    struct wbem_services_nspace_list *list;
+    struct wbem_services_nspace *e;
 
+    list = com_extension_by_id(services->ctx, COM_EXT_WMI_SERVICES_NAMESPACES);
+    if (list == NULL)
+    {
+        list = talloc_zero(services->ctx, struct wbem_services_nspace_list);
+        if (list == NULL) return;
+        talloc_set_destructor(list, wbem_services_nspace_list_destructor);
+        com_extension_set(services->ctx, COM_EXT_WMI_SERVICES_NAMESPACES,
+                list);
+    }
+
+    /* without an entry the class cache just falls back to no namespace */
+    e = talloc_zero(services, struct wbem_services_nspace);
+    if (e == NULL) return;
+    e->nspace = talloc_strdup(e, nspace);
+    if (e->nspace == NULL)
+    {
+        talloc_free(e);
+        return;
+    }
+    e->services = services;
+    e->list = list;
+    DLIST_ADD(list->entries, e);
+    talloc_set_destructor(e, wbem_services_nspace_destructor);
+}
+
+/*
+ * The namespace an IWbemServices pointer from WBEM_ConnectServer was
+ * connected to, NULL for one obtained otherwise.
+ */
+const char *WBEM_ServicesNamespace(struct IWbemServices *services)
+{
+    struct wbem_services_nspace_list *list;
+    struct wbem_services_nspace *e;
+
+    list = com_extension_by_id(services->ctx, COM_EXT_WMI_SERVICES_NAMESPACES);
+    if (list == NULL) return NULL;
+    for (e = list->entries; e; e = e->next)
+    {
+        if (e->services == services) return e->nspace;
+    }
+    return NULL;
+}
+
+/*
+ * Receive the results of the IUnknown:Release call of the IWbemLevel1Login
+ * interface pointer once it has gone out with the next batch of releases,
+ * or has failed because the object exporter was freed before it could.
+ * Either way the request is freed here.
+ */
+static void wbem_release_continue(struct composite_context *ctx)
+{
     /* receive the results, but we don't really care what they are */
     (void)IUnknown_Release_recv(ctx);
-
-    composite_done(c);
 }
 
 /*
@@ -83,12 +165,21 @@ static void wbem_login_server_continue(struct composite_context *ctx)
     {
         struct composite_context *release_ctx = NULL;
 
-        release_ctx = IUnknown_Release_send((struct IUnknown *)s->login, c);
+        /*
+         * the login pointer is released along with whatever else is let go
+         * of shortly, there is no need to hold up the connect for it
+         */
+        release_ctx = IUnknown_Release_send((struct IUnknown *)s->login,
+                s->com_context);
         if (composite_nomem(release_ctx, c)) return;
+        release_ctx->async.fn = wbem_release_continue;
+        s->login = NULL;
 
-        composite_continue(c, release_ctx, wbem_release_continue, c);
+        /* remembered for the class cache of the enumerations it creates */
+        wbem_services_set_namespace(services, s->wszNetworkResource);
 
         s->services = services;
+        composite_done(c);
     }
 }
 
@@ -247,6 +338,603 @@ WERROR WBEM_ConnectServer(struct com_context *ctx, const char *server,
     return WBEM_ConnectServer_recv(c, NULL, services);
 }
 
+/*
+ * Session pool. IWbemServices pointers are kept per (host, namespace,
+ * credentials) in the COM_EXT_WMI_SESSION_POOL extension of the com_context,
+ * so that repeated connects to the same host skip activation, the NTLM bind
+ * and NTLMLogin. A session may be handed to several callers at once; each
+ * returns it with WBEM_SessionPool_Release(). Sessions on a dead connection
+ * are dropped when found, idle ones after the idle timeout. The timeout
+ * defaults to less than the six minutes after which a server collects
+ * objects it has not been pinged for, as we do not ping.
+ */
+#define WBEM_SESSION_POOL_MAX_SESSIONS	1024
+#define WBEM_SESSION_POOL_IDLE_TIMEOUT	240
+
+struct wbem_session {
+    struct wbem_session_pool *pool;
+    const char *host;
+    const char *nspace;
+    const char *user;
+    const char *password;
+    struct IWbemServices *services;
+    struct timeval last_used;
+    uint32_t users;
+    BOOL failed;
+    struct wbem_session *prev, *next;
+};
+
+struct wbem_session_pool {
+    struct com_context *ctx;
+    struct wbem_session *sessions;	/* most recently used first */
+    uint32_t max_sessions;
+    uint32_t idle_timeout;
+    struct timed_event *expire_te;
+    struct wbem_session_pool_stats stats;
+};
+
+static void wbem_session_pool_schedule(struct wbem_session_pool *pool);
+
+static struct wbem_session_pool *wbem_session_pool(struct com_context *ctx,
+        BOOL create)
+{
+    struct wbem_session_pool *pool;
+
+    pool = com_extension_by_id(ctx, COM_EXT_WMI_SESSION_POOL);
+    if (pool == NULL && create)
+    {
+        pool = talloc_zero(ctx, struct wbem_session_pool);
+        if (pool == NULL) return NULL;
+        pool->ctx = ctx;
+        pool->max_sessions = WBEM_SESSION_POOL_MAX_SESSIONS;
+        pool->idle_timeout = WBEM_SESSION_POOL_IDLE_TIMEOUT;
+        com_extension_set(ctx, COM_EXT_WMI_SESSION_POOL, pool);
+    }
+    return pool;
+}
+
+static BOOL wbem_session_alive(struct wbem_session *ws)
+{
+    struct dcom_object_exporter *ox;
+    struct dcom_ox_pipe *op;
+
+    ox = object_exporter_by_ip(ws->pool->ctx, (struct IUnknown *)ws->services);
+    if (ox == NULL) return False;
+    /* failed pipes are rebuilt by dcom_get_pipe, only a host with no
+       working connection left is given up on */
+    if (ox->pipes == NULL) return True;
+    for (op = ox->pipes; op; op = op->next)
+    {
+        if (!op->pipe->conn->dead) return True;
+    }
+    return False;
+}
+
+static void wbem_session_release_continue(struct composite_context *ctx)
+{
+    struct wbem_session *ws = talloc_get_type(ctx->async.private_data,
+            struct wbem_session);
+
+    (void)IUnknown_Release_recv(ctx);
+    talloc_free(ws);
+}
+
+/*
+ * Take a session out of the pool and let go of its IWbemServices pointer.
+ * The session memory goes once the server has acknowledged the release.
+ */
+static void wbem_session_drop(struct wbem_session *ws, BOOL release)
+{
+    struct wbem_session_pool *pool = ws->pool;
+    struct composite_context *c;
+
+    DLIST_REMOVE(pool->sessions, ws);
+    pool->stats.sessions--;
+
+    if (release && wbem_session_alive(ws))
+    {
+        c = IUnknown_Release_send((struct IUnknown *)ws->services, ws);
+        if (c != NULL)
+        {
+            c->async.fn = wbem_session_release_continue;
+            c->async.private_data = ws;
+            return;
+        }
+    }
+    talloc_free(ws);
+}
+
+/*
+ * Drop idle sessions that have exceeded the idle timeout or that sit on a
+ * dead connection.
+ */
+static void wbem_session_pool_expire(struct wbem_session_pool *pool)
+{
+    struct wbem_session *ws, *next;
+    struct timeval now = timeval_current();
+
+    for (ws = pool->sessions; ws; ws = next)
+    {
+        next = ws->next;
+        if (ws->users) continue;
+        if (ws->failed || !wbem_session_alive(ws)
+            || timeval_elapsed2(&ws->last_used, &now) >= pool->idle_timeout)
+        {
+            DEBUG(3, ("wbem session pool: dropping idle session to %s\n",
+                    ws->host));
+            pool->stats.evictions++;
+            wbem_session_drop(ws, True);
+        }
+    }
+}
+
+static void wbem_session_pool_timer(struct event_context *ev,
+        struct timed_event *te, struct timeval t, void *private_data)
+{
+    struct wbem_session_pool *pool = talloc_get_type(private_data,
+            struct wbem_session_pool);
+
+    pool->expire_te = NULL;
+    wbem_session_pool_expire(pool);
+    wbem_session_pool_schedule(pool);
+}
+
+/*
+ * Arm the expiry timer for the idle session that times out first.
+ */
+static void wbem_session_pool_schedule(struct wbem_session_pool *pool)
+{
+    struct wbem_session *ws;
+    struct timeval first = timeval_zero();
+
+    for (ws = pool->sessions; ws; ws = ws->next)
+    {
+        if (ws->users) continue;
+        if (timeval_is_zero(&first) || timeval_compare(&ws->last_used, &first) < 0)
+            first = ws->last_used;
+    }
+
+    talloc_free(pool->expire_te);
+    pool->expire_te = NULL;
+    if (timeval_is_zero(&first)) return;
+
+    pool->expire_te = event_add_timed(pool->ctx->event_ctx, pool,
+            timeval_add(&first, pool->idle_timeout, 0),
+            wbem_session_pool_timer, pool);
+}
+
+static BOOL wbem_session_str_equal(const char *a, const char *b)
+{
+    return strcmp(a ? a : "", b ? b : "") == 0;
+}
+
+static struct wbem_session *wbem_session_pool_find(
+        struct wbem_session_pool *pool, const char *host, const char *nspace,
+        const char *user, const char *password)
+{
+    struct wbem_session *ws;
+
+    for (ws = pool->sessions; ws; ws = ws->next)
+    {
+        if (ws->failed) continue;
+        if (strcasecmp(ws->host, host) == 0
+            && strcasecmp(ws->nspace, nspace) == 0
+            && wbem_session_str_equal(ws->user, user)
+            && wbem_session_str_equal(ws->password, password))
+        {
+            return ws;
+        }
+    }
+    return NULL;
+}
+
+static struct wbem_session *wbem_session_by_services(
+        struct wbem_session_pool *pool, struct IWbemServices *services)
+{
+    struct wbem_session *ws;
+
+    for (ws = pool->sessions; ws; ws = ws->next)
+    {
+        if (ws->services == services) return ws;
+    }
+    return NULL;
+}
+
+struct wbem_session_connect_state
+{
+    struct wbem_session_pool *pool;
+    struct wbem_session *session;
+    BOOL reused;
+    const char *host;
+    const char *nspace;
+    const char *user;
+    const char *password;
+};
+
+static void wbem_session_connect_continue(struct composite_context *ctx)
+{
+    struct composite_context *c = NULL;
+    struct wbem_session_connect_state *s = NULL;
+    struct wbem_session_pool *pool;
+    struct wbem_session *ws;
+    struct IWbemServices *services = NULL;
+    WERROR result;
+
+    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+    s = talloc_get_type(c->private_data, struct wbem_session_connect_state);
+    pool = s->pool;
+
+    result = WBEM_ConnectServer_recv(ctx, c, &services);
+    if (!W_ERROR_IS_OK(result))
+    {
+        composite_error(c, werror_to_ntstatus(result));
+        return;
+    }
+
+    ws = talloc_zero(pool, struct wbem_session);
+    if (composite_nomem(ws, c)) return;
+    ws->pool = pool;
+    ws->host = talloc_strdup(ws, s->host);
+    ws->nspace = talloc_strdup(ws, s->nspace);
+    ws->user = talloc_strdup(ws, s->user);
+    ws->password = talloc_strdup(ws, s->password);
+    ws->services = talloc_steal(ws, services);
+    ws->users = 1;
+    ws->last_used = timeval_current();
+    DLIST_ADD(pool->sessions, ws);
+    pool->stats.sessions++;
+
+    /* make room by dropping the least recently used idle sessions */
+    if (pool->stats.sessions > pool->max_sessions)
+    {
+        struct wbem_session *victim, *prev;
+
+        for (victim = ws; victim->next; victim = victim->next) ;
+        for (; victim; victim = prev)
+        {
+            prev = victim->prev;
+            if (pool->stats.sessions <= pool->max_sessions) break;
+            if (victim->users) continue;
+            pool->stats.evictions++;
+            wbem_session_drop(victim, True);
+        }
+    }
+
+    s->session = ws;
+    composite_done(c);
+}
+
+/*
+ * Asynchronously get an IWbemServices pointer for a host from the session
+ * pool of com_ctx, connecting only if there is no live session for the same
+ * host, namespace and credentials.
+ */
+struct composite_context *WBEM_SessionPool_Connect_send(
+        struct com_context *com_ctx, TALLOC_CTX *parent_ctx,
+        const char *server, const char *nspace, const char *user,
+        const char *password, const char *locale, uint32_t flags,
+        const char *authority, struct IWbemContext *wbem_ctx)
+{
+    struct composite_context *c = NULL;
+    struct wbem_session_connect_state *s = NULL;
+    struct composite_context *new_ctx = NULL;
+    struct wbem_session *ws;
+
+    c = composite_create(parent_ctx, com_ctx->event_ctx);
+    if (c == NULL) return NULL;
+
+    s = talloc_zero(c, struct wbem_session_connect_state);
+    if (composite_nomem(s, c)) return c;
+    c->private_data = s;
+
+    s->pool = wbem_session_pool(com_ctx, True);
+    if (composite_nomem(s->pool, c)) return c;
+
+    wbem_session_pool_expire(s->pool);
+
+    ws = wbem_session_pool_find(s->pool, server, nspace, user, password);
+    if (ws != NULL)
+    {
+        s->pool->stats.hits++;
+        s->reused = True;
+        ws->users++;
+        DLIST_REMOVE(s->pool->sessions, ws);
+        DLIST_ADD(s->pool->sessions, ws);
+        s->session = ws;
+        composite_done(c);
+        return c;
+    }
+    s->pool->stats.misses++;
+
+    s->host = talloc_strdup(s, server);
+    s->nspace = talloc_strdup(s, nspace);
+    s->user = talloc_strdup(s, user);
+    s->password = talloc_strdup(s, password);
+
+    new_ctx = WBEM_ConnectServer_send(com_ctx, c, server, nspace, user,
+            password, locale, flags, authority, wbem_ctx);
+    if (composite_nomem(new_ctx, c)) return c;
+
+    composite_continue(c, new_ctx, wbem_session_connect_continue, c);
+    return c;
+}
+
+/*
+ * Receive the pooled IWbemServices pointer. It belongs to the pool: hand it
+ * back with WBEM_SessionPool_Release() instead of releasing it.
+ */
+WERROR WBEM_SessionPool_Connect_recv(struct composite_context *c,
+        struct IWbemServices **services)
+{
+    WERROR result;
+
+    NTSTATUS status = composite_wait(c);
+    if (!NT_STATUS_IS_OK(status))
+    {
+        result = ntstatus_to_werror(status);
+    }
+    else
+    {
+        struct wbem_session_connect_state *s = talloc_get_type(
+                c->private_data, struct wbem_session_connect_state);
+
+        *services = s->session->services;
+        result = WERR_OK;
+    }
+
+    talloc_free(c);
+    return result;
+}
+
+/*
+ * Returns True if 'result' says the session it was obtained on cannot be used
+ * any longer.
+ */
+static BOOL wbem_session_failed(WERROR result)
+{
+    return W_ERROR_V(result) == RPC_S_CALL_FAILED
+        || W_ERROR_V(result) == WBEM_E_TRANSPORT_FAILURE
+        || W_ERROR_EQUAL(result, ntstatus_to_werror(NT_STATUS_RPC_NT_CALL_FAILED))
+        || W_ERROR_EQUAL(result, ntstatus_to_werror(NT_STATUS_CONNECTION_DISCONNECTED))
+        || W_ERROR_EQUAL(result, ntstatus_to_werror(NT_STATUS_CONNECTION_RESET))
+        || W_ERROR_EQUAL(result, ntstatus_to_werror(NT_STATUS_IO_TIMEOUT));
+}
+
+/*
+ * Hand a session back to the pool. 'result' is the outcome of the last call
+ * made on it; a session whose call failed at the transport level is dropped
+ * so that the next connect builds a new one.
+ */
+void WBEM_SessionPool_Release(struct com_context *ctx,
+        struct IWbemServices *services, WERROR result)
+{
+    struct wbem_session_pool *pool;
+    struct wbem_session *ws;
+
+    pool = wbem_session_pool(ctx, False);
+    if (pool == NULL) return;
+    ws = wbem_session_by_services(pool, services);
+    if (ws == NULL) return;
+
+    if (ws->users) ws->users--;
+    ws->last_used = timeval_current();
+    if (!ws->failed && (wbem_session_failed(result) || !wbem_session_alive(ws)))
+    {
+        /* no new users; those still holding it find out on their next call */
+        ws->failed = True;
+        pool->stats.failures++;
+    }
+    if (ws->failed && ws->users == 0)
+    {
+        wbem_session_drop(ws, False);
+    }
+    wbem_session_pool_schedule(pool);
+}
+
+/*
+ * Query through the session pool. If the query fails on a pooled session
+ * because the connection has gone, the session is dropped and the query is
+ * retried once on a fresh connection. On success the session used is
+ * returned in *services and must be handed back with
+ * WBEM_SessionPool_Release() once the enumeration is finished.
+ */
+struct wbem_pool_query_state
+{
+    struct com_context *com_ctx;
+    const char *server;
+    const char *nspace;
+    const char *user;
+    const char *password;
+    const char *language;
+    const char *query;
+    int32_t flags;
+    BOOL retried;
+    BOOL pooled;
+    struct IWbemServices *services;
+    struct IEnumWbemClassObject *pEnum;
+};
+
+static void wbem_pool_query_connect(struct composite_context *c);
+
+static void wbem_pool_query_continue(struct composite_context *ctx)
+{
+    struct composite_context *c = NULL;
+    struct wbem_pool_query_state *s = NULL;
+    WERROR result;
+
+    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+    s = talloc_get_type(c->private_data, struct wbem_pool_query_state);
+
+    result = IWbemServices_ExecQuery_recv(ctx, &s->pEnum);
+    if (W_ERROR_IS_OK(result))
+    {
+        talloc_steal(s, s->pEnum);
+        IEnumWbemClassObject_SetNamespace(s->pEnum, s->nspace);
+        composite_done(c);
+        return;
+    }
+
+    WBEM_SessionPool_Release(s->com_ctx, s->services, result);
+    s->services = NULL;
+    if (s->pooled && !s->retried && wbem_session_failed(result))
+    {
+        DEBUG(1, ("wbem session pool: reconnecting to %s\n", s->server));
+        s->retried = True;
+        wbem_session_pool(s->com_ctx, False)->stats.reconnects++;
+        wbem_pool_query_connect(c);
+        return;
+    }
+    composite_error(c, werror_to_ntstatus(result));
+}
+
+static void wbem_pool_query_connected(struct composite_context *ctx)
+{
+    struct composite_context *c = NULL;
+    struct wbem_pool_query_state *s = NULL;
+    struct composite_context *new_ctx = NULL;
+    struct wbem_session_connect_state *cs;
+    WERROR result;
+
+    c = talloc_get_type(ctx->async.private_data, struct composite_context);
+    s = talloc_get_type(c->private_data, struct wbem_pool_query_state);
+
+    /* a session that came out of the pool is the one worth retrying */
+    cs = talloc_get_type(ctx->private_data, struct wbem_session_connect_state);
+    s->pooled = cs != NULL && cs->reused;
+
+    result = WBEM_SessionPool_Connect_recv(ctx, &s->services);
+    if (!W_ERROR_IS_OK(result))
+    {
+        composite_error(c, werror_to_ntstatus(result));
+        return;
+    }
+
+    new_ctx = IWbemServices_ExecQuery_send(s->services, c, s->language,
+            s->query, s->flags, NULL);
+    if (new_ctx == NULL)
+    {
+        WBEM_SessionPool_Release(s->com_ctx, s->services, WERR_NOMEM);
+        s->services = NULL;
+        composite_error(c, NT_STATUS_NO_MEMORY);
+        return;
+    }
+    composite_continue(c, new_ctx, wbem_pool_query_continue, c);
+}
+
+static void wbem_pool_query_connect(struct composite_context *c)
+{
+    struct wbem_pool_query_state *s = talloc_get_type(c->private_data,
+            struct wbem_pool_query_state);
+    struct composite_context *new_ctx = NULL;
+
+    new_ctx = WBEM_SessionPool_Connect_send(s->com_ctx, c, s->server,
+            s->nspace, s->user, s->password, NULL, 0, NULL, NULL);
+    if (composite_nomem(new_ctx, c)) return;
+
+    composite_continue(c, new_ctx, wbem_pool_query_connected, c);
+}
+
+struct composite_context *WBEM_SessionPool_ExecQuery_send(
+        struct com_context *com_ctx, TALLOC_CTX *parent_ctx,
+        const char *server, const char *nspace, const char *user,
+        const char *password, const char *language, const char *query,
+        int32_t flags)
+{
+    struct composite_context *c = NULL;
+    struct wbem_pool_query_state *s = NULL;
+
+    c = composite_create(parent_ctx, com_ctx->event_ctx);
+    if (c == NULL) return NULL;
+
+    s = talloc_zero(c, struct wbem_pool_query_state);
+    if (composite_nomem(s, c)) return c;
+    c->private_data = s;
+
+    s->com_ctx = com_ctx;
+    s->server = talloc_strdup(s, server);
+    s->nspace = talloc_strdup(s, nspace);
+    s->user = talloc_strdup(s, user);
+    s->password = talloc_strdup(s, password);
+    s->language = talloc_strdup(s, language);
+    s->query = talloc_strdup(s, query);
+    s->flags = flags;
+    if (composite_nomem(s->query, c)) return c;
+
+    wbem_pool_query_connect(c);
+    return c;
+}
+
+WERROR WBEM_SessionPool_ExecQuery_recv(struct composite_context *c,
+        TALLOC_CTX *parent_ctx, struct IWbemServices **services,
+        struct IEnumWbemClassObject **ppEnum)
+{
+    WERROR result;
+
+    NTSTATUS status = composite_wait(c);
+    if (!NT_STATUS_IS_OK(status))
+    {
+        result = ntstatus_to_werror(status);
+    }
+    else
+    {
+        struct wbem_pool_query_state *s = talloc_get_type(c->private_data,
+                struct wbem_pool_query_state);
+
+        *services = s->services;
+        *ppEnum = talloc_steal(parent_ctx, s->pEnum);
+        result = WERR_OK;
+    }
+
+    talloc_free(c);
+    return result;
+}
+
+/*
+ * Change the limits of the session pool; 0 leaves a limit unchanged.
+ */
+void WBEM_SessionPool_SetLimits(struct com_context *ctx,
+        uint32_t max_sessions, uint32_t idle_timeout)
+{
+    struct wbem_session_pool *pool = wbem_session_pool(ctx, True);
+
+    if (pool == NULL) return;
+    if (max_sessions) pool->max_sessions = max_sessions;
+    if (idle_timeout) pool->idle_timeout = idle_timeout;
+    wbem_session_pool_schedule(pool);
+}
+
+void WBEM_SessionPool_Stats(struct com_context *ctx,
+        struct wbem_session_pool_stats *stats)
+{
+    struct wbem_session_pool *pool = wbem_session_pool(ctx, False);
+
+    if (pool) {
+        *stats = pool->stats;
+    } else {
+        ZERO_STRUCTP(stats);
+    }
+}
+
+/*
+ * Drop every idle session, releasing its IWbemServices pointer.
+ */
+void WBEM_SessionPool_Flush(struct com_context *ctx)
+{
+    struct wbem_session_pool *pool = wbem_session_pool(ctx, False);
+    struct wbem_session *ws, *next;
+
+    if (pool == NULL) return;
+    for (ws = pool->sessions; ws; ws = next)
+    {
+        next = ws->next;
+        if (ws->users == 0) wbem_session_drop(ws, True);
+    }
+    wbem_session_pool_schedule(pool);
+
+    /* don't leave the releases waiting for the batch timer */
+    dcom_release_flush(ctx);
+}
+
 struct werror_code_struct {
         const char *dos_errstr;
         WERROR werror;
@@ -19,6 +19,7 @@
  */
 
 #include "includes.h"
+#include "system/select.h" /* needed for WITH_EPOLL */
 #include "lib/events/events.h"
 #include "lib/events/events_internal.h"
 #include "lib/util/dlinklist.h"
@@ -26,10 +27,11 @@
 #include "zenoss_events.h"
 
 
-/* to mark the ev->maxfd invalid
- * this means we need to recalculate it
- */
-#define EVENT_INVALID_MAXFD (-1)
+/* the fd table grows in steps of this many slots */
+#define ZENOSS_FD_TABLE_CHUNK 256
+
+/* the most descriptors handled per readiness of the epoll fd */
+#define ZENOSS_EPOLL_MAXEVENTS 64
 
 /**
  * Our event context will maintain state for all of the outstanding events
@@ -48,8 +50,18 @@ struct zenoss_event_context
     /* a list of timed events */
     struct timed_event* timed_events;
 
-    /* the maximum file descriptor number in fd_events */
-    int maxfd;
+    /*
+     * the fd_events indexed by their descriptor, so that a readiness
+     * notification is dispatched without scanning fd_events
+     */
+    struct fd_event** fd_table;
+    int fd_table_size;
+
+    /*
+     * when using epoll this is the handle from epoll_create, which is the
+     * only descriptor handed to the reactor; -1 otherwise
+     */
+    int epoll_fd;
 
      /* this is changed by the destructors for the fd event
      type. It is used to detect event destruction by event
@@ -65,6 +77,15 @@ struct zenoss_event_context
     struct reactor_functions functions;
 };
 
+/**
+ * what zenoss_event_context_init passes on to local_event_context_init
+ */
+struct zenoss_event_init
+{
+    struct reactor_functions* funcs;
+    BOOL try_epoll;
+};
+
 /**
  * forward reference
  */
@@ -72,9 +93,135 @@ static const struct event_ops *local_event_get_ops(void);
 static void local_event_loop_timer(struct zenoss_event_context *zenoss_ev);
 static int local_event_context_init(struct event_context *ev,
 				    void *private_data);
-static void local_calc_maxfd(struct zenoss_event_context *zenoss_ev);
 static int local_event_timed_destructor(struct timed_event *te);
 
+/* use epoll if it is available */
+#if WITH_EPOLL
+#define ZENOSS_ADDITIONAL_FD_FLAG_HAS_EVENT	(1<<0)
+
+/*
+ map from EVENT_FD_* to EPOLLIN/EPOLLOUT
+ */
+static uint32_t local_epoll_map_flags(uint16_t flags)
+{
+    uint32_t ret = 0;
+    if (flags & EVENT_FD_READ) ret |= (EPOLLIN | EPOLLERR | EPOLLHUP);
+    if (flags & EVENT_FD_WRITE) ret |= (EPOLLOUT | EPOLLERR | EPOLLHUP);
+    return ret;
+}
+
+/*
+ stop the reactor watching the epoll fd and close it
+ */
+static int local_epoll_ctx_destructor(struct zenoss_event_context *zenoss_ev)
+{
+    zenoss_ev->functions.update_reactor_callback(zenoss_ev->epoll_fd, 0);
+    close(zenoss_ev->epoll_fd);
+    zenoss_ev->epoll_fd = -1;
+    return 0;
+}
+
+/*
+ create the epoll fd and hand it to the reactor in place of the sockets
+ */
+static void local_epoll_init(struct zenoss_event_context *zenoss_ev)
+{
+    zenoss_ev->epoll_fd = epoll_create(64);
+    if (zenoss_ev->epoll_fd == -1)
+    {
+        DEBUG(0, ("epoll_create failed (%s) - passing sockets to the reactor\n",
+                  strerror(errno)));
+        return;
+    }
+    talloc_set_destructor(zenoss_ev, local_epoll_ctx_destructor);
+    zenoss_ev->functions.update_reactor_callback(zenoss_ev->epoll_fd, EVENT_FD_READ);
+}
+
+/*
+ add, change or (with no flags) delete the epoll event of the fd_event
+ */
+static void local_epoll_update(struct zenoss_event_context *zenoss_ev,
+			       struct fd_event *fde, uint16_t flags)
+{
+    struct epoll_event event;
+    int op;
+
+    ZERO_STRUCT(event);
+    event.events = local_epoll_map_flags(flags);
+    event.data.ptr = fde;
+
+    if (flags == 0)
+    {
+        if (!(fde->additional_flags & ZENOSS_ADDITIONAL_FD_FLAG_HAS_EVENT)) return;
+        /* fails harmlessly if the socket has already been closed */
+        epoll_ctl(zenoss_ev->epoll_fd, EPOLL_CTL_DEL, fde->fd, &event);
+        fde->additional_flags &= ~ZENOSS_ADDITIONAL_FD_FLAG_HAS_EVENT;
+        return;
+    }
+
+    op = (fde->additional_flags & ZENOSS_ADDITIONAL_FD_FLAG_HAS_EVENT) ?
+        EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    if (epoll_ctl(zenoss_ev->epoll_fd, op, fde->fd, &event) != 0)
+    {
+        DEBUG(0, ("epoll_ctl failed for fd %d (%s)\n", fde->fd, strerror(errno)));
+        return;
+    }
+    fde->additional_flags |= ZENOSS_ADDITIONAL_FD_FLAG_HAS_EVENT;
+}
+
+/*
+ the epoll fd is readable: call the handlers of the sockets that are ready.
+ The epoll fd is level triggered, so whatever is left over when a handler
+ destroys an fd_event keeps it readable for the next round.
+ */
+static void local_epoll_dispatch(struct zenoss_event_context *zenoss_ev)
+{
+    struct epoll_event events[ZENOSS_EPOLL_MAXEVENTS];
+    uint32_t destruction_count = zenoss_ev->destruction_count;
+    int ret, i;
+
+    ret = epoll_wait(zenoss_ev->epoll_fd, events, ZENOSS_EPOLL_MAXEVENTS, 0);
+    if (ret == -1)
+    {
+        if (errno != EINTR)
+        {
+            DEBUG(0, ("epoll_wait failed (%s)\n", strerror(errno)));
+        }
+        return;
+    }
+
+    for (i = 0; i < ret; i++)
+    {
+        struct fd_event *fde = talloc_get_type(events[i].data.ptr, struct fd_event);
+        uint16_t flags = 0;
+
+        if (fde == NULL)
+        {
+            continue;
+        }
+        if (events[i].events & (EPOLLHUP | EPOLLERR))
+        {
+            /* let the handler find the error on whatever it waits for */
+            flags |= (fde->flags & EVENT_FD_READ) ? EVENT_FD_READ : EVENT_FD_WRITE;
+        }
+        if (events[i].events & EPOLLIN) flags |= EVENT_FD_READ;
+        if (events[i].events & EPOLLOUT) flags |= EVENT_FD_WRITE;
+
+        fde->handler(zenoss_ev->ev, fde, flags, fde->private_data);
+        if (destruction_count != zenoss_ev->destruction_count)
+        {
+            DEBUG(9, ("fd_event destruction (#%u) detected in local_epoll_dispatch\n",
+                      zenoss_ev->destruction_count));
+            break;
+        }
+    }
+}
+#else
+#define local_epoll_init(zenoss_ev)
+#define local_epoll_update(zenoss_ev, fde, flags)
+#define local_epoll_dispatch(zenoss_ev)
+#endif
+
 /*
  create a event_context structure. This must be the first events
  call, and all subsequent calls pass this event_context as the first
@@ -85,8 +232,28 @@ struct event_context *zenoss_event_context_init(TALLOC_CTX *mem_ctx,
 {
     DEBUG_FN_ENTER;
     const struct event_ops *ops = local_event_get_ops();
+    struct zenoss_event_init init = { funcs, False };
 
-    struct event_context *newContext = event_context_init_ops(mem_ctx, ops, funcs);
+    struct event_context *newContext = event_context_init_ops(mem_ctx, ops, &init);
+    DEBUG_FN_EXIT;
+    return newContext;
+}
+
+/*
+ like zenoss_event_context_init(), but if the system supports it all sockets
+ are watched through a single epoll descriptor. That is the only descriptor
+ passed to update_reactor_callback, and zenoss_read_ready on it dispatches
+ whatever sockets are ready. Falls back to passing every socket to the
+ reactor when epoll is not available.
+ */
+struct event_context *zenoss_event_context_init_epoll(TALLOC_CTX *mem_ctx,
+						      struct reactor_functions *funcs)
+{
+    DEBUG_FN_ENTER;
+    const struct event_ops *ops = local_event_get_ops();
+    struct zenoss_event_init init = { funcs, True };
+
+    struct event_context *newContext = event_context_init_ops(mem_ctx, ops, &init);
     DEBUG_FN_EXIT;
     return newContext;
 }
@@ -139,25 +306,25 @@ void zenoss_read_ready(struct event_context* event_ctx, int fd)
         DEBUG_FN_FAIL("zenoss_ev == NULL: not of type struct zenoss_event_context");
     }
 
-    uint32_t destruction_count = zenoss_ev->destruction_count;
-
-    struct fd_event *fde;
+    if (zenoss_ev->epoll_fd != -1 && fd == zenoss_ev->epoll_fd)
+    {
+        local_epoll_dispatch(zenoss_ev);
+        DEBUG_FN_EXIT;
+        return;
+    }
 
-    for (fde = zenoss_ev->fd_events; fde; fde = fde->next)
+    if (fd < 0 || fd >= zenoss_ev->fd_table_size || zenoss_ev->fd_table[fd] == NULL)
     {
-        if (fde->fd == fd)
-        {
-            fde->flags |= EVENT_FD_READ;
-
-            fde->handler(event_ctx, fde, EVENT_FD_READ, fde->private_data);
-            if (destruction_count != zenoss_ev->destruction_count)
-            {
-                DEBUG(9, ("fd_event destruction (#%u) detected in zenoss_read_ready: %p\n", zenoss_ev->destruction_count, fde));
-                break;
-            }
-        }
+        DEBUG(9, ("zenoss_read_ready: no fd_event for fd %d\n", fd));
+        DEBUG_FN_EXIT;
+        return;
     }
 
+    struct fd_event *fde = zenoss_ev->fd_table[fd];
+
+    fde->flags |= EVENT_FD_READ;
+    fde->handler(event_ctx, fde, EVENT_FD_READ, fde->private_data);
+
     DEBUG_FN_EXIT;
 }
 
@@ -175,29 +342,19 @@ void zenoss_write_ready(struct event_context* event_ctx, int fd)
 	{
 	    DEBUG_FN_FAIL("zenoss_ev == NULL: not of type struct zenoss_event_context");
 	}
-	else if (zenoss_ev->fd_events == NULL)
-	{
-        DEBUG_FN_FAIL("zenoss_ev->fd_events == NULL");
-	}
-
-    uint32_t destruction_count = zenoss_ev->destruction_count;
 
-    struct fd_event *fde;
-
-    for (fde = zenoss_ev->fd_events; fde; fde = fde->next)
+    if (fd < 0 || fd >= zenoss_ev->fd_table_size || zenoss_ev->fd_table[fd] == NULL)
     {
-        if (fde->fd == fd)
-        {
-            fde->flags |= EVENT_FD_WRITE;
-            fde->handler(event_ctx, fde, EVENT_FD_WRITE, fde->private_data);
-            if (destruction_count != zenoss_ev->destruction_count)
-            {
-                DEBUG(9, ("fd_event destruction detected in zenoss_write_ready: %p\n", fde));
-                break;
-            }
-        }
+        DEBUG(9, ("zenoss_write_ready: no fd_event for fd %d\n", fd));
+        DEBUG_FN_EXIT;
+        return;
     }
 
+    struct fd_event *fde = zenoss_ev->fd_table[fd];
+
+    fde->flags |= EVENT_FD_WRITE;
+    fde->handler(event_ctx, fde, EVENT_FD_WRITE, fde->private_data);
+
     DEBUG_FN_EXIT;
 }
 
@@ -247,39 +404,66 @@ static int local_event_context_init(struct event_context *ev,
 {
     DEBUG_FN_ENTER;
     struct zenoss_event_context* zenoss_ev;
-    struct reactor_functions* funcs = (struct reactor_functions *)private_data;
+    struct zenoss_event_init* init = (struct zenoss_event_init *)private_data;
     zenoss_ev = talloc_zero(ev, struct zenoss_event_context);
     if (!zenoss_ev) {
         DEBUG_FN_FAIL("Out of memory: talloc_zero(zenoss_event_context) failed.");
         return -1;
     }
     zenoss_ev->ev = ev;
-    zenoss_ev->functions = *funcs;
+    zenoss_ev->functions = *init->funcs;
+    zenoss_ev->epoll_fd = -1;
 
     ev->additional_data = zenoss_ev;
+
+    if (init->try_epoll)
+    {
+        local_epoll_init(zenoss_ev);
+    }
     DEBUG_FN_EXIT;
     return 0;
 }
 
 /*
- recalculate the maxfd
+ make room in the fd table for the given descriptor
  */
-static void local_calc_maxfd(struct zenoss_event_context *zenoss_ev)
+static BOOL local_fd_table_grow(struct zenoss_event_context *zenoss_ev, int fd)
 {
-    DEBUG_FN_ENTER;
+    struct fd_event **table;
+    int size;
 
-    struct fd_event *fde;
+    if (fd < zenoss_ev->fd_table_size)
+    {
+        return True;
+    }
 
-    zenoss_ev->maxfd = 0;
-    for (fde = zenoss_ev->fd_events; fde; fde = fde->next)
+    size = (fd / ZENOSS_FD_TABLE_CHUNK + 1) * ZENOSS_FD_TABLE_CHUNK;
+    table = talloc_realloc(zenoss_ev, zenoss_ev->fd_table, struct fd_event *, size);
+    if (table == NULL)
     {
-        if (fde->fd > zenoss_ev->maxfd)
-        {
-            zenoss_ev->maxfd = fde->fd;
-        }
+        return False;
     }
+    memset(&table[zenoss_ev->fd_table_size], 0,
+           (size - zenoss_ev->fd_table_size) * sizeof(struct fd_event *));
+    zenoss_ev->fd_table = table;
+    zenoss_ev->fd_table_size = size;
+    return True;
+}
 
-    DEBUG_FN_EXIT;
+/*
+ tell whoever watches the sockets what we want to know about the fd_event
+ */
+static void local_update_fd(struct zenoss_event_context *zenoss_ev,
+			    struct fd_event *fde, uint16_t flags)
+{
+    if (zenoss_ev->epoll_fd != -1)
+    {
+        local_epoll_update(zenoss_ev, fde, flags);
+    }
+    else
+    {
+        zenoss_ev->functions.update_reactor_callback(fde->fd, flags);
+    }
 }
 
 /*
@@ -298,12 +482,12 @@ static int local_event_fd_destructor(struct fd_event *fde)
 
     DEBUG(9, ("event_destructor: fd=%d\n", fde->fd));
 
-    if (zenoss_ev->maxfd == fde->fd)
+    DLIST_REMOVE(zenoss_ev->fd_events, fde);
+    if (fde->fd < zenoss_ev->fd_table_size && zenoss_ev->fd_table[fde->fd] == fde)
     {
-        zenoss_ev->maxfd = EVENT_INVALID_MAXFD;
+        zenoss_ev->fd_table[fde->fd] = NULL;
+        local_update_fd(zenoss_ev, fde, 0);
     }
-    DLIST_REMOVE(zenoss_ev->fd_events, fde);
-    zenoss_ev->functions.update_reactor_callback(fde->fd, 0);
 
     zenoss_ev->destruction_count++;
 
@@ -342,16 +526,26 @@ static struct fd_event *local_event_add_fd(struct event_context *ev,
     fde->additional_flags = 0;
     fde->additional_data = NULL;
 
-    DLIST_ADD(zenoss_ev->fd_events, fde);
-    if (fde->fd > zenoss_ev->maxfd)
+    if (fd < 0 || !local_fd_table_grow(zenoss_ev, fd))
+    {
+        DEBUG_FN_FAIL("Out of memory: growing the fd table failed.");
+        talloc_free(fde);
+        return NULL;
+    }
+    if (zenoss_ev->fd_table[fd] != NULL)
     {
-        zenoss_ev->maxfd = fde->fd;
+        /* a socket has a single handler, the new event replaces the old */
+        DEBUG(0, ("event_add_fd: fd %d already has an fd_event\n", fd));
+        local_update_fd(zenoss_ev, zenoss_ev->fd_table[fd], 0);
     }
+    zenoss_ev->fd_table[fd] = fde;
+
+    DLIST_ADD(zenoss_ev->fd_events, fde);
     talloc_set_destructor(fde, local_event_fd_destructor);
 
     // update the reactor since we might need to update our read or write
     // selector
-    zenoss_ev->functions.update_reactor_callback(fde->fd, flags);
+    local_update_fd(zenoss_ev, fde, flags);
 
     DEBUG_FN_EXIT;
     return fde;
@@ -386,7 +580,10 @@ static void local_event_set_fd_flags(struct fd_event *fde, uint16_t flags)
         DEBUG_FN_FAIL("zenoss_ev == NULL: not of type struct zenoss_event_context");
     }
 
-    zenoss_ev->functions.update_reactor_callback(fde->fd, flags);
+    if (zenoss_ev->fd_table[fde->fd] == fde)
+    {
+        local_update_fd(zenoss_ev, fde, flags);
+    }
     DEBUG_FN_EXIT;
 }
 
@@ -28,5 +28,15 @@ struct reactor_functions {
 
 struct event_context *zenoss_event_context_init(TALLOC_CTX *mem_ctx, 
 						struct reactor_functions *funcs);
+struct event_context *zenoss_event_context_init_epoll(TALLOC_CTX *mem_ctx,
+						      struct reactor_functions *funcs);
+
+void zenoss_get_next_timeout(struct event_context *event_ctx,
+			     struct timeval *timeout);
+void zenoss_read_ready(struct event_context *event_ctx, int fd);
+void zenoss_write_ready(struct event_context *event_ctx, int fd);
+
+void async_wmi_lib_init(void);
+struct event_context *async_create_context(struct reactor_functions *funcs);
 
 #endif /* ZENOSS_EVENTS_H_ */
@@ -177,6 +177,20 @@ library.talloc_total_size = logFuncCall(library.talloc_total_size)
 library.talloc_total_blocks.restype = c_size_t
 library.talloc_total_blocks.argtypes = [c_void_p]
 library.talloc_total_blocks = logFuncCall(library.talloc_total_blocks)
+class talloc_memstats(Structure):
+    _fields_ = [
+        ('bytes', size_t),
+        ('blocks', size_t),
+        ('peak_bytes', size_t),
+        ('max_bytes', size_t),
+        ('failures', size_t),
+        ]
+library.talloc_set_memlimit.restype = c_int
+library.talloc_set_memlimit.argtypes = [c_void_p, size_t]
+library.talloc_set_memlimit = logFuncCall(library.talloc_set_memlimit)
+library.talloc_get_memstats.restype = c_int
+library.talloc_get_memstats.argtypes = [c_void_p, POINTER(talloc_memstats)]
+library.talloc_get_memstats = logFuncCall(library.talloc_get_memstats)
 library.talloc_report_depth_file.restype = None
 library.talloc_report_depth_file.argtypes = [c_void_p, c_int, c_int, c_void_p]
 library.talloc_report_depth_file = logFuncCall(library.talloc_report_depth_file)
@@ -13,7 +13,7 @@
 
 __doc__= "Re-implement the talloc macros in a python-compatible way"
 
-from pysamba.library import library, logFuncCall
+from pysamba.library import library, logFuncCall, talloc_memstats
 from ctypes import *
 class TallocError(Exception): pass
 
@@ -69,3 +69,15 @@ def talloc_array(ctx, type, count):
 talloc_free = library.talloc_free
 talloc_increase_ref_count = library.talloc_increase_ref_count
 talloc_get_name = library.talloc_get_name
+
+def talloc_set_memlimit(ctx, maxBytes):
+    "count the memory below ctx, and refuse allocations over maxBytes (0: no limit)"
+    if library.talloc_set_memlimit(ctx, maxBytes) != 0:
+        raise TallocError("Out of memory setting a memory limit")
+
+def talloc_get_memstats(ctx):
+    "the counters of a context given to talloc_set_memlimit, or None"
+    stats = talloc_memstats()
+    if library.talloc_get_memstats(ctx, byref(stats)) != 0:
+        return None
+    return stats
@@ -0,0 +1,60 @@
+###########################################################################
+#
+# This program is part of Zenoss Core, an open source monitoring platform.
+# Copyright (C) 2008-2010, Zenoss Inc.
+#
+# This program is free software; you can redistribute it and/or modify it
+# under the terms of the GNU General Public License version 2, or (at your
+# option) any later version, as published by the Free Software Foundation.
+#
+# For complete information please visit: http://www.zenoss.com/oss/
+#
+###########################################################################
+
+from ctypes import *
+
+from pysamba.library import *
+from pysamba.talloc import *
+from pysamba.wbem.wbem import *
+from pysamba.wbem.Query import Query
+import sys
+
+import logging
+log = logging.getLogger('p.t.memstats')
+
+def check(what, ok):
+    if not ok:
+        raise AssertionError(what)
+
+def main():
+    logging.basicConfig()
+
+    ctx = library.talloc_named_const(None, 0, "memstats")
+    check("stats without a limit", talloc_get_memstats(ctx) is None)
+
+    talloc_set_memlimit(ctx, 4096)
+    p = library.talloc_named_const(ctx, 1000, "p")
+    check("allocation under the limit", p)
+    stats = talloc_get_memstats(ctx)
+    check("stats with a limit", stats is not None)
+    check("bytes counted", stats.bytes >= 1000)
+    check("blocks counted", stats.blocks >= 1)
+    check("limit reported", stats.max_bytes == 4096)
+    check("no failures yet", stats.failures == 0)
+
+    check("allocation over the limit",
+          not library.talloc_named_const(ctx, 8192, "big"))
+    check("failure counted", talloc_get_memstats(ctx).failures == 1)
+
+    # the per host view of the same counters
+    q = Query()
+    check("stats before connect", q.memoryStats() is None)
+    q.ctx = cast(ctx, POINTER(com_context))
+    stats = q.memoryStats()
+    check("stats of a host", stats is not None and stats.bytes >= 1000)
+    q.close()
+
+    print "memstats: ok"
+    return 0
+
+sys.exit(main())
@@ -139,29 +139,42 @@ class QueryResult(object):
                 )
             yield deferred(ctx); driver.next()
 
-            result = library.IEnumWbemClassObject_SmartNext_recv(
-                ctx, self.ctx, objs, byref(count)
-                )
+            # everything decoded for this batch lives in the arena, so
+            # long running enumerations do not grow self.ctx
+            arena = library.WBEMDATA_BatchArena(self.ctx)
+            try:
+                result = library.IEnumWbemClassObject_SmartNext_recv(
+                    ctx, arena, objs, byref(count)
+                    )
 
-            WERR_CHECK(result, self._deviceId, "Retrieve result data.")
+                WERR_CHECK(result, self._deviceId, "Retrieve result data.")
 
-            result = []
-            for i in range(count.value):
-                result.append(wbemInstanceToPython(objs[i]))
-                talloc_free(objs[i])
+                result = []
+                for i in range(count.value):
+                    result.append(wbemInstanceToPython(objs[i]))
+            finally:
+                talloc_free(arena)
             driver.finish(result)
         return drive(inner)
 
 
 class Query(object):
+    # bytes a host may have allocated at once, None to not count them;
+    # queries that would go over it fail with an out of memory error
+    memoryLimit = None
+
     def __init__(self):
         self.ctx = POINTER(com_context)()
         self.pWS = POINTER(IWbemServices)()
         self._deviceId = None
+        self._namespace = None
 
     def connect(self, eventContext, deviceId, hostname, creds, namespace="root\\cimv2"):
         self._deviceId = deviceId
+        self._namespace = namespace
         library.com_init_ctx(byref(self.ctx), eventContext)
+        if self.memoryLimit is not None:
+            talloc_set_memlimit(self.ctx, self.memoryLimit)
 
         cred = library.cli_credentials_init(self.ctx)
         library.cli_credentials_set_conf(cred)
@@ -205,6 +218,8 @@ class Query(object):
                 result = library.IWbemServices_ExecQuery_recv(qctx,
                                                               byref(pEnum))
                 WERR_CHECK(result, self._deviceId, "ExecQuery")
+                library.IEnumWbemClassObject_SetNamespace(pEnum,
+                                                          self._namespace)
                 ctx = library.IEnumWbemClassObject_Reset_send_f(pEnum, self.ctx)
                 yield deferred(ctx); driver.next()
                 result = library.IEnumWbemClassObject_Reset_recv(ctx);
@@ -234,6 +249,8 @@ class Query(object):
                 result = library.IWbemServices_ExecNotificationQuery_recv(
                     qctx, byref(pEnum))
                 WERR_CHECK(result, self._deviceId, "ExecNotificationQuery")
+                library.IEnumWbemClassObject_SetNamespace(pEnum,
+                                                          self._namespace)
                 driver.finish(QueryResult(self._deviceId, self.ctx, pEnum))
             except Exception, ex:
                 if pEnum:
@@ -246,6 +263,12 @@ class Query(object):
         return drive(inner)
 
 
+    def memoryStats(self):
+        "bytes, blocks, peak_bytes, max_bytes and failures of this host, or None"
+        if not self.ctx:
+            return None
+        return talloc_get_memstats(self.ctx)
+
     def __del__(self):
         self.close()
 
@@ -206,6 +206,11 @@ class WbemInstance(Structure):
         ('data', POINTER(CIMVAR)),
         ('u2_4', uint32_t),
         ('u3_1', uint8_t),
+        ('lazy_data', POINTER(uint8_t)),
+        ('lazy_size', uint32_t),
+        ('lazy_ofs', uint32_t),
+        ('lazy_base', uint32_t),
+        ('lazy_decoded', POINTER(uint8_t)),
         ]
 
 WbemClassObject._fields_ = [
@@ -273,6 +278,9 @@ library.IEnumWbemClassObject_SmartNext_recv = logFuncCall(library.IEnumWbemClass
 library.IEnumWbemClassObject_SmartNext.restype = WERROR
 library.IEnumWbemClassObject_SmartNext.argtypes = [POINTER(IEnumWbemClassObject), c_void_p, c_int32, c_uint32, c_void_p, c_void_p]
 library.IEnumWbemClassObject_SmartNext = logFuncCall(library.IEnumWbemClassObject_SmartNext)
+library.WBEMDATA_BatchArena.restype = c_void_p
+library.WBEMDATA_BatchArena.argtypes = [c_void_p]
+library.WBEMDATA_BatchArena = logFuncCall(library.WBEMDATA_BatchArena)
 library.wmi_errstr.restype = c_char_p
 library.wmi_errstr.argtypes = [WERROR]
 library.wmi_errstr = logFuncCall(library.wmi_errstr)